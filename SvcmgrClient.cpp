@@ -0,0 +1,356 @@
+// vim600: fdm=marker
+/* -*- c++ -*- */
+///////////////////////////////////////////
+// Service Manager
+// -------------------------------------
+// file       : SvcmgrClient.cpp
+// author     : Ben Kietzman
+// begin      : 2019-02-18
+// copyright  : kietzman.org
+// email      : ben@kietzman.org
+///////////////////////////////////////////
+
+/**************************************************************************
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+**************************************************************************/
+
+/*! \file SvcmgrClient.cpp
+* \brief Service Manager Client Library
+*/
+// {{{ includes
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "SvcmgrClient.h"
+// }}}
+// {{{ SvcmgrClient()
+SvcmgrClient::SvcmgrClient(const string strSocket) : m_bStop(false)
+{
+  m_fdSocket = -1;
+  m_unId = 0;
+  m_strSocket = strSocket;
+  if (pipe2(m_fdWake, O_CLOEXEC | O_NONBLOCK) != 0)
+  {
+    m_fdWake[0] = m_fdWake[1] = -1;
+  }
+  m_ptThread = new thread(&SvcmgrClient::process, this);
+}
+// }}}
+// {{{ ~SvcmgrClient()
+SvcmgrClient::~SvcmgrClient()
+{
+  list<string> replies;
+
+  m_bStop = true;
+  if (m_fdWake[1] != -1)
+  {
+    while (write(m_fdWake[1], "", 1) < 0 && errno == EINTR);
+  }
+  m_ptThread->join();
+  delete m_ptThread;
+  m_mutex.lock();
+  // watch callbacks are dropped rather than told the client was destroyed
+  for (map<size_t, string>::iterator i = m_watches.begin(); i != m_watches.end(); i++)
+  {
+    m_callbacks.erase(i->first);
+  }
+  m_watches.clear();
+  disconnect("The client was destroyed.", replies);
+  m_mutex.unlock();
+  for (list<string>::iterator i = replies.begin(); i != replies.end(); i++)
+  {
+    dispatch(*i);
+  }
+  m_callbacks.clear();
+  for (size_t i = 0; i < 2; i++)
+  {
+    if (m_fdWake[i] != -1)
+    {
+      close(m_fdWake[i]);
+    }
+  }
+}
+// }}}
+// {{{ connect()
+bool SvcmgrClient::connect(string &strError)
+{
+  bool bResult = false;
+  stringstream ssError;
+
+  if ((m_fdSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) >= 0)
+  {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_strSocket.c_str(), (sizeof(addr.sun_path) - 1));
+    if (::connect(m_fdSocket, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0)
+    {
+      bResult = true;
+    }
+    else
+    {
+      ssError << "connect(" << errno << ") error [" << m_strSocket << "]:  " << strerror(errno);
+      close(m_fdSocket);
+      m_fdSocket = -1;
+    }
+  }
+  else
+  {
+    ssError << "socket(" << errno << ") error:  " << strerror(errno);
+  }
+  strError = ssError.str();
+
+  return bResult;
+}
+// }}}
+// {{{ disconnect()
+void SvcmgrClient::disconnect(const string strError, list<string> &replies)
+{
+  string strJson;
+
+  if (m_fdSocket != -1)
+  {
+    close(m_fdSocket);
+    m_fdSocket = -1;
+  }
+  m_strBuffer[0].clear();
+  m_strBuffer[1].clear();
+  for (map<size_t, function<void(Json *)> >::iterator i = m_callbacks.begin(); i != m_callbacks.end(); i++)
+  {
+    stringstream ssId;
+    Json *ptReply = new Json;
+    ssId << i->first;
+    ptReply->insert("Id", ssId.str());
+    ptReply->insert("Status", "error");
+    ptReply->insert("Error", strError);
+    replies.push_back(ptReply->json(strJson));
+    delete ptReply;
+  }
+  // watch requests are sent again as soon as the next connection is made
+  for (map<size_t, string>::iterator i = m_watches.begin(); i != m_watches.end(); i++)
+  {
+    m_strBuffer[1].append(i->second);
+  }
+}
+// }}}
+// {{{ dispatch()
+void SvcmgrClient::dispatch(const string strLine)
+{
+  Json *ptReply = new Json(strLine);
+
+  if (ptReply->m.find("Id") != ptReply->m.end() && !ptReply->m["Id"]->v.empty())
+  {
+    bool bFound = false, bWatch = false;
+    size_t unId = strtoul(ptReply->m["Id"]->v.c_str(), NULL, 10);
+    function<void(Json *)> callback;
+    m_mutex.lock();
+    if (m_callbacks.find(unId) != m_callbacks.end())
+    {
+      bFound = true;
+      callback = m_callbacks[unId];
+      if (m_watches.find(unId) != m_watches.end())
+      {
+        bWatch = true;
+      }
+      else
+      {
+        m_callbacks.erase(unId);
+      }
+    }
+    m_mutex.unlock();
+    // the acknowledgement of a watch request carries no event
+    if (bFound && (!bWatch || ptReply->m.find("Response") != ptReply->m.end() || ptReply->m.find("Status") == ptReply->m.end() || ptReply->m["Status"]->v != "okay"))
+    {
+      callback(ptReply);
+    }
+  }
+  delete ptReply;
+}
+// }}}
+// {{{ process()
+void SvcmgrClient::process()
+{
+  char szBuffer[65536];
+  list<string> replies;
+  time_t CRetry = 0;
+
+  while (!m_bStop)
+  {
+    int nReturn;
+    nfds_t unCount = 1;
+    pollfd fds[2];
+    fds[0].fd = m_fdWake[0];
+    fds[0].events = POLLIN;
+    m_mutex.lock();
+    if (m_fdSocket == -1 && (!m_strBuffer[1].empty() || !m_watches.empty()) && time(NULL) >= CRetry)
+    {
+      string strError;
+      if (!connect(strError))
+      {
+        CRetry = time(NULL) + 1;
+        disconnect(strError, replies);
+      }
+    }
+    if (m_fdSocket != -1)
+    {
+      fds[1].fd = m_fdSocket;
+      fds[1].events = POLLIN;
+      if (!m_strBuffer[1].empty())
+      {
+        fds[1].events |= POLLOUT;
+      }
+      unCount = 2;
+    }
+    m_mutex.unlock();
+    for (list<string>::iterator i = replies.begin(); i != replies.end(); i++)
+    {
+      dispatch(*i);
+    }
+    replies.clear();
+    if ((nReturn = poll(fds, unCount, 1000)) > 0)
+    {
+      if (fds[0].revents & POLLIN)
+      {
+        while (read(fds[0].fd, szBuffer, sizeof(szBuffer)) > 0);
+      }
+      if (unCount == 2 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+      {
+        if ((nReturn = read(fds[1].fd, szBuffer, sizeof(szBuffer))) > 0)
+        {
+          size_t unPosition;
+          m_mutex.lock();
+          m_strBuffer[0].append(szBuffer, nReturn);
+          while ((unPosition = m_strBuffer[0].find('\n')) != string::npos)
+          {
+            replies.push_back(m_strBuffer[0].substr(0, unPosition));
+            m_strBuffer[0].erase(0, (unPosition + 1));
+          }
+          m_mutex.unlock();
+        }
+        else if (nReturn == 0 || (errno != EAGAIN && errno != EINTR))
+        {
+          stringstream ssError;
+          if (nReturn == 0)
+          {
+            ssError << "Lost the connection to svcmgrd.";
+          }
+          else
+          {
+            ssError << "read(" << errno << ") error:  " << strerror(errno);
+          }
+          m_mutex.lock();
+          disconnect(ssError.str(), replies);
+          m_mutex.unlock();
+          unCount = 1;
+        }
+      }
+      if (unCount == 2 && (fds[1].revents & POLLOUT))
+      {
+        m_mutex.lock();
+        if ((nReturn = ::send(m_fdSocket, m_strBuffer[1].c_str(), m_strBuffer[1].size(), MSG_NOSIGNAL)) > 0)
+        {
+          m_strBuffer[1].erase(0, nReturn);
+        }
+        else if (nReturn < 0 && errno != EAGAIN && errno != EINTR)
+        {
+          stringstream ssError;
+          ssError << "send(" << errno << ") error:  " << strerror(errno);
+          disconnect(ssError.str(), replies);
+        }
+        m_mutex.unlock();
+      }
+    }
+    for (list<string>::iterator i = replies.begin(); i != replies.end(); i++)
+    {
+      dispatch(*i);
+    }
+    replies.clear();
+  }
+}
+// }}}
+// {{{ request()
+void SvcmgrClient::request(Json *ptRequest, function<void(Json *)> callback)
+{
+  send(ptRequest, callback, false);
+}
+future<Json *> SvcmgrClient::request(Json *ptRequest)
+{
+  shared_ptr<promise<Json *> > ptPromise = make_shared<promise<Json *> >();
+  future<Json *> reply = ptPromise->get_future();
+
+  send(ptRequest, [ptPromise](Json *ptReply)
+  {
+    string strJson;
+    ptPromise->set_value(new Json(ptReply->json(strJson)));
+  }, false);
+
+  return reply;
+}
+// }}}
+// {{{ send()
+size_t SvcmgrClient::send(Json *ptRequest, function<void(Json *)> callback, const bool bWatch)
+{
+  size_t unId;
+  string strJson;
+  stringstream ssId;
+  Json *ptCopy = new Json(ptRequest->json(strJson));
+
+  m_mutex.lock();
+  unId = ++m_unId;
+  ssId << unId;
+  ptCopy->insert("Id", ssId.str());
+  ptCopy->json(strJson);
+  strJson.append("\n");
+  m_callbacks[unId] = callback;
+  if (bWatch)
+  {
+    m_watches[unId] = strJson;
+  }
+  m_strBuffer[1].append(strJson);
+  m_mutex.unlock();
+  delete ptCopy;
+  if (m_fdWake[1] != -1)
+  {
+    while (write(m_fdWake[1], "", 1) < 0 && errno == EINTR);
+  }
+
+  return unId;
+}
+// }}}
+// {{{ unwatch()
+void SvcmgrClient::unwatch(const size_t unId)
+{
+  m_mutex.lock();
+  m_callbacks.erase(unId);
+  m_watches.erase(unId);
+  m_mutex.unlock();
+}
+// }}}
+// {{{ watch()
+size_t SvcmgrClient::watch(const string strService, function<void(Json *)> callback)
+{
+  size_t unId;
+  Json *ptRequest = new Json;
+
+  ptRequest->insert("Function", "watch");
+  ptRequest->insert("Service", strService);
+  unId = send(ptRequest, callback, true);
+  delete ptRequest;
+
+  return unId;
+}
+// }}}
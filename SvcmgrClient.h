@@ -0,0 +1,142 @@
+// vim600: fdm=marker
+/* -*- c++ -*- */
+///////////////////////////////////////////
+// Service Manager
+// -------------------------------------
+// file       : SvcmgrClient.h
+// author     : Ben Kietzman
+// begin      : 2019-02-18
+// copyright  : kietzman.org
+// email      : ben@kietzman.org
+///////////////////////////////////////////
+
+/**************************************************************************
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+**************************************************************************/
+
+/*! \file SvcmgrClient.h
+* \brief Service Manager Client Library
+*
+* Keeps one connection to svcmgrd open and pipelines requests over it.
+*
+* Each request is tagged with an Id field which svcmgrd echoes back, so any
+* number of requests may be outstanding at once.  Replies are delivered to
+* callbacks or futures from a background thread which also reconnects after
+* the connection is lost and resubscribes any watch requests.
+*/
+#ifndef _SVCMGR_CLIENT_
+#define _SVCMGR_CLIENT_
+// {{{ includes
+#include <atomic>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+#include <Json>
+using namespace common;
+// }}}
+// {{{ defines
+/*! \def UNIX_SOCKET
+* \brief Contains the unix socket path.
+*/
+#ifndef UNIX_SOCKET
+#define UNIX_SOCKET "/tmp/svcmgr"
+#endif
+// }}}
+// {{{ SvcmgrClient
+/*! \class SvcmgrClient
+* \brief Pipelines requests to svcmgrd over a persistent connection.
+*
+* Callbacks run on the background thread and receive a reply which is
+* deleted once they return.  They may issue further requests.
+*/
+class SvcmgrClient
+{
+  protected:
+  atomic<bool> m_bStop;
+  int m_fdSocket;
+  int m_fdWake[2];
+  mutex m_mutex;
+  size_t m_unId;
+  string m_strBuffer[2];
+  string m_strSocket;
+  map<size_t, function<void(Json *)> > m_callbacks;
+  map<size_t, string> m_watches;
+  thread *m_ptThread;
+
+  /*! \fn bool connect(string &strError)
+  * \brief Connects to svcmgrd.
+  * \param strError Contains the error.
+  * \return Returns a boolean true/false value.
+  */
+  bool connect(string &strError);
+  /*! \fn void disconnect(const string strError, list<string> &replies)
+  * \brief Closes the connection, fails the outstanding requests, and queues the watch requests for the next connection.
+  * \param strError Contains the error delivered to the callbacks.
+  * \param replies Returns an error reply for each outstanding request to be dispatched once the lock is released.
+  */
+  void disconnect(const string strError, list<string> &replies);
+  /*! \fn void dispatch(const string strLine)
+  * \brief Delivers a reply to the callback registered under its Id.
+  * \param strLine Contains the reply.
+  */
+  void dispatch(const string strLine);
+  /*! \fn void process()
+  * \brief Runs the connection until the client is destroyed.
+  */
+  void process();
+  /*! \fn size_t send(Json *ptRequest, function<void(Json *)> callback, const bool bWatch)
+  * \brief Queues a request.
+  * \param ptRequest Contains the request.
+  * \param callback Contains the reply callback.
+  * \param bWatch Contains whether the request streams replies until the client is destroyed.
+  * \return Returns the Id of the request.
+  */
+  size_t send(Json *ptRequest, function<void(Json *)> callback, const bool bWatch);
+
+  public:
+  /*! \fn SvcmgrClient(const string strSocket = UNIX_SOCKET)
+  * \brief Starts the connection thread.
+  * \param strSocket Contains the unix socket path.
+  */
+  SvcmgrClient(const string strSocket = UNIX_SOCKET);
+  /*! \fn ~SvcmgrClient()
+  * \brief Fails the outstanding requests and closes the connection without calling the watch callbacks again.
+  */
+  ~SvcmgrClient();
+  /*! \fn void request(Json *ptRequest, function<void(Json *)> callback)
+  * \brief Sends a request whose reply is delivered to a callback.
+  * \param ptRequest Contains the request which is copied.
+  * \param callback Contains the reply callback.
+  */
+  void request(Json *ptRequest, function<void(Json *)> callback);
+  /*! \fn future<Json *> request(Json *ptRequest)
+  * \brief Sends a request whose reply is delivered through a future.
+  * \param ptRequest Contains the request which is copied.
+  * \return Returns the future of the reply which the caller deletes.
+  */
+  future<Json *> request(Json *ptRequest);
+  /*! \fn void unwatch(const size_t unId)
+  * \brief Stops delivering the events of a watch request.
+  * \param unId Contains the Id returned by watch().
+  */
+  void unwatch(const size_t unId);
+  /*! \fn size_t watch(const string strService, function<void(Json *)> callback)
+  * \brief Streams journal events to a callback.
+  * \param strService Contains the service or is empty for all services.
+  * \param callback Contains the callback which receives each event reply with the event in its Response and any error reply.
+  * \return Returns the Id of the watch request.
+  */
+  size_t watch(const string strService, function<void(Json *)> callback);
+};
+// }}}
+#endif
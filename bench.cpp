@@ -0,0 +1,251 @@
+// vim600: fdm=marker
+/* -*- c++ -*- */
+///////////////////////////////////////////
+// Service Manager
+// -------------------------------------
+// file       : bench.cpp
+// author     : Ben Kietzman
+// begin      : 2026-10-19
+// copyright  : kietzman.org
+// email      : ben@kietzman.org
+///////////////////////////////////////////
+
+/**************************************************************************
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+**************************************************************************/
+
+/*! \file bench.cpp
+* \brief Service Manager Benchmarks
+*
+* Measures the daemon internals against synthetic service tables and requests.
+*/
+// {{{ includes
+#include <new>
+#include <random>
+// the daemon is compiled into the benchmark so its internals are measured as they ship
+#define main svcmgrd
+#include "svcmgrd.cpp"
+#undef main
+// }}}
+// {{{ defines
+/*! \def BENCH_ROUNDS
+* \brief Contains the number of times each measurement is repeated.
+*/
+#define BENCH_ROUNDS 20
+// }}}
+// {{{ global variables
+size_t gunAllocations = 0; //!< Counts the heap allocations made by the benchmark.
+// }}}
+// {{{ prototypes
+/*! \fn void benchRequests(const size_t unRequests)
+* \brief Measures the in place request parser against the Json path.
+* \param unRequests Contains the number of requests parsed by each path.
+*/
+void benchRequests(const size_t unRequests);
+/*! \fn void benchServices(const size_t unServices, const size_t unRunning)
+* \brief Measures the per tick scan and the name lookup against a synthetic service table.
+* \param unServices Contains the number of services.
+* \param unRunning Contains every how many services one is running or zero for none.
+*/
+void benchServices(const size_t unServices, const size_t unRunning);
+// }}}
+// {{{ main()
+/*! \fn int main(int argc, char *argv[])
+* \brief This is the main function.
+* \return Exits with a return code for the operating system.
+*/
+int main(int argc, char *argv[])
+{
+  string strError;
+
+  gpCentral = new Central(strError);
+  benchServices(10000, 0);
+  benchServices(10000, 100);
+  benchServices(100000, 0);
+  benchServices(100000, 100);
+  benchRequests(1000000);
+  delete gpCentral;
+
+  return 0;
+}
+// }}}
+// {{{ operator new()
+// the benchmark is single threaded so a plain counter is enough
+void *operator new(size_t unSize)
+{
+  void *pData;
+
+  gunAllocations++;
+  if ((pData = malloc((unSize > 0)?unSize:1)) == NULL)
+  {
+    throw bad_alloc();
+  }
+
+  return pData;
+}
+void operator delete(void *pData) noexcept
+{
+  free(pData);
+}
+void operator delete(void *pData, size_t unSize) noexcept
+{
+  free(pData);
+}
+// }}}
+// {{{ benchRequests()
+void benchRequests(const size_t unRequests)
+{
+  const char *lines[4] = {"{\"Function\":\"status\",\"Service\":\"sleeper\"}", "{\"Function\":\"start\",\"Service\":\"sleeper\",\"Async\":\"1\"}", "{\"Function\":\"list\",\"Tag\":\"client-17\"}", "{\"Function\":\"history\",\"Service\":\"sleeper\",\"Start\":1760000000,\"Limit\":100}"};
+  size_t unAllocations, unBytes = 0, unNanoseconds, unStart;
+  string strBuffer, strEmpty, strInput, strJson;
+  stringstream ssMessage;
+
+  strBuffer.reserve(4096);
+  strInput.reserve(4096);
+  strJson.reserve(4096);
+  ssMessage << "requests=" << unRequests << endl;
+  // {{{ requestParse()
+  // the socket buffers keep their capacity between requests just as the daemon's do
+  unAllocations = gunAllocations;
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < unRequests; i++)
+  {
+    request tRequest;
+    strInput.assign(lines[i % 4]);
+    memset(&tRequest, 0, sizeof(request));
+    if (requestParse(&strInput[0], strInput.size(), tRequest))
+    {
+      strBuffer.clear();
+      requestReply(tRequest, true, strEmpty, NULL, strBuffer);
+      unBytes += strBuffer.size();
+    }
+  }
+  unNanoseconds = timeMonotonic() - unStart;
+  ssMessage << "  requestParse():    " << ((unRequests * 1000000000) / ((unNanoseconds > 0)?unNanoseconds:1)) << " requests/s, " << ((double)(gunAllocations - unAllocations) / unRequests) << " allocations/request" << endl;
+  // }}}
+  // {{{ Json
+  unAllocations = gunAllocations;
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < unRequests; i++)
+  {
+    Json *ptJson;
+    strInput.assign(lines[i % 4]);
+    ptJson = new Json(strInput);
+    ptJson->insert("Status", "okay");
+    strBuffer.clear();
+    strBuffer.append(ptJson->json(strJson));
+    strBuffer.push_back('\n');
+    unBytes += strBuffer.size();
+    delete ptJson;
+  }
+  unNanoseconds = timeMonotonic() - unStart;
+  ssMessage << "  Json:              " << ((unRequests * 1000000000) / ((unNanoseconds > 0)?unNanoseconds:1)) << " requests/s, " << ((double)(gunAllocations - unAllocations) / unRequests) << " allocations/request" << endl;
+  // }}}
+  cout << ssMessage.str() << "  bytes:             " << unBytes << endl;
+}
+// }}}
+// {{{ benchServices()
+void benchServices(const size_t unServices, const size_t unRunning)
+{
+  int fdSelf = syscall(SYS_pidfd_open, getpid(), 0);
+  map<string, service *> ordered;
+  size_t unChecked = 0, unStart;
+  stringstream ssMessage;
+  vector<string> names;
+
+  // {{{ populate
+  for (size_t i = 0; i < unServices; i++)
+  {
+    service *ptService = new service();
+    stringstream ssName;
+    ssName << "bench" << i;
+    names.push_back(ssName.str());
+    serviceIntern(ssName.str(), ptService);
+    ptService->strHealth = "unknown";
+    ptService->strRestart = "always";
+    // the benchmark itself stands in for the running processes
+    if (unRunning > 0 && (i % unRunning) == 0)
+    {
+      processTrack(ptService, gServiceHot[ptService->unId].nPid, getpid());
+      gServiceHot[ptService->unId].fdPid = fdSelf;
+    }
+    gServices[ssName.str()] = ptService;
+    ordered[ssName.str()] = ptService;
+  }
+  shuffle(names.begin(), names.end(), default_random_engine(unServices));
+  // }}}
+  // {{{ scan
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < BENCH_ROUNDS; i++)
+  {
+    serviceScan();
+  }
+  ssMessage << "services=" << unServices << " running=" << ((unRunning > 0)?(unServices / unRunning):0) << endl;
+  ssMessage << "  serviceScan():     " << ((timeMonotonic() - unStart) / BENCH_ROUNDS / 1000) << " us/tick" << endl;
+  // }}}
+  // {{{ struct walk
+  // the walk the scan replaced read three scalars from every heap allocated service
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < BENCH_ROUNDS; i++)
+  {
+    for (unordered_map<string, service *>::iterator j = gServices.begin(); j != gServices.end(); j++)
+    {
+      if (j->second->nExitSignal != 0 || j->second->nStopGroup != 0 || j->second->unRestarts > 0)
+      {
+        unChecked++;
+      }
+    }
+  }
+  ssMessage << "  struct walk:       " << ((timeMonotonic() - unStart) / BENCH_ROUNDS / 1000) << " us/tick" << endl;
+  // }}}
+  // {{{ lookup
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < BENCH_ROUNDS; i++)
+  {
+    for (vector<string>::iterator j = names.begin(); j != names.end(); j++)
+    {
+      if (gServices.find(*j) != gServices.end())
+      {
+        unChecked++;
+      }
+    }
+  }
+  ssMessage << "  hashed lookup:     " << ((timeMonotonic() - unStart) / BENCH_ROUNDS / unServices) << " ns/lookup" << endl;
+  unStart = timeMonotonic();
+  for (size_t i = 0; i < BENCH_ROUNDS; i++)
+  {
+    for (vector<string>::iterator j = names.begin(); j != names.end(); j++)
+    {
+      if (ordered.find(*j) != ordered.end())
+      {
+        unChecked++;
+      }
+    }
+  }
+  ssMessage << "  ordered lookup:    " << ((timeMonotonic() - unStart) / BENCH_ROUNDS / unServices) << " ns/lookup" << endl;
+  // }}}
+  // {{{ cleanup
+  while (!gServices.empty())
+  {
+    serviceRelease(gServices.begin()->second);
+    delete gServices.begin()->second;
+    gServices.erase(gServices.begin());
+  }
+  gServiceFree.clear();
+  gServiceHot.clear();
+  gServiceNames.clear();
+  ordered.clear();
+  names.clear();
+  if (fdSelf != -1)
+  {
+    close(fdSelf);
+  }
+  // }}}
+  cout << ssMessage.str() << "  checked:           " << unChecked << endl;
+}
+// }}}
@@ -23,19 +23,33 @@
 * \brief Service Manager Keep-Alive
 *
 * Keeps the svcmgrd daemon alive.
+*
+* By default keepalive runs from cron and starts svcmgrd when its PID file no
+* longer refers to a running process.  In resident mode keepalive stays
+* running, supervises one or more svcmgrd instances, and respawns each one
+* with backoff as soon as it exits.
 */
 // {{{ includes
 #include <cerrno>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <poll.h>
 #include <sstream>
 #include <string>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <vector>
 using namespace std;
 // }}}
 // {{{ defines
@@ -49,7 +63,7 @@ using namespace std;
 /*! \def mUSAGE(A)
 * \brief Prints the usage statement.
 */
-#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [options]"  << endl << endl << "     --command=[COMMAND]" << endl << "     Sets the command." << endl << endl << "     --data=[PATH]" << endl << "     Sets the data directory." << endl << endl << " -h, --help" << endl << "     Displays this usage screen." << endl << endl << " -v, --version" << endl << "     Displays the current version of this software." << endl << endl
+#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [options]"  << endl << endl << "     --command=[COMMAND]" << endl << "     Sets the command.  Repeat to supervise several instances." << endl << endl << "     --data=[PATH]" << endl << "     Sets the data directory.  The Nth data directory belongs to the Nth command." << endl << endl << " -h, --help" << endl << "     Displays this usage screen." << endl << endl << "     --ping=[SECONDS]" << endl << "     Pings each resident instance over its control socket at this interval." << endl << endl << "     --ping-threshold=[MILLISECONDS]" << endl << "     Restarts an instance which does not answer a ping within this time (default 5000)." << endl << endl << " -r, --resident" << endl << "     Stays running and respawns the instances as soon as they exit." << endl << endl << "     --socket=[PATH]" << endl << "     Sets the control socket.  The Nth socket belongs to the Nth command." << endl << endl << " -v, --version" << endl << "     Displays the current version of this software." << endl << endl
 /*! \def mVER_USAGE(A,B)
 * \brief Prints the version number.
 */
@@ -58,11 +72,131 @@ using namespace std;
 * \brief Contains the PID path.
 */
 #define PID "/.pid"
+/*! \def BACKOFF_MAX
+* \brief Contains the maximum respawn delay in milliseconds.
+*/
+#define BACKOFF_MAX 30000
+/*! \def BACKOFF_MIN
+* \brief Contains the first non-zero respawn delay in milliseconds.
+*/
+#define BACKOFF_MIN 100
+/*! \def PROBE_RETRY
+* \brief Contains the number of milliseconds to wait before retrying a ping refused by a full listen backlog.
+*/
+#define PROBE_RETRY 100
+/*! \def STABLE
+* \brief Contains the number of milliseconds an instance must run before its backoff resets.
+*/
+#define STABLE 10000
+/*! \def UNIX_SOCKET
+* \brief Contains the default control socket path.
+*/
+#ifndef UNIX_SOCKET
+#define UNIX_SOCKET "/tmp/svcmgr"
+#endif
+#ifndef SYS_pidfd_open
+/*! \def SYS_pidfd_open
+* \brief Contains the pidfd_open system call number for older headers.
+*/
+#define SYS_pidfd_open 434
+#endif
+// }}}
+// {{{ structs
+struct instance
+{
+  int fdPid;
+  int fdProbe;
+  pid_t nLauncher;
+  pid_t nPid;
+  pid_t nPrevious;
+  size_t unBackoff;
+  size_t unLaunch;
+  size_t unProbe;
+  size_t unProbeBusy;
+  size_t unProbeNext;
+  size_t unRespawn;
+  size_t unStart;
+  string strCommand;
+  string strData;
+  string strProbe[2];
+  string strSocket;
+};
 // }}}
 // {{{ global variables
+bool gbShutdown = false; //!< Global shutdown variable.
 string gstrApplication = "Service Manager"; //!< Global application name.
-string gstrCommand; //!< Global command.
 string gstrData = "/data/svcmgr"; //!< Global data path.
+size_t gunPing = 0; //!< Global ping interval in seconds.
+size_t gunPingThreshold = 5000; //!< Global ping threshold in milliseconds.
+vector<instance> gInstances; //!< Global instances.
+// }}}
+// {{{ prototypes
+/*! \fn void instanceExit(instance &tInstance, const string strReason)
+* \brief Schedules the respawn of an instance which exited or failed to start.
+* \param tInstance Contains the instance.
+* \param strReason Contains the reason.
+*/
+void instanceExit(instance &tInstance, const string strReason);
+/*! \fn void instanceDiagnose(instance &tInstance, const size_t unLatency)
+* \brief Records diagnostics for a stalled instance and kills it.
+* \param tInstance Contains the instance.
+* \param unLatency Contains the milliseconds the ping has been outstanding.
+*/
+void instanceDiagnose(instance &tInstance, const size_t unLatency);
+/*! \fn void instanceLaunch(instance &tInstance)
+* \brief Launches the command of an instance.
+* \param tInstance Contains the instance.
+*/
+void instanceLaunch(instance &tInstance);
+/*! \fn bool instanceTrack(instance &tInstance)
+* \brief Tracks the process named by the PID file of an instance.
+* \param tInstance Contains the instance.
+* \return Returns a boolean true/false value indicating whether a running process is tracked.
+*/
+bool instanceTrack(instance &tInstance);
+/*! \fn void log(const string strMessage)
+* \brief Writes a timestamped message to the standard error.
+* \param strMessage Contains the message.
+*/
+void log(const string strMessage);
+/*! \fn pid_t pidRead(const string strData)
+* \brief Reads the PID file of a data directory.
+* \param strData Contains the data directory.
+* \return Returns the process ID when the process is running or -1.
+*/
+pid_t pidRead(const string strData);
+/*! \fn void probeCancel(instance &tInstance)
+* \brief Closes the ping connection of an instance.
+* \param tInstance Contains the instance.
+*/
+void probeCancel(instance &tInstance);
+/*! \fn void probePoll(instance &tInstance, const short sRevents)
+* \brief Services the ping connection of an instance.
+* \param tInstance Contains the instance.
+* \param sRevents Contains the poll events.
+*/
+void probePoll(instance &tInstance, const short sRevents);
+/*! \fn bool probeStart(instance &tInstance, string &strError)
+* \brief Connects to the control socket of an instance and sends a ping, deferring the ping while the listen backlog is full.
+* \param tInstance Contains the instance.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool probeStart(instance &tInstance, string &strError);
+/*! \fn void resident()
+* \brief Supervises the instances until a shutdown signal is caught.
+*/
+void resident();
+/*! \fn void sighandle(const int nSignal)
+* \brief Establishes signal handling for the resident mode.
+* \param nSignal Contains the caught signal.
+*/
+void sighandle(const int nSignal);
+/*! \fn size_t timeMonotonic()
+* \brief Retrieves the monotonic clock.
+* \return Returns the monotonic clock in milliseconds.
+*/
+size_t timeMonotonic();
 // }}}
 // {{{ main()
 /*! \fn int main(int argc, char *argv[])
@@ -71,8 +205,8 @@ string gstrData = "/data/svcmgr"; //!< Global data path.
 */
 int main(int argc, char *argv[])
 {
-  string strError, strPrefix = "main()";
-  stringstream ssMessage;
+  bool bResident = false;
+  vector<string> commands, data, sockets;
 
   // {{{ command line arguments
   for (int i = 1; i < argc; i++)
@@ -81,25 +215,43 @@ int main(int argc, char *argv[])
     string strArg = argv[i];
     if (strArg.size() > 10 && strArg.substr(0, 10) == "--command=")
     {
-      gstrCommand = strArg.substr(10, strArg.size() - 10);
-      while ((unPosition = gstrCommand.find("'")) != string::npos || (unPosition = gstrCommand.find("\"")) != string::npos)
+      string strCommand = strArg.substr(10, strArg.size() - 10);
+      while ((unPosition = strCommand.find("'")) != string::npos || (unPosition = strCommand.find("\"")) != string::npos)
       {
-        gstrCommand.erase(unPosition, 1);
+        strCommand.erase(unPosition, 1);
       }
+      commands.push_back(strCommand);
     }
     else if (strArg.size() > 7 && strArg.substr(0, 7) == "--data=")
     {
-      gstrData = strArg.substr(7, strArg.size() - 7);
-      while ((unPosition = gstrData.find("'")) != string::npos || (unPosition = gstrData.find("\"")) != string::npos)
+      string strData = strArg.substr(7, strArg.size() - 7);
+      while ((unPosition = strData.find("'")) != string::npos || (unPosition = strData.find("\"")) != string::npos)
       {
-        gstrData.erase(unPosition, 1);
+        strData.erase(unPosition, 1);
       }
+      data.push_back(strData);
     }
     else if (strArg == "-h" || strArg == "--help")
     {
       mUSAGE(argv[0]);
       return 0;
     }
+    else if (strArg.size() > 7 && strArg.substr(0, 7) == "--ping=")
+    {
+      gunPing = strtoul(strArg.substr(7, strArg.size() - 7).c_str(), NULL, 10);
+    }
+    else if (strArg.size() > 17 && strArg.substr(0, 17) == "--ping-threshold=")
+    {
+      gunPingThreshold = strtoul(strArg.substr(17, strArg.size() - 17).c_str(), NULL, 10);
+    }
+    else if (strArg == "-r" || strArg == "--resident")
+    {
+      bResident = true;
+    }
+    else if (strArg.size() > 9 && strArg.substr(0, 9) == "--socket=")
+    {
+      sockets.push_back(strArg.substr(9, strArg.size() - 9));
+    }
     else if (strArg == "-v" || strArg == "--version")
     {
       mVER_USAGE(argv[0], VERSION);
@@ -107,27 +259,42 @@ int main(int argc, char *argv[])
     }
   }
   // }}}
+  for (size_t i = 0; i < commands.size(); i++)
+  {
+    instance tInstance;
+    tInstance.fdPid = -1;
+    tInstance.fdProbe = -1;
+    tInstance.nLauncher = -1;
+    tInstance.nPid = -1;
+    tInstance.nPrevious = -1;
+    tInstance.unBackoff = 0;
+    tInstance.unLaunch = 0;
+    tInstance.unProbe = 0;
+    tInstance.unProbeBusy = 0;
+    tInstance.unProbeNext = 0;
+    tInstance.unRespawn = 0;
+    tInstance.unStart = 0;
+    tInstance.strCommand = commands[i];
+    tInstance.strData = ((i < data.size())?data[i]:gstrData);
+    tInstance.strSocket = ((i < sockets.size())?sockets[i]:UNIX_SOCKET);
+    gInstances.push_back(tInstance);
+  }
+  // {{{ resident run
+  if (!gInstances.empty() && bResident)
+  {
+    resident();
+  }
+  // }}}
   // {{{ normal run
-  if (!gstrCommand.empty())
+  else if (!gInstances.empty())
   {
-    ifstream inPid((gstrData + PID).c_str());
-    if (inPid)
+    for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
     {
-      pid_t nPid;
-      stringstream ssProc;
-      struct stat tStat;
-      inPid >> nPid;
-      ssProc << "/proc/" << nPid;
-      if (stat(ssProc.str().c_str(), &tStat) != 0 || !S_ISDIR(tStat.st_mode))
+      if (pidRead(i->strData) == -1)
       {
-        system(gstrCommand.c_str());
+        system(i->strCommand.c_str());
       }
     }
-    else
-    {
-      system(gstrCommand.c_str());
-    }
-    inPid.close();
   }
   // }}}
   // {{{ usage statement
@@ -140,3 +307,504 @@ int main(int argc, char *argv[])
   return 0;
 }
 // }}}
+// {{{ instanceDiagnose()
+void instanceDiagnose(instance &tInstance, const size_t unLatency)
+{
+  char szTime[32];
+  list<string> files;
+  time_t CTime;
+  ofstream outDiag;
+  stringstream ssDiag, ssMessage, ssProc;
+  struct tm tTime;
+
+  time(&CTime);
+  localtime_r(&CTime, &tTime);
+  strftime(szTime, sizeof(szTime), "%Y%m%d%H%M%S", &tTime);
+  ssDiag << tInstance.strData << "/stall_" << szTime << "_" << tInstance.nPid << ".txt";
+  ssProc << "/proc/" << tInstance.nPid;
+  files.push_back("status");
+  files.push_back("wchan");
+  files.push_back("syscall");
+  files.push_back("stack");
+  files.push_back("task/" + ssProc.str().substr(6) + "/children");
+  outDiag.open(ssDiag.str().c_str());
+  if (outDiag)
+  {
+    outDiag << "Ping outstanding for " << unLatency << " ms over " << tInstance.strSocket << "." << endl;
+    for (list<string>::iterator i = files.begin(); i != files.end(); i++)
+    {
+      string strLine;
+      ifstream inProc((ssProc.str() + "/" + (*i)).c_str());
+      outDiag << endl << "==> " << ssProc.str() << "/" << (*i) << " <==" << endl;
+      while (getline(inProc, strLine))
+      {
+        outDiag << strLine << endl;
+        if ((*i).find("children") != string::npos)
+        {
+          pid_t nChild;
+          stringstream ssChildren(strLine);
+          while (ssChildren >> nChild)
+          {
+            stringstream ssCommand;
+            string strCommand;
+            ssCommand << "/proc/" << nChild << "/cmdline";
+            ifstream inCommand(ssCommand.str().c_str());
+            getline(inCommand, strCommand);
+            for (size_t j = 0; j < strCommand.size(); j++)
+            {
+              if (strCommand[j] == '\0')
+              {
+                strCommand[j] = ' ';
+              }
+            }
+            outDiag << nChild << ":  " << strCommand << endl;
+          }
+        }
+      }
+    }
+  }
+  outDiag.close();
+  ssMessage << "instanceDiagnose() [" << tInstance.strData << "," << tInstance.nPid << "," << unLatency << " ms]:  Killing the stalled instance after writing diagnostics to " << ssDiag.str() << ".";
+  log(ssMessage.str());
+  probeCancel(tInstance);
+  kill(tInstance.nPid, SIGKILL);
+}
+// }}}
+// {{{ instanceExit()
+void instanceExit(instance &tInstance, const string strReason)
+{
+  size_t unNow = timeMonotonic();
+  stringstream ssMessage;
+
+  probeCancel(tInstance);
+  if (tInstance.fdPid != -1)
+  {
+    close(tInstance.fdPid);
+    tInstance.fdPid = -1;
+  }
+  if (tInstance.nPid != -1)
+  {
+    tInstance.nPrevious = tInstance.nPid;
+  }
+  tInstance.nPid = -1;
+  tInstance.unLaunch = 0;
+  if (tInstance.unStart == 0 || (unNow - tInstance.unStart) >= STABLE)
+  {
+    tInstance.unBackoff = 0;
+  }
+  else
+  {
+    tInstance.unBackoff = ((tInstance.unBackoff == 0)?BACKOFF_MIN:tInstance.unBackoff * 2);
+    if (tInstance.unBackoff > BACKOFF_MAX)
+    {
+      tInstance.unBackoff = BACKOFF_MAX;
+    }
+  }
+  tInstance.unRespawn = unNow + tInstance.unBackoff;
+  ssMessage << "instanceExit() [" << tInstance.strData << "," << tInstance.nPrevious << "]:  " << strReason << "  Respawning in " << tInstance.unBackoff << " ms.";
+  log(ssMessage.str());
+}
+// }}}
+// {{{ instanceLaunch()
+void instanceLaunch(instance &tInstance)
+{
+  stringstream ssMessage;
+
+  tInstance.unLaunch = tInstance.unStart = timeMonotonic();
+  tInstance.unRespawn = 0;
+  if ((tInstance.nLauncher = fork()) == 0)
+  {
+    setsid();
+    execl("/bin/sh", "sh", "-c", tInstance.strCommand.c_str(), (char *)NULL);
+    _exit(127);
+  }
+  else if (tInstance.nLauncher > 0)
+  {
+    ssMessage << "instanceLaunch() [" << tInstance.strData << "," << tInstance.nLauncher << "]:  Launched " << tInstance.strCommand << ".";
+    log(ssMessage.str());
+  }
+  else
+  {
+    tInstance.nLauncher = -1;
+    ssMessage << "fork(" << errno << ") " << strerror(errno);
+    instanceExit(tInstance, ssMessage.str());
+  }
+}
+// }}}
+// {{{ instanceTrack()
+bool instanceTrack(instance &tInstance)
+{
+  bool bResult = false;
+  pid_t nPid;
+
+  if ((nPid = pidRead(tInstance.strData)) != -1 && nPid != tInstance.nPrevious)
+  {
+    stringstream ssMessage;
+    bResult = true;
+    tInstance.nPid = nPid;
+    tInstance.fdPid = syscall(SYS_pidfd_open, nPid, 0);
+    tInstance.unLaunch = 0;
+    tInstance.unProbeBusy = 0;
+    tInstance.unProbeNext = timeMonotonic() + (gunPing * 1000);
+    ssMessage << "instanceTrack() [" << tInstance.strData << "," << nPid << "]:  Tracking instance" << ((tInstance.fdPid == -1)?" without a pidfd.":".");
+    log(ssMessage.str());
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ log()
+void log(const string strMessage)
+{
+  char szTime[32];
+  time_t CTime;
+  struct tm tTime;
+
+  time(&CTime);
+  localtime_r(&CTime, &tTime);
+  strftime(szTime, sizeof(szTime), "%Y-%m-%d %H:%M:%S", &tTime);
+  cerr << szTime << " " << strMessage << endl;
+}
+// }}}
+// {{{ pidRead()
+pid_t pidRead(const string strData)
+{
+  pid_t nPid = -1;
+  ifstream inPid((strData + PID).c_str());
+
+  if (inPid && inPid >> nPid && nPid > 0)
+  {
+    stringstream ssProc;
+    struct stat tStat;
+    ssProc << "/proc/" << nPid;
+    if (stat(ssProc.str().c_str(), &tStat) != 0 || !S_ISDIR(tStat.st_mode))
+    {
+      nPid = -1;
+    }
+  }
+  else
+  {
+    nPid = -1;
+  }
+  inPid.close();
+
+  return nPid;
+}
+// }}}
+// {{{ probeCancel()
+void probeCancel(instance &tInstance)
+{
+  if (tInstance.fdProbe != -1)
+  {
+    close(tInstance.fdProbe);
+    tInstance.fdProbe = -1;
+  }
+  tInstance.unProbe = 0;
+  tInstance.unProbeBusy = 0;
+  tInstance.unProbeNext = timeMonotonic() + (gunPing * 1000);
+  tInstance.strProbe[0].clear();
+  tInstance.strProbe[1].clear();
+}
+// }}}
+// {{{ probePoll()
+void probePoll(instance &tInstance, const short sRevents)
+{
+  bool bDone = false;
+  char szBuffer[4096];
+  ssize_t nReturn;
+  stringstream ssMessage;
+
+  if ((sRevents & POLLOUT) && !tInstance.strProbe[1].empty())
+  {
+    if ((nReturn = write(tInstance.fdProbe, tInstance.strProbe[1].c_str(), tInstance.strProbe[1].size())) > 0)
+    {
+      tInstance.strProbe[1].erase(0, nReturn);
+    }
+    else if (nReturn < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      bDone = true;
+      ssMessage << "probePoll()->write(" << errno << ") error [" << tInstance.strData << "," << tInstance.strSocket << "]:  " << strerror(errno);
+    }
+  }
+  if (!bDone && (sRevents & (POLLIN | POLLHUP | POLLERR)))
+  {
+    if ((nReturn = read(tInstance.fdProbe, szBuffer, sizeof(szBuffer))) > 0)
+    {
+      size_t unPosition;
+      tInstance.strProbe[0].append(szBuffer, nReturn);
+      if ((unPosition = tInstance.strProbe[0].find("\n")) != string::npos)
+      {
+        size_t unLatency = timeMonotonic() - tInstance.unProbe;
+        bDone = true;
+        if (unLatency * 2 >= gunPingThreshold)
+        {
+          ssMessage << "probePoll() [" << tInstance.strData << "," << tInstance.nPid << "," << unLatency << " ms]:  Slow ping response " << tInstance.strProbe[0].substr(0, unPosition);
+        }
+      }
+    }
+    else if (nReturn == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+      bDone = true;
+      ssMessage << "probePoll()->read(" << errno << ") error [" << tInstance.strData << "," << tInstance.strSocket << "]:  " << ((nReturn == 0)?"Connection closed.":strerror(errno));
+    }
+  }
+  if (bDone)
+  {
+    if (!ssMessage.str().empty())
+    {
+      log(ssMessage.str());
+    }
+    probeCancel(tInstance);
+  }
+}
+// }}}
+// {{{ probeStart()
+bool probeStart(instance &tInstance, string &strError)
+{
+  bool bResult = false;
+  stringstream ssError;
+
+  if ((tInstance.fdProbe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0)
+  {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, tInstance.strSocket.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(tInstance.fdProbe, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0 || errno == EINPROGRESS)
+    {
+      bResult = true;
+      tInstance.unProbe = timeMonotonic();
+      tInstance.unProbeBusy = 0;
+      tInstance.strProbe[1] = "{\"Function\":\"ping\"}\n";
+    }
+    else if (errno == EAGAIN)
+    {
+      size_t unNow = timeMonotonic();
+      bResult = true;
+      close(tInstance.fdProbe);
+      tInstance.fdProbe = -1;
+      if (tInstance.unProbeBusy == 0)
+      {
+        tInstance.unProbeBusy = unNow;
+      }
+      tInstance.unProbeNext = unNow + PROBE_RETRY;
+    }
+    else
+    {
+      ssError << "connect(" << errno << ") " << strerror(errno);
+      close(tInstance.fdProbe);
+      tInstance.fdProbe = -1;
+    }
+  }
+  else
+  {
+    ssError << "socket(" << errno << ") " << strerror(errno);
+  }
+  strError = ssError.str();
+
+  return bResult;
+}
+// }}}
+// {{{ resident()
+void resident()
+{
+  struct sigaction act;
+
+  memset(&act, 0, sizeof(struct sigaction));
+  sigemptyset(&act.sa_mask);
+  act.sa_handler = sighandle;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+  if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0)
+  {
+    stringstream ssMessage;
+    ssMessage << "resident()->prctl(" << errno << ") error [PR_SET_CHILD_SUBREAPER]:  " << strerror(errno);
+    log(ssMessage.str());
+  }
+  for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
+  {
+    if (!instanceTrack(*i))
+    {
+      instanceLaunch(*i);
+    }
+  }
+  while (!gbShutdown)
+  {
+    int nStatus, nTimeout = -1;
+    pid_t nPid;
+    size_t unIndex = 0, unNow = timeMonotonic();
+    pollfd *fds = new pollfd[gInstances.size() * 2];
+    vector<int> probes(gInstances.size(), -1);
+    for (size_t i = 0; i < gInstances.size(); i++)
+    {
+      if (gInstances[i].fdProbe != -1)
+      {
+        int nWait = ((gInstances[i].unProbe + gunPingThreshold > unNow)?(int)(gInstances[i].unProbe + gunPingThreshold - unNow):0);
+        probes[i] = unIndex;
+        fds[unIndex].fd = gInstances[i].fdProbe;
+        fds[unIndex].events = POLLIN;
+        if (!gInstances[i].strProbe[1].empty())
+        {
+          fds[unIndex].events |= POLLOUT;
+        }
+        fds[unIndex].revents = 0;
+        unIndex++;
+        if (nTimeout == -1 || nWait < nTimeout)
+        {
+          nTimeout = nWait;
+        }
+      }
+      else if (gunPing > 0 && gInstances[i].nPid != -1)
+      {
+        int nWait = ((gInstances[i].unProbeNext > unNow)?(int)(gInstances[i].unProbeNext - unNow):0);
+        if (nTimeout == -1 || nWait < nTimeout)
+        {
+          nTimeout = nWait;
+        }
+      }
+    }
+    for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
+    {
+      if (i->fdPid != -1)
+      {
+        fds[unIndex].fd = i->fdPid;
+        fds[unIndex].events = POLLIN;
+        fds[unIndex].revents = 0;
+        unIndex++;
+      }
+      else if (i->nPid != -1 || i->unLaunch != 0)
+      {
+        if (nTimeout == -1 || nTimeout > 100)
+        {
+          nTimeout = 100;
+        }
+      }
+      else if (i->unRespawn != 0)
+      {
+        int nWait = ((i->unRespawn > unNow)?(int)(i->unRespawn - unNow):0);
+        if (nTimeout == -1 || nWait < nTimeout)
+        {
+          nTimeout = nWait;
+        }
+      }
+    }
+    if (poll(fds, unIndex, nTimeout) < 0 && errno != EINTR)
+    {
+      stringstream ssMessage;
+      ssMessage << "resident()->poll(" << errno << ") error:  " << strerror(errno);
+      log(ssMessage.str());
+      usleep(100000);
+    }
+    for (size_t i = 0; i < gInstances.size(); i++)
+    {
+      if (probes[i] != -1 && gInstances[i].fdProbe == fds[probes[i]].fd && fds[probes[i]].revents != 0)
+      {
+        probePoll(gInstances[i], fds[probes[i]].revents);
+      }
+    }
+    delete[] fds;
+    // {{{ reap
+    while ((nPid = waitpid(-1, &nStatus, WNOHANG)) > 0)
+    {
+      for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
+      {
+        if (nPid == i->nLauncher)
+        {
+          i->nLauncher = -1;
+          if (i->nPid == -1 && i->unLaunch != 0 && (!WIFEXITED(nStatus) || WEXITSTATUS(nStatus) != 0))
+          {
+            stringstream ssMessage;
+            ssMessage << "The command failed with a status of " << ((WIFEXITED(nStatus))?WEXITSTATUS(nStatus):(128 + WTERMSIG(nStatus))) << ".";
+            instanceExit(*i, ssMessage.str());
+          }
+        }
+      }
+    }
+    // }}}
+    unNow = timeMonotonic();
+    for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
+    {
+      if (i->nPid != -1)
+      {
+        bool bExited = false;
+        if (i->fdPid != -1)
+        {
+          pollfd fdPid[1];
+          fdPid[0].fd = i->fdPid;
+          fdPid[0].events = POLLIN;
+          fdPid[0].revents = 0;
+          bExited = (poll(fdPid, 1, 0) > 0);
+        }
+        else
+        {
+          bExited = (kill(i->nPid, 0) != 0 && errno == ESRCH);
+        }
+        if (bExited)
+        {
+          instanceExit(*i, "The instance exited.");
+        }
+        else if (gunPing > 0)
+        {
+          if (i->fdProbe != -1)
+          {
+            if ((unNow - i->unProbe) >= gunPingThreshold)
+            {
+              instanceDiagnose(*i, (unNow - i->unProbe));
+            }
+          }
+          else if (i->unProbeBusy != 0 && (unNow - i->unProbeBusy) >= gunPingThreshold)
+          {
+            instanceDiagnose(*i, (unNow - i->unProbeBusy));
+          }
+          else if (unNow >= i->unProbeNext)
+          {
+            string strError;
+            if (!probeStart(*i, strError))
+            {
+              log((string)"resident()->probeStart() error [" + i->strData + (string)"," + i->strSocket + (string)"]:  " + strError);
+              i->unProbeNext = unNow + (gunPing * 1000);
+            }
+          }
+        }
+      }
+      else if (i->unLaunch != 0)
+      {
+        if (!instanceTrack(*i) && i->nLauncher == -1 && (unNow - i->unLaunch) >= 5000)
+        {
+          instanceExit(*i, "The instance never wrote its PID file.");
+        }
+      }
+      else if (i->unRespawn != 0 && unNow >= i->unRespawn)
+      {
+        if (!instanceTrack(*i))
+        {
+          instanceLaunch(*i);
+        }
+      }
+    }
+  }
+  for (vector<instance>::iterator i = gInstances.begin(); i != gInstances.end(); i++)
+  {
+    if (i->fdPid != -1)
+    {
+      close(i->fdPid);
+    }
+  }
+}
+// }}}
+// {{{ sighandle()
+void sighandle(const int nSignal)
+{
+  gbShutdown = true;
+}
+// }}}
+// {{{ timeMonotonic()
+size_t timeMonotonic()
+{
+  timespec tTime;
+
+  clock_gettime(CLOCK_MONOTONIC, &tTime);
+
+  return ((size_t)tTime.tv_sec * 1000) + (tTime.tv_nsec / 1000000);
+}
+// }}}
@@ -25,23 +25,20 @@
 * Manages non-root services.
 */
 // {{{ includes
-#include <cerrno>
-#include <cstring>
-#include <fstream>
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <list>
 #include <map>
-#include <poll.h>
+#include <sstream>
 #include <string>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <sys/un.h>
-#include <unistd.h>
 using namespace std;
 #include <Json>
 using namespace common;
+#include "SvcmgrClient.h"
 // }}}
 // {{{ defines
 #ifdef VERSION
@@ -54,17 +51,23 @@ using namespace common;
 /*! \def mUSAGE(A)
 * \brief Prints the usage statement.
 */
-#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [function: disable, enable, list, reload, restart, start, stop] [service]" << endl << endl
+#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [function: daemon-reload, disable, enable, history, job-cancel, job-wait, jobs, list, ping, reload, reload-or-restart, restart, start, stats, status, stop, trace, upgrade, watch] [service or job] [history hours]" << endl << endl
 /*! \def mVER_USAGE(A,B)
 * \brief Prints the version number.
 */
 #define mVER_USAGE(A,B) cout << endl << A << " Version: " << B << endl << endl
-/*! \def UNIX_SOCKET
-* \brief Contains the unix socket path.
+// }}}
+// {{{ prototypes
+/*! \fn void printEvent(Json *ptEvent)
+* \brief Prints a journal event on a single line.
+* \param ptEvent Contains the event.
 */
-#ifndef UNIX_SOCKET
-#define UNIX_SOCKET "/tmp/svcmgr"
-#endif
+void printEvent(Json *ptEvent);
+/*! \fn void printJob(Json *ptJob)
+* \brief Prints a job on a single line.
+* \param ptJob Contains the job.
+*/
+void printJob(Json *ptJob);
 // }}}
 // {{{ main()
 /*! \fn int main(int argc, char *argv[])
@@ -76,138 +79,105 @@ int main(int argc, char *argv[])
   // {{{ normal run
   if (argc >= 2)
   {
-    string strFunction = argv[1], strService = ((argc == 3)?argv[2]:"");
-    struct stat tStat;
-    if (stat(UNIX_SOCKET, &tStat) == 0)
+    string strFunction = argv[1], strService = ((argc >= 3)?argv[2]:"");
+    // {{{ watch
+    if (strFunction == "watch")
+    {
+      atomic<bool> bDone(false);
+      promise<string> error;
+      future<string> done = error.get_future();
+      // the client is declared after what its callback captures so its thread is joined first
+      SvcmgrClient client;
+      client.watch(strService, [&bDone, &error](Json *ptReply)
+      {
+        if (ptReply->m.find("Status") != ptReply->m.end() && ptReply->m["Status"]->v == "okay" && ptReply->m.find("Response") != ptReply->m.end())
+        {
+          printEvent(ptReply->m["Response"]);
+          cout << flush;
+        }
+        else if (!bDone.exchange(true))
+        {
+          error.set_value((ptReply->m.find("Error") != ptReply->m.end() && !ptReply->m["Error"]->v.empty())?ptReply->m["Error"]->v:"Encountered an unknown error.");
+        }
+      });
+      cerr << done.get() << endl;
+    }
+    // }}}
+    // {{{ request
+    else
     {
-      int fdUnix;
-      if ((fdUnix = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0)
+      SvcmgrClient client;
+      Json *ptJson = new Json;
+      ptJson->insert("Function", strFunction);
+      // the job functions take a job ID in place of the service
+      ptJson->insert(((strFunction == "job-cancel" || strFunction == "job-wait")?"Job":"Service"), strService);
+      if (strFunction == "history" && argc >= 4)
+      {
+        stringstream ssStart;
+        ssStart << (time(NULL) - (atol(argv[3]) * 3600));
+        ptJson->insert("Start", ssStart.str());
+      }
+      future<Json *> reply = client.request(ptJson);
+      delete ptJson;
+      ptJson = reply.get();
+      if (ptJson->m.find("Status") != ptJson->m.end() && ptJson->m["Status"]->v == "okay")
       {
-        sockaddr_un addr;
-        memset(&addr, 0, sizeof(sockaddr_un));
-        addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, UNIX_SOCKET, (sizeof(addr.sun_path) - 1));
-        if (connect(fdUnix, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0)
+        if (ptJson->m.find("Response") != ptJson->m.end())
         {
-          bool bExit = false;
-          char szBuffer[4096];
-          int nReturn;
-          size_t unPosition;
-          string strBuffer[2];
-          Json *ptJson = new Json;
-          ptJson->insert("Function", strFunction);
-          ptJson->insert("Service", strService);
-          ptJson->json(strBuffer[1]);
-          delete ptJson;
-          strBuffer[1] += "\n";
-          while (!bExit)
+          if (strFunction == "daemon-reload" || strFunction == "job-wait" || strFunction == "list" || strFunction == "ping" || strFunction == "stats" || strFunction == "status")
           {
-            pollfd fds[1];
-            fds[0].fd = fdUnix;
-            fds[0].events = POLLIN;
-            if (!strBuffer[1].empty())
-            {
-              fds[0].events |= POLLOUT;
-            }
-            if ((nReturn = poll(fds, 1, 250)) > 0)
+            size_t unMax[2] = {0, 0};
+            for (map<string, Json *>::iterator i = ptJson->m["Response"]->m.begin(); i != ptJson->m["Response"]->m.end(); i++)
             {
-              if (fds[0].revents & POLLIN)
+              if (i->first.size() > unMax[0])
               {
-                if ((nReturn = read(fds[0].fd, szBuffer, 4096)) > 0)
-                {
-                  strBuffer[0].append(szBuffer, nReturn);
-                  if ((unPosition = strBuffer[0].find("\n")) != string::npos)
-                  {
-                    bExit = true;
-                    ptJson = new Json(strBuffer[0].substr(0, unPosition));
-                    strBuffer[0].erase(0, (unPosition + 1));
-                    if (ptJson->m.find("Status") != ptJson->m.end() && ptJson->m["Status"]->v == "okay")
-                    {
-                      if (ptJson->m.find("Response") != ptJson->m.end())
-                      {
-                        if (strFunction == "list")
-                        {
-                          size_t unMax[2] = {0, 0};
-                          for (map<string, Json *>::iterator i = ptJson->m["Response"]->m.begin(); i != ptJson->m["Response"]->m.end(); i++)
-                          {
-                            if (i->first.size() > unMax[0])
-                            {
-                              unMax[0] = i->first.size();
-                            }
-                            if (i->second->v.size() > unMax[1])
-                            {
-                              unMax[1] = i->second->v.size();
-                            }
-                          }
-                          for (map<string, Json *>::iterator i = ptJson->m["Response"]->m.begin(); i != ptJson->m["Response"]->m.end(); i++)
-                          {
-                            cout << setw(unMax[0]) << setfill(' ') << i->first << ":  " << setw(unMax[1]) << setfill(' ') << i->second->v << endl;
-                          }
-                        }
-                        else
-                        {
-                          cout <<  endl << ptJson->m["Response"] << endl;
-                        }
-                      }
-                    }
-                    else if (ptJson->m.find("Error") != ptJson->m.end() && !ptJson->m["Error"]->v.empty())
-                    {
-                      cerr << ptJson->m["Error"]->v << endl;
-                    }
-                    else
-                    {
-                      cerr << "Encountered an unknown error." << endl;
-                    }
-                    delete ptJson;
-                  }
-                }
-                else
-                {
-                  bExit = true;
-                  if (nReturn < 0)
-                  {
-                    cerr << "read(" << errno << ") error:  " << strerror(errno) << endl;
-                  }
-                }
+                unMax[0] = i->first.size();
               }
-              if (fds[0].revents & POLLOUT)
+              if (i->second->v.size() > unMax[1])
               {
-                if ((nReturn = write(fds[0].fd, strBuffer[1].c_str(), strBuffer[1].size())) > 0)
-                {
-                  strBuffer[1].erase(0, nReturn);
-                }
-                else
-                {
-                  bExit = true;
-                  if (nReturn < 0)
-                  {
-                    cerr << "write(" << errno << ") error:  " << strerror(errno) << endl;
-                  }
-                }
+                unMax[1] = i->second->v.size();
               }
             }
-            else if (nReturn < 0)
+            for (map<string, Json *>::iterator i = ptJson->m["Response"]->m.begin(); i != ptJson->m["Response"]->m.end(); i++)
             {
-              bExit = true;
-              cerr << "poll(" << errno << ") error:  " << strerror(errno) << endl;
+              cout << setw(unMax[0]) << setfill(' ') << i->first << ":  " << setw(unMax[1]) << setfill(' ') << i->second->v << endl;
             }
           }
+          else if (strFunction == "history")
+          {
+            for (list<Json *>::iterator i = ptJson->m["Response"]->l.begin(); i != ptJson->m["Response"]->l.end(); i++)
+            {
+              printEvent(*i);
+            }
+          }
+          else if (strFunction == "jobs")
+          {
+            for (list<Json *>::iterator i = ptJson->m["Response"]->l.begin(); i != ptJson->m["Response"]->l.end(); i++)
+            {
+              printJob(*i);
+            }
+          }
+          else if (strFunction == "trace")
+          {
+            cout << ptJson->m["Response"] << endl;
+          }
+          else
+          {
+            cout <<  endl << ptJson->m["Response"] << endl;
+          }
         }
-        else
-        {
-          cerr << "connect(" << errno << ") error:  " << strerror(errno) << endl;
-        }
-        close(fdUnix);
+      }
+      else if (ptJson->m.find("Error") != ptJson->m.end() && !ptJson->m["Error"]->v.empty())
+      {
+        cerr << ptJson->m["Error"]->v << endl;
       }
       else
       {
-        cerr << "socket(" << errno << ") error:  " << strerror(errno) << endl;
+        cerr << "Encountered an unknown error." << endl;
       }
+      delete ptJson;
     }
-    else
-    {
-      cerr << "stat(" << errno << ") error:  " << strerror(errno) << endl;
-    }
+    // }}}
   }
   // }}}
   // {{{ usage statement
@@ -220,3 +190,33 @@ int main(int argc, char *argv[])
   return 0;
 }
 // }}}
+// {{{ printEvent()
+void printEvent(Json *ptEvent)
+{
+  cout << ptEvent->m["Time"]->v << "  " << left << setw(24) << setfill(' ') << ptEvent->m["Service"]->v << "  " << setw(9) << ptEvent->m["Event"]->v << right;
+  if (ptEvent->m.find("Pid") != ptEvent->m.end())
+  {
+    cout << "  pid " << ptEvent->m["Pid"]->v;
+  }
+  if (ptEvent->m.find("Status") != ptEvent->m.end())
+  {
+    cout << "  status " << ptEvent->m["Status"]->v;
+  }
+  if (ptEvent->m.find("Duration") != ptEvent->m.end())
+  {
+    cout << "  " << ptEvent->m["Duration"]->v;
+  }
+  cout << endl;
+}
+// }}}
+// {{{ printJob()
+void printJob(Json *ptJob)
+{
+  cout << right << setw(6) << setfill(' ') << ptJob->m["Job"]->v << "  " << ptJob->m["Queued"]->v << "  " << left << setw(17) << ptJob->m["Function"]->v << "  " << setw(24) << ptJob->m["Service"]->v << "  " << ptJob->m["State"]->v << right;
+  if (ptJob->m.find("Error") != ptJob->m.end())
+  {
+    cout << "  " << ptJob->m["Error"]->v;
+  }
+  cout << endl;
+}
+// }}}
@@ -25,26 +25,48 @@
 * Manages non-root services.
 */
 // {{{ includes
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
 #include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <list>
 #include <map>
+#include <mutex>
+#include <netinet/in.h>
 #include <poll.h>
 #include <sstream>
 #include <string>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
+#include <zlib.h>
 using namespace std;
 #include <Central>
 #include <Json>
@@ -61,11 +83,15 @@ using namespace common;
 /*! \def mUSAGE(A)
 * \brief Prints the usage statement.
 */
-#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [options]"  << endl << endl << " -c, --conf=[CONF]" << endl << "     Provides the configuration path." << endl << endl << " -d, --daemon" << endl << "     Turns the process into a daemon." << endl << endl << "     --data=[PATH]" << endl << "     Sets the data directory." << endl << endl << " -e EMAIL, --email=EMAIL" << endl << "     Provides the email address for default notifications." << endl << endl << " -h, --help" << endl << "     Displays this usage screen." << endl << endl << " -v, --version" << endl << "     Displays the current version of this software." << endl << endl
+#define mUSAGE(A) cout << endl << "Usage:  "<< A << " [options]"  << endl << endl << " -c, --conf=[CONF]" << endl << "     Provides the configuration path." << endl << endl << " -d, --daemon" << endl << "     Turns the process into a daemon." << endl << endl << "     --core-backtrace" << endl << "     Adds a gdb backtrace of each new core dump to the crash notifications." << endl << endl << "     --core-limit=[MEGABYTES]" << endl << "     Sets the total size of compressed core dumps kept in the cores directory (default 4096)." << endl << endl << "     --core-service-limit=[MEGABYTES]" << endl << "     Sets the size of compressed core dumps kept per service (default 1024)." << endl << endl << "     --data=[PATH]" << endl << "     Sets the data directory." << endl << endl << " -e EMAIL, --email=EMAIL" << endl << "     Provides the email address for default notifications." << endl << endl << " -h, --help" << endl << "     Displays this usage screen." << endl << endl << "     --metrics=[ADDRESS]" << endl << "     Serves Prometheus metrics on a unix socket path, a port, or a host:port (default host 127.0.0.1)." << endl << endl << "     --notify-key-limit=[COUNT]" << endl << "     Sets how many times per hour the same notification is delivered before it is only counted (default 5)." << endl << endl << "     --notify-limit=[COUNT]" << endl << "     Sets how many notification digests are emailed per hour before the rest are only logged (default 20)." << endl << endl << "     --notify-window=[SECONDS]" << endl << "     Sets how long notifications are collected into a single digest (default 60)." << endl << endl << "     --stall=[MILLISECONDS]" << endl << "     Logs the slowest operation of any event loop iteration taking this long (default 1000)." << endl << endl << " -v, --version" << endl << "     Displays the current version of this software." << endl << endl
 /*! \def mVER_USAGE(A,B)
 * \brief Prints the version number.
 */
 #define mVER_USAGE(A,B) cout << endl << A << " Version: " << B << endl << endl
+/*! \def NOTIFY
+* \brief Contains the notify socket path.
+*/
+#define NOTIFY "/notify"
 /*! \def PID
 * \brief Contains the PID path.
 */
@@ -74,6 +100,118 @@ using namespace common;
 * \brief Contains the start path.
 */
 #define START "/.start"
+/*! \def DEFINITIONS_MAGIC
+* \brief Contains the signature and format version of the service definition cache.
+*/
+#define DEFINITIONS_MAGIC "SVCDEF02"
+/*! \def FRAME_ASYNC
+* \brief Contains the binary frame tag of the Async field.
+*/
+#define FRAME_ASYNC 7
+/*! \def FRAME_END
+* \brief Contains the binary frame tag of the End field.
+*/
+#define FRAME_END 3
+/*! \def FRAME_ERROR
+* \brief Contains the binary frame tag of the Error field.
+*/
+#define FRAME_ERROR 5
+/*! \def FRAME_JOB
+* \brief Contains the binary frame tag of the Job field.
+*/
+#define FRAME_JOB 8
+/*! \def FRAME_LIMIT
+* \brief Contains the binary frame tag of the Limit field.
+*/
+#define FRAME_LIMIT 4
+/*! \def FRAME_MAGIC
+* \brief Contains the first byte a client sends to select binary framing instead of JSON lines.
+*/
+#define FRAME_MAGIC 0xB5
+/*! \def FRAME_MAX
+* \brief Contains the largest binary frame payload accepted before the connection is closed.
+*/
+#define FRAME_MAX 1048576
+/*! \def FRAME_RESPONSE
+* \brief Contains the binary frame tag of the Response field.
+*/
+#define FRAME_RESPONSE 6
+/*! \def FRAME_SERVICE
+* \brief Contains the binary frame tag of the Service field.
+*/
+#define FRAME_SERVICE 1
+/*! \def FRAME_START
+* \brief Contains the binary frame tag of the Start field.
+*/
+#define FRAME_START 2
+/*! \def FRAME_VERSION
+* \brief Contains the binary framing version returned after the magic byte.
+*/
+#define FRAME_VERSION 1
+/*! \def HISTOGRAM_BUCKETS
+* \brief Contains the number of log-linear buckets in a histogram.
+*/
+#define HISTOGRAM_BUCKETS 512
+/*! \def JOB_HISTORY
+* \brief Contains the number of finished jobs retained for the jobs and job-wait functions.
+*/
+#define JOB_HISTORY 1000
+/*! \def JOURNAL_ENTRIES
+* \brief Contains the number of 32 byte slots in a journal segment including its header.
+*/
+#define JOURNAL_ENTRIES 65536
+/*! \def JOURNAL_SEGMENTS
+* \brief Contains the number of journal segments retained.
+*/
+#define JOURNAL_SEGMENTS 32
+/*! \def LOG_BATCH
+* \brief Contains the most records the log writer gathers into a single writev().
+*/
+#define LOG_BATCH 256
+/*! \def LOG_PREFIX
+* \brief Contains the log file prefix shared by Central and the log writer.
+*/
+#define LOG_PREFIX "svcmgrd_"
+/*! \def LOG_RECORDS
+* \brief Contains the capacity of the log queue.
+*/
+#define LOG_RECORDS 8192
+/*! \def LOG_TIME
+* \brief Contains the strftime() format of the timestamp Central begins each log line with.
+*/
+#define LOG_TIME "%Y-%m-%d %H:%M:%S "
+/*! \def REQUEST_EXTRAS
+* \brief Contains the most unrecognized request fields echoed back before the Json fallback is used.
+*/
+#define REQUEST_EXTRAS 8
+/*! \def SCRAPE_MAX
+* \brief Contains the most metrics connections served at once before new ones are refused.
+*/
+#define SCRAPE_MAX 32
+/*! \def SCRAPE_TIMEOUT
+* \brief Contains the number of seconds a metrics connection may take to request and receive its scrape.
+*/
+#define SCRAPE_TIMEOUT 5
+/*! \def TRACE_SPANS
+* \brief Contains the number of spans held by the trace ring.
+*/
+#define TRACE_SPANS 4096
+/*! \def WATCH_BUFFER
+* \brief Contains the most unsent output a watching client may accumulate before it is disconnected.
+*/
+#define WATCH_BUFFER 4194304
+#ifndef SYS_close_range
+/*! \def SYS_close_range
+* \brief Contains the close_range system call number for older headers.
+*/
+#define SYS_close_range 436
+#endif
+#ifndef SYS_pidfd_open
+/*! \def SYS_pidfd_open
+* \brief Contains the pidfd_open system call number for older headers.
+*/
+#define SYS_pidfd_open 434
+#endif
 /*! \def UNIX_SOCKET
 * \brief Contains the unix socket path.
 */
@@ -82,40 +220,772 @@ using namespace common;
 #endif
 // }}}
 // {{{ structs
+struct crash
+{
+  time_t CTime;
+  string strBinary;
+  string strService;
+};
+struct definitionHeader
+{
+  char szMagic[8];
+  uint32_t unCount;
+  uint32_t unReserved;
+};
+struct definitionRecord
+{
+  int64_t nModifiedSec;
+  int64_t nModifiedNsec;
+  uint64_t unSize;
+  uint32_t unNameLength;
+  uint32_t unLength;
+};
+struct frameHeader
+{
+  uint32_t unLength;
+  uint32_t unId;
+  uint16_t usFunction;
+  uint16_t usStatus;
+};
+struct histogram
+{
+  size_t unCount;
+  size_t unMax;
+  size_t unSum;
+  size_t buckets[HISTOGRAM_BUCKETS];
+};
+struct span
+{
+  size_t unDuration;
+  size_t unStart;
+  string strName;
+  string strService;
+};
+struct watcher
+{
+  bool bBinary;
+  frameHeader tFrame;
+  int fdSocket;
+  string strPrefix;
+  string strService;
+};
+struct job
+{
+  bool bStopping;
+  pid_t nPid;
+  time_t CFinished;
+  time_t CQueued;
+  time_t CStarted;
+  size_t unId;
+  size_t unStart;
+  string strError;
+  string strFunction;
+  string strService;
+  string strState;
+  list<watcher> replies;
+  list<watcher> waiters;
+};
+struct journalEntry
+{
+  uint64_t unTime;
+  uint32_t unService;
+  int32_t nPid;
+  int32_t nStatus;
+  uint32_t unDuration;
+  uint16_t usEvent;
+  uint16_t usReserved;
+  uint32_t unReserved;
+};
+struct journalHeader
+{
+  char szMagic[8];
+  uint64_t unFirst;
+  uint64_t unLast;
+  uint32_t unCount;
+  uint32_t unReserved;
+};
+struct notification
+{
+  size_t unCount;
+  time_t CFirst;
+  time_t CLast;
+  string strFirst;
+  string strLast;
+};
+struct record
+{
+  atomic<bool> bReady;
+  bool bNotify;
+  time_t CTime;
+  string strMessage;
+};
+struct requestValue
+{
+  const char *pszData;
+  size_t unSize;
+  bool bString;
+};
+struct request
+{
+  requestValue tAsync;
+  requestValue tEnd;
+  requestValue tFunction;
+  requestValue tJob;
+  requestValue tLimit;
+  requestValue tService;
+  requestValue tStart;
+  size_t unExtras;
+  requestValue extras[REQUEST_EXTRAS][2];
+};
+struct scrape
+{
+  size_t unAccepted;
+  string strBuffer[2];
+};
 struct service
 {
+  bool bAdopted;
+  bool bCoreDumped;
   bool bDetached;
+  bool bHandoverStopping;
+  bool bHealthCheckConnected;
+  bool bReady;
+  bool bStopDiagnosed;
+  bool bStopMain;
   bool bStopped;
-  pid_t nPid;
+  bool bStopping;
+  int nExitSignal;
+  int nExitStatus;
+  int nKillSignal;
+  pid_t nHealthCheckPid;
+  pid_t nStopGroup;
   list<string> environment;
-  size_t unCrashes;
+  list<string> listenDatagram;
+  list<string> listenStream;
+  size_t unFdStoreMax;
+  size_t unHealthCheckFailures;
+  size_t unHealthCheckInterval;
+  size_t unHealthCheckLatency;
+  size_t unHealthCheckStart;
+  size_t unHealthCheckThreshold;
+  size_t unHealthCheckTimeout;
+  size_t unId;
+  size_t unIdleCpu;
+  size_t unIdleStopSec;
+  size_t unRestarts;
+  size_t unStartDuration;
+  size_t unStarts;
+  size_t unStopDuration;
+  size_t unStopStart;
+  size_t unStopWait;
+  rusage tUsage;
+  size_t unTimeoutStopSec;
   string strDescription;
   string strExecStart;
   string strExecStartPost;
   string strExecStartPre;
   string strExecStopPost;
+  string strHealth;
+  string strHealthCheckBuffer[2];
+  string strHealthCheckCommand;
+  string strHealthCheckHost;
+  string strHealthCheckPath;
+  string strHealthCheckPort;
+  string strHealthCheckType;
+  string strKillMode;
   string strLimitCore;
   string strLimitNoFile;
   string strPidFile;
+  string strExitCause;
   string strRestart;
+  string strStale;
+  string strStopDiagnostics;
+  string strType;
+  time_t CHandover;
+  time_t CIdle;
+  time_t CIdleCheck;
   time_t CStart;
+  timespec tDefinitionModified;
+  size_t unDefinitionSize;
+  vector<int> listens;
+  vector<pair<string, int> > fdstore;
+};
+struct serviceHot
+{
+  bool bListening;
+  int fdHealthCheck;
+  int fdPid;
+  pid_t nHandoverPid;
+  pid_t nPid;
+  size_t unCrashes;
+  service *ptService;
 };
 // }}}
 // {{{ global variables
+atomic<bool> gbCoreStop(false); //!< Global core manager stop flag.
+atomic<size_t> gunCoresCompressed(0); //!< Global number of core dumps compressed.
+atomic<size_t> gunCoresRemoved(0); //!< Global number of core dumps removed to honor the quotas.
+atomic<size_t> gunDefinitionsCached(0); //!< Global number of service definitions decoded from the cache.
+atomic<size_t> gunDefinitionsParsed(0); //!< Global number of service definitions parsed from their files.
+atomic<size_t> gunDiagnosing(0); //!< Global number of hang diagnostics still being captured.
+bool gbCoreBacktrace = false; //!< Global whether to extract backtraces from new core dumps.
+atomic<bool> gbLogStop(false); //!< Global log writer stop flag.
+atomic<size_t> gunLogBatches(0); //!< Global number of writev() batches written by the log writer.
+atomic<size_t> gunLogDropped(0); //!< Global number of records dropped because the log queue was full.
+atomic<size_t> gunLogHead(0); //!< Global log queue position of the writer.
+atomic<size_t> gunLogTail(0); //!< Global log queue position of the event loop.
+atomic<size_t> gunLogWritten(0); //!< Global number of records written by the log writer.
+atomic<size_t> gunNotifyReceived(0); //!< Global number of notifications received by the aggregator.
+atomic<size_t> gunNotifySent(0); //!< Global number of notification digests delivered.
+atomic<size_t> gunNotifySuppressed(0); //!< Global number of notifications withheld by the rate caps.
+bool gbNotifyStop = false; //!< Global notifier stop flag guarded by the notification mutex.
+condition_variable gNotifyCondition; //!< Global notifier wake up condition.
 char **environ;
+char *gpszDefinitions = NULL; //!< Global memory mapped service definition cache.
 bool gbDaemon = false; //!< Global daemon variable.
+bool gbDefinitionsDirty = false; //!< Global whether the service definition cache needs to be rewritten.
+bool gbReload = false; //!< Global daemon reload variable set by SIGHUP.
 bool gbShutdown = false; //!< Global shutdown variable.
-map<string, service *> gServices; //!< Global services.
+volatile sig_atomic_t gbSignals[NSIG] = {0}; //!< Global signals caught but not yet dispatched.
+volatile sig_atomic_t gnSignalPids[NSIG] = {0}; //!< Global senders of the caught signals.
+map<pid_t, crash> gCrashes; //!< Global recent core dumping crashes keyed by process guarded by the core mutex.
+map<string, service *> gDefinitions; //!< Global service definitions parsed ahead of serviceAdd() by the startup thread pool.
+list<watcher> gWatchers; //!< Global client requests streaming journal events.
+map<int, string> gWatchBuffers; //!< Global journal events and deferred replies waiting to be moved to the output of clients keyed by socket.
+list<size_t> gJobsFinished; //!< Global finished job IDs oldest first.
+map<size_t, job> gJobs; //!< Global recent jobs keyed by ID.
+map<string, list<size_t> > gJobQueues; //!< Global unfinished job IDs keyed by service.
+map<string, histogram> gHistograms; //!< Global latency histograms in microseconds.
+map<string, uint32_t> gJournalServices; //!< Global journal identifiers of services.
+map<string, notification> gNotifications; //!< Global notifications of the open digest window keyed by their normalized text.
+map<string, size_t> gNotifyKeys; //!< Global deliveries per notification key during the current hour.
+mutex gCoreMutex; //!< Global mutex guarding the recent core dumping crashes.
+mutex gNotifyMutex; //!< Global mutex guarding the notification aggregator.
+mutex gWorkerMutex; //!< Global mutex guarding the worker thread children.
+list<pid_t> gWorkerPids; //!< Global children of worker threads which wait on them themselves guarded by the worker mutex.
+vector<serviceHot> gServiceHot; //!< Global per tick state of the services indexed by their dense identifiers.
+unordered_map<pid_t, service *> gPids; //!< Global service, handover, and health check processes hashed by process ID.
+unordered_map<string, service *> gServices; //!< Global services hashed by name.
+vector<size_t> gServiceFree; //!< Global released service identifiers.
+vector<string> gServiceNames; //!< Global service names indexed by their dense identifiers.
 rlim_t gResourceLimitCoreSoft; //!< Global core soft limit.
 rlim_t gResourceLimitCoreHard; //!< Global core hard limit.
 rlim_t gResourceLimitNoFileSoft; //!< Global file descriptor soft limit.
 rlim_t gResourceLimitNoFileHard; //!< Global file descriptor hard limit.
 string gstrApplication = "Service Manager"; //!< Global application name.
+string gstrBinary; //!< Global binary path.
 string gstrData = "/data/svcmgr"; //!< Global data path.
 string gstrEmail; //!< Global notification email address.
+string gstrMetrics; //!< Global metrics listener address.
+string gstrMetricsBuffer; //!< Global preallocated metrics rendering buffer.
+string gstrStall; //!< Global slowest operation of the current event loop iteration.
+size_t gunStall = 0; //!< Global duration of the slowest operation of the current event loop iteration in nanoseconds.
+size_t gunStallStart = 0; //!< Global monotonic start of the slowest operation of the current event loop iteration.
+size_t gunStallThreshold = 1000; //!< Global event loop stall threshold in milliseconds.
+size_t gunStalls = 0; //!< Global number of stalled event loop iterations.
+size_t gunDefinitions = 0; //!< Global size of the memory mapped service definition cache.
+size_t gunCoreLimit = 4096; //!< Global total core dump quota in megabytes.
+size_t gunCoreServiceLimit = 1024; //!< Global per service core dump quota in megabytes.
+size_t gunJobId = 0; //!< Global ID of the most recent job.
+size_t gunJournalSegment = 0; //!< Global sequence of the journal segment being appended.
+size_t gunNotifyDigests = 0; //!< Global number of digests delivered during the current hour.
+size_t gunNotifyKeyLimit = 5; //!< Global deliveries allowed per notification key per hour.
+size_t gunNotifyLimit = 20; //!< Global digests allowed per hour.
+size_t gunNotifyWindow = 60; //!< Global digest window in seconds.
+time_t gCNotifyHour = 0; //!< Global start of the current notification rate hour.
+time_t gCNotifyWindow = 0; //!< Global start of the open digest window.
+size_t gunSpans = 0; //!< Global number of spans ever recorded in the trace ring.
+span gSpans[TRACE_SPANS]; //!< Global trace ring of lifecycle spans.
 Central *gpCentral = NULL; //!< Contains the Central class.
+Json *gptUpgrade = NULL; //!< Contains the state handed over by a live upgrade.
+journalEntry *gptJournal = NULL; //!< Contains the mapped journal segment being appended whose first slot is its header.
+const string gstrJournalEvents[] = {"", "boot", "upgrade", "start", "stop", "kill", "crash", "unhealthy", "restart", "abandon", "failed", "exit", "hang"}; //!< Global journal event names.
+const string gstrFunctions[] = {"", "daemon-reload", "disable", "enable", "history", "list", "ping", "reload", "reload-or-restart", "restart", "start", "stats", "status", "stop", "trace", "upgrade", "watch", "job-cancel", "job-wait", "jobs"}; //!< Global control functions indexed by their binary frame codes which are only ever appended.
+vector<string> gJournalNames; //!< Global service names indexed by journal identifier.
+record gLogRecords[LOG_RECORDS]; //!< Global log queue.
+thread *gptCoreManager = NULL; //!< Contains the core manager thread.
+thread *gptLogWriter = NULL; //!< Contains the log writer thread.
+thread *gptNotifyWriter = NULL; //!< Contains the notifier thread.
 // }}}
 // {{{ prototypes
+/*! \fn bool coreBacktrace(const string strBinary, const string strCore, string &strBacktrace)
+* \brief Extracts a short backtrace from a core dump using gdb.
+* \param strBinary Contains the executable which dumped core.
+* \param strCore Contains the core dump.
+* \param strBacktrace Returns the frames.
+* \return Returns a boolean true/false value.
+*/
+bool coreBacktrace(const string strBinary, const string strCore, string &strBacktrace);
+/*! \fn bool coreCompress(const string strCore, string &strError)
+* \brief Compresses a core dump into a gzip file alongside it and removes the original.
+* \param strCore Contains the core dump.
+* \param strError Contains the error.
+* \return Returns false when the compression failed or was interrupted by a stop.
+*/
+bool coreCompress(const string strCore, string &strError);
+/*! \fn void coreManager()
+* \brief Watches the cores directory and renames, compresses, and prunes new core dumps at a low priority.
+*/
+void coreManager();
+/*! \fn void coreQuota()
+* \brief Removes the oldest core dumps until the per service and total quotas are honored.
+*/
+void coreQuota();
+/*! \fn void coreRecord(const string strService, const pid_t nPid)
+* \brief Remembers a crash which dumped core so the core manager can name its core dump.
+* \param strService Contains the service.
+* \param nPid Contains the process.
+*/
+void coreRecord(const string strService, const pid_t nPid);
+/*! \fn string coreService(const string strName)
+* \brief Retrieves the service from the name of a collected core dump.
+* \param strName Contains the file name.
+* \return Returns the service or an empty string.
+*/
+string coreService(const string strName);
+/*! \fn void coreStart()
+* \brief Starts the core manager.
+*/
+void coreStart();
+/*! \fn void coreStop()
+* \brief Stops the core manager.
+*/
+void coreStop();
+/*! \fn void daemonReload(map<string, string> &changes)
+* \brief Reparses the definitions of loaded services whose files changed and applies them.
+* \param changes Returns the changed keys of each reloaded service.
+*/
+void daemonReload(map<string, string> &changes);
+/*! \fn void definitionClose()
+* \brief Unmaps the service definition cache.
+*/
+void definitionClose();
+/*! \fn bool definitionDecode(const char *pszRecord, const size_t unSize, service *ptService)
+* \brief Decodes the definition fields of a cached record.
+* \param pszRecord Contains the encoded fields.
+* \param unSize Contains the size of the encoded fields.
+* \param ptService Returns the definition fields.
+* \return Returns false when the record is truncated.
+*/
+bool definitionDecode(const char *pszRecord, const size_t unSize, service *ptService);
+/*! \fn string &definitionEncode(service *ptService, string &strRecord)
+* \brief Encodes the definition fields of a service for the cache.
+* \param ptService Contains the service.
+* \param strRecord Returns the encoded fields.
+* \return Returns the encoded fields.
+*/
+string &definitionEncode(service *ptService, string &strRecord);
+/*! \fn void definitionFields(service *ptService, vector<string *> &strings, vector<list<string> *> &lists, vector<size_t *> &numbers)
+* \brief Retrieves the definition fields of a service in cache order.
+* \param ptService Contains the service.
+* \param strings Returns the string fields.
+* \param lists Returns the list fields.
+* \param numbers Returns the numeric fields apart from the kill signal.
+*/
+void definitionFields(service *ptService, vector<string *> &strings, vector<list<string> *> &lists, vector<size_t *> &numbers);
+/*! \fn bool definitionFind(const string strService, const char *&pszRecord, size_t &unSize, definitionRecord &tRecord)
+* \brief Binary searches the service definition cache.
+* \param strService Contains the service.
+* \param pszRecord Returns the encoded fields.
+* \param unSize Returns the size of the encoded fields.
+* \param tRecord Returns the record header.
+* \return Returns a boolean true/false value indicating whether the service is cached.
+*/
+bool definitionFind(const string strService, const char *&pszRecord, size_t &unSize, definitionRecord &tRecord);
+/*! \fn bool definitionLookup(const string strService, const struct stat &tStat, service *ptService)
+* \brief Retrieves a cached definition when its modification time and size still match the file.
+* \param strService Contains the service.
+* \param tStat Contains the current stat() of the definition file.
+* \param ptService Returns the definition fields or NULL to only validate the record.
+* \return Returns a boolean true/false value indicating whether the cached definition is current.
+*/
+bool definitionLookup(const string strService, const struct stat &tStat, service *ptService);
+/*! \fn void definitionMove(service *ptSource, service *ptTarget)
+* \brief Moves the definition fields from one service to another.
+* \param ptSource Contains the source which is left with the previous fields of the target.
+* \param ptTarget Returns the definition fields.
+*/
+void definitionMove(service *ptSource, service *ptTarget);
+/*! \fn void definitionOpen()
+* \brief Maps the service definition cache when it exists and matches this version.
+*/
+void definitionOpen();
+/*! \fn bool definitionParse(const string strService, service *ptService, string &strError)
+* \brief Parses the definition of a service from its JSON file without touching any shared state.
+* \param strService Contains the service.
+* \param ptService Returns the definition fields.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool definitionParse(const string strService, service *ptService, string &strError);
+/*! \fn void definitionPrepare(const list<string> &services)
+* \brief Parses the definitions which are missing from or stale in the cache across a thread pool.
+* \param services Contains the services about to be added.
+*/
+void definitionPrepare(const list<string> &services);
+/*! \fn void definitionSave()
+* \brief Rewrites the service definition cache and maps the new file.
+*/
+void definitionSave();
+/*! \fn void definitionWorker(const vector<string> &misses, vector<service *> &parsed, atomic<size_t> &unNext)
+* \brief Parses definitions for definitionPrepare() until none are left.
+* \param misses Contains the services to parse.
+* \param parsed Returns the parsed definitions in the same positions.
+* \param unNext Contains the next position to claim.
+*/
+void definitionWorker(const vector<string> &misses, vector<service *> &parsed, atomic<size_t> &unNext);
+/*! \fn string &frameEncode(Json *ptJson, string &strBuffer)
+* \brief Appends a response tree as tagged, length prefixed objects, arrays, and values.
+* \param ptJson Contains the response.
+* \param strBuffer Returns the encoding appended to the buffer.
+* \return Returns the buffer.
+*/
+string &frameEncode(Json *ptJson, string &strBuffer);
+/*! \fn void frameField(const uint8_t ucTag, const char *pszData, const size_t unSize, string &strBuffer)
+* \brief Appends a tagged, length prefixed frame field.
+* \param ucTag Contains the field tag.
+* \param pszData Contains the field value.
+* \param unSize Contains the length of the field value.
+* \param strBuffer Returns the field appended to the buffer.
+*/
+void frameField(const uint8_t ucTag, const char *pszData, const size_t unSize, string &strBuffer);
+/*! \fn string &frameHex(const string strData, string &strHex)
+* \brief Hex encodes binary connection buffers for the upgrade state.
+* \param strData Contains the data.
+* \param strHex Returns the hex digits.
+* \return Returns the hex digits.
+*/
+string &frameHex(const string strData, string &strHex);
+/*! \fn bool frameParse(string &strBuffer, size_t &unConsumed, request &tRequest, frameHeader &tFrame, bool &bClose)
+* \brief Parses the next complete binary frame of a connection without copying it.
+* \param strBuffer Contains the received data.
+* \param unConsumed Contains the offset of the next frame and returns the offset after it.
+* \param tRequest Returns the function and the spans of the known fields.
+* \param tFrame Returns the header in host byte order.
+* \param bClose Returns true when the frame exceeds FRAME_MAX.
+* \return Returns true when a frame was parsed.
+*/
+bool frameParse(string &strBuffer, size_t &unConsumed, request &tRequest, frameHeader &tFrame, bool &bClose);
+/*! \fn string &frameReply(const frameHeader &tFrame, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer)
+* \brief Writes a reply frame carrying the request ID directly to the output buffer.
+* \param tFrame Contains the request header.
+* \param bProcessed Contains whether the request succeeded.
+* \param strError Contains the error.
+* \param ptResponse Contains the response or NULL.
+* \param strBuffer Returns the reply appended to the buffer.
+* \return Returns the buffer.
+*/
+string &frameReply(const frameHeader &tFrame, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer);
+/*! \fn string &frameUnhex(const string strHex, string &strData)
+* \brief Decodes hex encoded connection buffers from the upgrade state.
+* \param strHex Contains the hex digits.
+* \param strData Returns the data.
+* \return Returns the data.
+*/
+string &frameUnhex(const string strHex, string &strData);
+/*! \fn void healthCheck(const size_t unId)
+* \brief Schedules the health check for a service.
+* \param unId Contains the dense identifier of the service.
+*/
+void healthCheck(const size_t unId);
+/*! \fn void healthCheckCancel(const string strService)
+* \brief Cancels an outstanding health check probe.
+* \param strService Contains the service.
+*/
+void healthCheckCancel(const string strService);
+/*! \fn void healthCheckFinish(const string strService, const bool bHealthy, const string strError)
+* \brief Records the result of a health check probe.
+* \param strService Contains the service.
+* \param bHealthy Contains the probe result.
+* \param strError Contains the error.
+*/
+void healthCheckFinish(const string strService, const bool bHealthy, const string strError);
+/*! \fn void healthCheckPoll(const string strService, const short sRevents)
+* \brief Processes poll events for a health check probe.
+* \param strService Contains the service.
+* \param sRevents Contains the returned poll events.
+*/
+void healthCheckPoll(const string strService, const short sRevents);
+/*! \fn bool healthCheckStart(const string strService, string &strError)
+* \brief Starts a health check probe.
+* \param strService Contains the service.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool healthCheckStart(const string strService, string &strError);
+/*! \fn size_t jobAdd(const string strFunction, const string strService)
+* \brief Queues a lifecycle operation behind the earlier operations on the same service.
+* \param strFunction Contains the function.
+* \param strService Contains the service.
+* \return Returns the job ID.
+*/
+size_t jobAdd(const string strFunction, const string strService);
+/*! \fn bool jobCancel(const size_t unId, string &strError)
+* \brief Cancels a job which has not started yet.
+* \param unId Contains the job ID.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool jobCancel(const size_t unId, string &strError);
+/*! \fn void jobDescribe(const job &tJob, Json *ptJob)
+* \brief Formats a job.
+* \param tJob Contains the job.
+* \param ptJob Returns the formatted job.
+*/
+void jobDescribe(const job &tJob, Json *ptJob);
+/*! \fn void jobFinish(const size_t unId, const bool bResult, const string strError, const string strState)
+* \brief Finishes a job and replies to the requests waiting on it.
+* \param unId Contains the job ID.
+* \param bResult Contains whether the operation succeeded.
+* \param strError Contains the error.
+* \param strState Contains the final state.
+*/
+void jobFinish(const size_t unId, const bool bResult, const string strError, const string strState);
+/*! \fn void jobProcess()
+* \brief Advances the oldest job of each service without blocking.
+*/
+void jobProcess();
+/*! \fn void jobRemove(const int fdSocket)
+* \brief Drops the deferred replies of a closed client.
+* \param fdSocket Contains the client socket.
+*/
+void jobRemove(const int fdSocket);
+/*! \fn void journalClose()
+* \brief Unmaps the journal segment being appended.
+*/
+void journalClose();
+/*! \fn void journalFormat(const journalEntry &tEntry, Json *ptEntry)
+* \brief Describes a journal entry.
+* \param tEntry Contains the journal entry.
+* \param ptEntry Returns the time, service, event, process, status, and duration.
+*/
+void journalFormat(const journalEntry &tEntry, Json *ptEntry);
+/*! \fn bool journalOpen(string &strError)
+* \brief Loads the journal service identifiers and maps the newest journal segment.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool journalOpen(string &strError);
+/*! \fn void journalQuery(const string strService, const time_t CStart, const time_t CEnd, const size_t unLimit, Json *ptEntries)
+* \brief Retrieves the most recent journal entries within a time range.
+* \param strService Contains the service or is empty for all services.
+* \param CStart Contains the start of the time range.
+* \param CEnd Contains the end of the time range.
+* \param unLimit Contains the most entries to retrieve.
+* \param ptEntries Returns the entries oldest first.
+*/
+void journalQuery(const string strService, const time_t CStart, const time_t CEnd, const size_t unLimit, Json *ptEntries);
+/*! \fn void journalRecord(const string strService, const string strEvent, const pid_t nPid, const int nStatus, const size_t unDuration)
+* \brief Appends an entry to the journal.
+* \param strService Contains the service or is empty for the daemon.
+* \param strEvent Contains the event.
+* \param nPid Contains the process.
+* \param nStatus Contains the exit status or -1.
+* \param unDuration Contains the duration in microseconds.
+*/
+void journalRecord(const string strService, const string strEvent, const pid_t nPid, const int nStatus, const size_t unDuration);
+/*! \fn bool journalRotate(string &strError)
+* \brief Maps a new journal segment and prunes the oldest ones.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool journalRotate(string &strError);
+/*! \fn list<size_t> &journalSegments(list<size_t> &segments)
+* \brief Lists the journal segments.
+* \param segments Returns the segment sequences in ascending order.
+* \return Returns the segments.
+*/
+list<size_t> &journalSegments(list<size_t> &segments);
+/*! \fn void logMessage(const string strMessage)
+* \brief Queues a log message for the log writer.
+* \param strMessage Contains the message.
+*/
+void logMessage(const string strMessage);
+/*! \fn void logNotify(const string strMessage)
+* \brief Queues a notification for the log writer.
+* \param strMessage Contains the message.
+*/
+void logNotify(const string strMessage);
+/*! \fn string &logPath(const time_t CTime, string &strPath)
+* \brief Builds the path of the monthly log Central was configured with through setLog().
+* \param CTime Contains a time within the month.
+* \param strPath Returns the path.
+* \return Returns the path.
+*/
+string &logPath(const time_t CTime, string &strPath);
+/*! \fn bool logPush(const bool bNotify, const string strMessage)
+* \brief Pushes a record onto the log queue without blocking from any thread other than a signal handler.
+* \param bNotify Contains whether the record is a notification.
+* \param strMessage Contains the message.
+* \return Returns false when the queue was full and the record was dropped.
+*/
+bool logPush(const bool bNotify, const string strMessage);
+/*! \fn void logStart()
+* \brief Starts the log writer.
+*/
+void logStart();
+/*! \fn void logStop()
+* \brief Drains the log queue and stops the log writer.
+*/
+void logStop();
+/*! \fn void logWriter()
+* \brief Drains the log queue in batches, rotating the log monthly.
+*/
+void logWriter();
+/*! \fn void metricsAppend(const char *pszFormat, ...)
+* \brief Appends a formatted line to the preallocated metrics buffer.
+* \param pszFormat Contains the printf format.
+*/
+void metricsAppend(const char *pszFormat, ...);
+/*! \fn bool metricsListen(const string strAddress, int &fdMetrics, string &strError)
+* \brief Binds the metrics listener.
+* \param strAddress Contains a unix socket path, a port, or a host:port.
+* \param fdMetrics Returns the listening socket.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool metricsListen(const string strAddress, int &fdMetrics, string &strError);
+/*! \fn void metricsRender(const size_t unLag)
+* \brief Renders the Prometheus exposition into the preallocated metrics buffer.
+* \param unLag Contains the busy time of the last event loop iteration in nanoseconds.
+*/
+void metricsRender(const size_t unLag);
+/*! \fn void notifyFlush(const bool bForce)
+* \brief Delivers the open digest once its window has elapsed.
+* \param bForce Contains whether to deliver the digest regardless of its window.
+*/
+void notifyFlush(const bool bForce);
+/*! \fn string &notifyKey(const string strMessage, string &strKey)
+* \brief Normalizes a notification into its deduplication key.
+* \param strMessage Contains the message.
+* \param strKey Returns the message with each run of digits replaced by #.
+* \return Returns the key.
+*/
+string &notifyKey(const string strMessage, string &strKey);
+/*! \fn void notifyPush(const string strMessage)
+* \brief Adds a notification to the open digest.
+* \param strMessage Contains the message.
+*/
+void notifyPush(const string strMessage);
+/*! \fn void notifyWriter()
+* \brief Delivers digests off the event loop until stopped.
+*/
+void notifyWriter();
+/*! \fn list<pid_t> &processChildren(const pid_t nPid, list<pid_t> &children)
+* \brief Retrieves the children of a process.
+* \param nPid Contains the process ID.
+* \param children Returns the process IDs of the children appended to the list.
+* \return Returns the list of children.
+*/
+list<pid_t> &processChildren(const pid_t nPid, list<pid_t> &children);
+/*! \fn string &processCommand(const pid_t nPid, string &strCommand)
+* \brief Retrieves the executable of a process.
+* \param nPid Contains the process ID.
+* \param strCommand Returns the first argument of the command line.
+* \return Returns the first argument of the command line.
+*/
+string &processCommand(const pid_t nPid, string &strCommand);
+/*! \fn void processDiagnose(const string strService, const pid_t nPid, const string strPath, const string strModes)
+* \brief Snapshots the threads, wait channels, kernel stacks, status, and descriptor counts of a hung service on its own thread.
+* \param strService Contains the service.
+* \param nPid Contains the main process ID.
+* \param strPath Contains the path prefix of the diagnostic files.
+* \param strModes Contains the StopDiagnostics value which may also request gcore and sigquit.
+*/
+void processDiagnose(const string strService, const pid_t nPid, const string strPath, const string strModes);
+/*! \fn void processReap()
+* \brief Reaps zombie children which are neither tracked as a service, handover, or health check process nor owned by a worker thread.
+*/
+void processReap();
+/*! \fn string &processService(const pid_t nPid, string &strService)
+* \brief Retrieves the service a process was started for.
+* \param nPid Contains the process ID.
+* \param strService Returns the SVCMGR_SERVICE environment value.
+* \return Returns the service.
+*/
+string &processService(const pid_t nPid, string &strService);
+/*! \fn size_t processStart(const pid_t nPid)
+* \brief Retrieves the start time of a process.
+* \param nPid Contains the process ID.
+* \return Returns the start time in clock ticks since boot or zero when the process does not exist.
+*/
+size_t processStart(const pid_t nPid);
+/*! \fn char processState(const pid_t nPid)
+* \brief Retrieves the state of a process.
+* \param nPid Contains the process ID.
+* \return Returns the state character from /proc or a null character when the process does not exist.
+*/
+char processState(const pid_t nPid);
+/*! \fn void processTrack(service *ptService, pid_t &nField, const pid_t nPid)
+* \brief Sets a service, handover, or health check process and keeps the tracked process index current.
+* \param ptService Contains the service.
+* \param nField Contains the process field of the service.
+* \param nPid Contains the new process ID or -1.
+*/
+void processTrack(service *ptService, pid_t &nField, const pid_t nPid);
+/*! \fn string &requestEcho(const request &tRequest, string &strBuffer)
+* \brief Appends the fields of a request which are echoed in its replies each followed by a comma.
+* \param tRequest Contains the parsed request.
+* \param strBuffer Returns the fields appended to the buffer.
+* \return Returns the buffer.
+*/
+string &requestEcho(const request &tRequest, string &strBuffer);
+/*! \fn string &requestEscape(string &strBuffer, const char *pszData, const size_t unSize)
+* \brief Appends a quoted and escaped JSON string.
+* \param strBuffer Returns the string appended to the buffer.
+* \param pszData Contains the text.
+* \param unSize Contains the length of the text.
+* \return Returns the buffer.
+*/
+string &requestEscape(string &strBuffer, const char *pszData, const size_t unSize);
+/*! \fn bool requestIs(const requestValue &tValue, const char *pszText)
+* \brief Compares a request value.
+* \param tValue Contains the request value.
+* \param pszText Contains the text.
+* \return Returns a boolean true/false value.
+*/
+bool requestIs(const requestValue &tValue, const char *pszText);
+/*! \fn long requestNumber(const requestValue &tValue, const long lDefault)
+* \brief Converts a request value to a number.
+* \param tValue Contains the request value.
+* \param lDefault Contains the number used when the value is missing.
+* \return Returns the number.
+*/
+long requestNumber(const requestValue &tValue, const long lDefault);
+/*! \fn bool requestParse(char *pszLine, const size_t unSize, request &tRequest)
+* \brief Parses a flat request object in place without allocating.
+* \param pszLine Contains the request line which is unescaped in place.
+* \param unSize Contains the length of the request line.
+* \param tRequest Returns the spans of the known fields and the raw unrecognized fields.
+* \return Returns false when the line needs the Json fallback.
+*/
+bool requestParse(char *pszLine, const size_t unSize, request &tRequest);
+/*! \fn string &requestReply(const request &tRequest, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer)
+* \brief Writes a reply line directly to the output buffer.
+* \param tRequest Contains the parsed request.
+* \param bProcessed Contains whether the request succeeded.
+* \param strError Contains the error.
+* \param ptResponse Contains the response or NULL.
+* \param strBuffer Returns the reply appended to the buffer.
+* \return Returns the buffer.
+*/
+string &requestReply(const request &tRequest, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer);
+/*! \fn void requestUnescape(char *pszData, size_t &unSize)
+* \brief Decodes the escapes of a JSON string in place.
+* \param pszData Contains the escaped text.
+* \param unSize Contains the escaped length and returns the decoded length.
+*/
+void requestUnescape(char *pszData, size_t &unSize);
+/*! \fn watcher &requestWatcher(const int fdSocket, const request &tRequest, Json *ptJson, const frameHeader *ptFrame, watcher &tWatcher)
+* \brief Captures what is needed to reply to a request later.
+* \param fdSocket Contains the client socket.
+* \param tRequest Contains the parsed request.
+* \param ptJson Contains the request when it needed the Json fallback or NULL.
+* \param ptFrame Contains the request header of a binary client or NULL.
+* \param tWatcher Returns the deferred reply.
+* \return Returns the deferred reply.
+*/
+watcher &requestWatcher(const int fdSocket, const request &tRequest, Json *ptJson, const frameHeader *ptFrame, watcher &tWatcher);
 /*! \fn bool serviceActive(const string strService, string &strError)
 * \brief Active service.
 * \param strService Contains the service.
@@ -130,6 +1000,25 @@ bool serviceActive(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceAdd(const string strService, string &strError);
+/*! \fn bool serviceAdopt(const string strService)
+* \brief Adopts a service instance left running by a previous daemon.
+* \param strService Contains the service.
+* \return Returns a boolean true/false value indicating whether the instance was adopted.
+*/
+bool serviceAdopt(const string strService);
+/*! \fn void serviceCrashed(const string strService, string strEvent, const pid_t nCrashed, const size_t unStart)
+* \brief Reports a crashed or unhealthy service once its stop has finished and restarts it as its Restart setting allows.
+* \param strService Contains the service.
+* \param strEvent Contains the crash or unhealthy event.
+* \param nCrashed Contains the process which crashed.
+* \param unStart Contains the monotonic time the crash was noticed.
+*/
+void serviceCrashed(const string strService, string strEvent, const pid_t nCrashed, const size_t unStart);
+/*! \fn void serviceDiagnose(const string strService)
+* \brief Starts capturing hang diagnostics into the diag directory ahead of the SIGKILL escalation.
+* \param strService Contains the service.
+*/
+void serviceDiagnose(const string strService);
 /*! \fn bool serviceDisable(const string strService, string &strError)
 * \brief Disable service.
 * \param strService Contains the service.
@@ -151,6 +1040,45 @@ bool serviceEnable(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceExist(const string strService, string &strError);
+/*! \fn void serviceExited(const string strService, const int nStatus, const rusage &tUsage)
+* \brief Records how the last run of a service ended.
+* \param strService Contains the service.
+* \param nStatus Contains the status returned by wait4().
+* \param tUsage Contains the resource usage returned by wait4().
+*/
+void serviceExited(const string strService, const int nStatus, const rusage &tUsage);
+/*! \fn pid_t serviceFollow(const string strService)
+* \brief Finds the process a forking service left running after its main process exited.
+* \param strService Contains the service.
+* \return Returns the process ID or zero when the service left nothing running.
+*/
+pid_t serviceFollow(const string strService);
+/*! \fn void serviceHandover(const size_t unId)
+* \brief Retires the previous instance of a service once its replacement is ready.
+* \param unId Contains the dense identifier of the service.
+*/
+void serviceHandover(const size_t unId);
+/*! \fn bool serviceIdle(const size_t unId)
+* \brief Checks an activated service for inactivity.
+* \param unId Contains the dense identifier of the service.
+* \return Returns a boolean true/false value indicating whether the service has been idle for IdleStopSec.
+*/
+bool serviceIdle(const size_t unId);
+/*! \fn void serviceIntern(const string strService, service *ptService)
+* \brief Assigns a service its dense identifier and resets its per tick state.
+* \param strService Contains the service.
+* \param ptService Contains the service.
+*/
+void serviceIntern(const string strService, service *ptService);
+/*! \fn bool serviceKill(const string strService, const pid_t nGroup, const int nSignal, const bool bFinal)
+* \brief Signals the processes of a service according to its KillMode.
+* \param strService Contains the service.
+* \param nGroup Contains the process group or -1 when the service shares the process group of the daemon.
+* \param nSignal Contains the signal where zero only checks for remaining processes.
+* \param bFinal Contains whether this is the final SIGKILL which also reaches the workers in mixed mode.
+* \return Returns a boolean true/false value indicating whether any process was signaled.
+*/
+bool serviceKill(const string strService, const pid_t nGroup, const int nSignal, const bool bFinal);
 /*! \fn bool serviceLink(const string strService, string &strError)
 * \brief Link service.
 * \param strService Contains the service.
@@ -158,6 +1086,47 @@ bool serviceExist(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceLink(const string strService, string &strError);
+/*! \fn bool serviceListen(const string strService, string &strError)
+* \brief Binds the activation sockets of a service.
+* \param strService Contains the service.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool serviceListen(const string strService, string &strError);
+/*! \fn bool serviceNotify(const int fdNotify, string &strError)
+* \brief Receives service notifications.
+* \param fdNotify Contains the notify socket.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool serviceNotify(const int fdNotify, string &strError);
+/*! \fn bool serviceParse(const string strService, service *ptService, string &strError)
+* \brief Retrieves the definition of a service from the startup thread pool, the cache, or its file.
+* \param strService Contains the service.
+* \param ptService Returns the definition fields along with the modification time and size of the file.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool serviceParse(const string strService, service *ptService, string &strError);
+/*! \fn list<pid_t> &serviceProcesses(const string strService, list<pid_t> &processes)
+* \brief Retrieves the process tree of a service.
+* \param strService Contains the service.
+* \param processes Returns the process IDs.
+* \return Returns the list of processes.
+*/
+list<pid_t> &serviceProcesses(const string strService, list<pid_t> &processes);
+/*! \fn void serviceRefresh(const string strService, service &tDefinition, string &strChanges)
+* \brief Applies a reparsed definition to a loaded service.
+* \param strService Contains the service.
+* \param tDefinition Contains the reparsed definition.
+* \param strChanges Returns the changed keys or an empty string when nothing changed.
+*/
+void serviceRefresh(const string strService, service &tDefinition, string &strChanges);
+/*! \fn void serviceRelease(service *ptService)
+* \brief Releases the dense identifier and tracked processes of a service which is about to be deleted.
+* \param ptService Contains the service.
+*/
+void serviceRelease(service *ptService);
 /*! \fn bool serviceReload(const string strService, string &strError)
 * \brief Reload service.
 * \param strService Contains the service.
@@ -165,6 +1134,13 @@ bool serviceLink(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceReload(const string strService, string &strError);
+/*! \fn bool serviceReloadOrRestart(const string strService, string &strError)
+* \brief Restarts a service by starting its replacement before stopping it.
+* \param strService Contains the service.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool serviceReloadOrRestart(const string strService, string &strError);
 /*! \fn bool serviceRemove(const string strService, string &strError)
 * \brief Remove service.
 * \param strService Contains the service.
@@ -172,6 +1148,12 @@ bool serviceReload(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceRemove(const string strService, string &strError);
+/*! \fn void serviceRestore(const string strService, Json *ptState)
+* \brief Restores the runtime state of a service after a live upgrade.
+* \param strService Contains the service.
+* \param ptState Contains the serialized state.
+*/
+void serviceRestore(const string strService, Json *ptState);
 /*! \fn bool serviceRestart(const string strService, string &strError)
 * \brief Restart service.
 * \param strService Contains the service.
@@ -179,6 +1161,22 @@ bool serviceRemove(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceRestart(const string strService, string &strError);
+/*! \fn bool serviceRunning(const size_t unId)
+* \brief Checks whether the main process of a service is still running.
+* \param unId Contains the dense identifier of the service.
+* \return Returns a boolean true/false value.
+*/
+bool serviceRunning(const size_t unId);
+/*! \fn void serviceScan()
+* \brief Walks the dense per tick state to follow handovers, health checks, crashes, idle services, and pending restarts.
+*/
+void serviceScan();
+/*! \fn void serviceSerialize(const string strService, Json *ptState)
+* \brief Serializes the runtime state of a service for a live upgrade.
+* \param strService Contains the service.
+* \param ptState Returns the serialized state.
+*/
+void serviceSerialize(const string strService, Json *ptState);
 /*! \fn bool serviceStart(const string strService, string &strError)
 * \brief Start service.
 * \param strService Contains the service.
@@ -186,6 +1184,20 @@ bool serviceRestart(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceStart(const string strService, string &strError);
+/*! \fn string serviceState(const string strService)
+* \brief State service.
+* \param strService Contains the service.
+* \return Returns the state of a loaded service.
+*/
+string serviceState(const string strService);
+/*! \fn bool serviceStatus(const string strService, map<string, string> &status, string &strError)
+* \brief Status service.
+* \param strService Contains the service.
+* \param status Contains the status.
+* \param strError Contains the error.
+* \return Returns a boolean true/false value.
+*/
+bool serviceStatus(const string strService, map<string, string> &status, string &strError);
 /*! \fn bool serviceStop(const string strService, string &strError)
 * \brief Stop service.
 * \param strService Contains the service.
@@ -193,6 +1205,21 @@ bool serviceStart(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceStop(const string strService, string &strError);
+/*! \fn bool serviceStopBegin(const string strService, string &strError)
+* \brief Signals a service to stop without waiting for it.
+* \param strService Contains the service.
+* \param strError Contains the error.
+* \return Returns true when a stop is under way.
+*/
+bool serviceStopBegin(const string strService, string &strError);
+/*! \fn bool serviceStopPoll(const string strService, bool &bResult, string &strError)
+* \brief Advances a stop begun by serviceStopBegin() without blocking, escalating to SIGKILL after TimeoutStopSec.
+* \param strService Contains the service.
+* \param bResult Returns whether the service stopped once the stop is finished.
+* \param strError Contains the error.
+* \return Returns true when the stop is finished.
+*/
+bool serviceStopPoll(const string strService, bool &bResult, string &strError);
 /*! \fn bool serviceUnlink(const string strService, string &strError)
 * \brief Unlink service.
 * \param strService Contains the service.
@@ -200,6 +1227,11 @@ bool serviceStop(const string strService, string &strError);
 * \return Returns a boolean true/false value.
 */
 bool serviceUnlink(const string strService, string &strError);
+/*! \fn void serviceUnlisten(const string strService)
+* \brief Closes the activation sockets of a service.
+* \param strService Contains the service.
+*/
+void serviceUnlisten(const string strService);
 /*! \fn bool serviceValid(const string strService, string &strError)
 * \brief Valid service.
 * \param strService Contains the service.
@@ -208,12 +1240,111 @@ bool serviceUnlink(const string strService, string &strError);
 */
 bool serviceValid(const string strService, string &strError);
 /*! \fn void sighandle(const int nSignal, siginfo_t *ptInfo, void *vptContext)
-* \brief Establishes signal forwarding for the application.
+* \brief Records a caught signal and its sender for signalDispatch().
 * \param nSignal Contains the caught signal.
 * \param ptInfo Contains the source information.
 * \param ptContext Contains the context.
 */
 void sighandle(const int nSignal, siginfo_t *ptInfo, void *vptContext);
+/*! \fn void signalDispatch()
+* \brief Acts on the signals recorded by sighandle() from the event loop.
+*/
+void signalDispatch();
+/*! \fn int signalNumber(const string strSignal)
+* \brief Converts a signal name or number.
+* \param strSignal Contains the signal such as SIGTERM, TERM, or 15.
+* \return Returns the signal number or zero when the signal is unknown.
+*/
+int signalNumber(const string strSignal);
+/*! \fn size_t statsBucketMax(const size_t unBucket)
+* \brief Retrieves the highest value held by a histogram bucket.
+* \param unBucket Contains the bucket.
+* \return Returns the value in microseconds.
+*/
+size_t statsBucketMax(const size_t unBucket);
+/*! \fn size_t statsPercentile(const string strHistogram, const double dPercentile)
+* \brief Retrieves a percentile from a histogram.
+* \param strHistogram Contains the histogram.
+* \param dPercentile Contains the percentile between zero and one hundred.
+* \return Returns the highest value of the bucket holding the percentile in microseconds.
+*/
+size_t statsPercentile(const string strHistogram, const double dPercentile);
+/*! \fn void statsRecord(const string strOperation, const string strDetail, const size_t unStart)
+* \brief Records the duration of an operation and remembers the slowest operation of the event loop iteration along with the operations enclosing it.
+* \param strOperation Contains the operation which names the histogram.
+* \param strDetail Contains the subject of the operation such as the service.
+* \param unStart Contains the monotonic start time in nanoseconds.
+*/
+void statsRecord(const string strOperation, const string strDetail, const size_t unStart);
+/*! \fn void statsSummary(map<string, string> &stats)
+* \brief Summarizes the histograms and counters.
+* \param stats Returns a line per histogram.
+*/
+void statsSummary(map<string, string> &stats);
+/*! \fn void statsValue(const string strHistogram, const size_t unValue)
+* \brief Records a value in a histogram.
+* \param strHistogram Contains the histogram.
+* \param unValue Contains the value in microseconds.
+*/
+void statsValue(const string strHistogram, const size_t unValue);
+/*! \fn void threadSignals()
+* \brief Blocks every signal in the calling thread so they are delivered to the event loop.
+*/
+void threadSignals();
+/*! \fn size_t timeMonotonic()
+* \brief Retrieves the monotonic clock.
+* \return Returns the monotonic clock in nanoseconds.
+*/
+size_t timeMonotonic();
+/*! \fn void traceExport(Json *ptTrace)
+* \brief Exports the trace ring in the Chrome trace event format.
+* \param ptTrace Returns the trace with a lane per service.
+*/
+void traceExport(Json *ptTrace);
+/*! \fn void traceRecord(const string strName, const string strService, const size_t unStart)
+* \brief Records a completed lifecycle span in the trace ring.
+* \param strName Contains the phase.
+* \param strService Contains the service or is empty for the daemon.
+* \param unStart Contains the monotonic start in nanoseconds.
+*/
+void traceRecord(const string strName, const string strService, const size_t unStart);
+/*! \fn bool upgrade(int argc, char *argv[], const int fdUnix, const int fdNotify, map<int, vector<string> > &sockets, string &strError)
+* \brief Replaces the running binary in place while preserving its state.
+* \param argc Contains the argument count.
+* \param argv Contains the arguments.
+* \param fdUnix Contains the unix socket.
+* \param fdNotify Contains the notify socket.
+* \param sockets Contains the client sockets and their buffers.
+* \param strError Contains the error.
+* \return Returns false when the new binary could not be executed.
+*/
+bool upgrade(int argc, char *argv[], const int fdUnix, const int fdNotify, map<int, vector<string> > &sockets, string &strError);
+/*! \fn void watchAdd(const int fdSocket, const string strService, const string strPrefix, const frameHeader *ptFrame)
+* \brief Subscribes a client request to journal events.
+* \param fdSocket Contains the client socket.
+* \param strService Contains the service or is empty for all services.
+* \param strPrefix Contains the opening of a JSON reply up to the Response field.
+* \param ptFrame Contains the request header of a binary client or NULL.
+*/
+void watchAdd(const int fdSocket, const string strService, const string strPrefix, const frameHeader *ptFrame);
+/*! \fn void watchPush(const journalEntry &tEntry)
+* \brief Queues a journal event as a reply to each matching watch request.
+* \param tEntry Contains the journal entry.
+*/
+void watchPush(const journalEntry &tEntry);
+/*! \fn void watchRemove(const int fdSocket)
+* \brief Drops the watch requests of a closed client.
+* \param fdSocket Contains the client socket.
+*/
+void watchRemove(const int fdSocket);
+/*! \fn void watchReply(const watcher &tWatcher, const bool bProcessed, const string &strError, Json *ptResponse)
+* \brief Queues a reply to a deferred or streaming request.
+* \param tWatcher Contains the request.
+* \param bProcessed Contains whether the request succeeded.
+* \param strError Contains the error.
+* \param ptResponse Contains the response or NULL.
+*/
+void watchReply(const watcher &tWatcher, const bool bProcessed, const string &strError, Json *ptResponse);
 // }}}
 // {{{ main()
 /*! \fn int main(int argc, char *argv[])
@@ -222,6 +1353,9 @@ void sighandle(const int nSignal, siginfo_t *ptInfo, void *vptContext);
 */
 int main(int argc, char *argv[])
 {
+  char szBinary[PATH_MAX];
+  int fdUpgrade = -1;
+  ssize_t nLength;
   struct sigaction act;
   string strError, strPrefix = "main()";
   stringstream ssMessage;
@@ -231,10 +1365,20 @@ int main(int argc, char *argv[])
   sigemptyset(&act.sa_mask);
   act.sa_sigaction = sighandle;
   act.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigaction(SIGHUP, &act, NULL);
   sigaction(SIGINT, &act, NULL);
   sigaction(SIGTERM, &act, NULL);
   // }}}
   gpCentral = new Central(strError);
+  if ((nLength = readlink("/proc/self/exe", szBinary, sizeof(szBinary) - 1)) > 0)
+  {
+    szBinary[nLength] = '\0';
+    gstrBinary = szBinary;
+    if (gstrBinary.size() > 10 && gstrBinary.substr(gstrBinary.size() - 10, 10) == " (deleted)")
+    {
+      gstrBinary.erase(gstrBinary.size() - 10, 10);
+    }
+  }
   // {{{ command line arguments
   for (int i = 1; i < argc; i++)
   {
@@ -255,6 +1399,18 @@ int main(int argc, char *argv[])
       gpCentral->manip()->purgeChar(strConf, strConf, "\"");
       gpCentral->utility()->setConfPath(strConf, strError);
     }
+    else if (strArg == "--core-backtrace")
+    {
+      gbCoreBacktrace = true;
+    }
+    else if (strArg.size() > 13 && strArg.substr(0, 13) == "--core-limit=")
+    {
+      gunCoreLimit = strtoul(strArg.substr(13, strArg.size() - 13).c_str(), NULL, 10);
+    }
+    else if (strArg.size() > 21 && strArg.substr(0, 21) == "--core-service-limit=")
+    {
+      gunCoreServiceLimit = strtoul(strArg.substr(21, strArg.size() - 21).c_str(), NULL, 10);
+    }
     else if (strArg == "-d" || strArg == "--daemon")
     {
       gbDaemon = true;
@@ -278,11 +1434,35 @@ int main(int argc, char *argv[])
       gpCentral->manip()->purgeChar(gstrEmail, gstrEmail, "'");
       gpCentral->manip()->purgeChar(gstrEmail, gstrEmail, "\"");
     }
+    else if (strArg.size() > 10 && strArg.substr(0, 10) == "--metrics=")
+    {
+      gstrMetrics = strArg.substr(10, strArg.size() - 10);
+    }
+    else if (strArg.size() > 19 && strArg.substr(0, 19) == "--notify-key-limit=")
+    {
+      gunNotifyKeyLimit = strtoul(strArg.substr(19, strArg.size() - 19).c_str(), NULL, 10);
+    }
+    else if (strArg.size() > 15 && strArg.substr(0, 15) == "--notify-limit=")
+    {
+      gunNotifyLimit = strtoul(strArg.substr(15, strArg.size() - 15).c_str(), NULL, 10);
+    }
+    else if (strArg.size() > 16 && strArg.substr(0, 16) == "--notify-window=")
+    {
+      gunNotifyWindow = strtoul(strArg.substr(16, strArg.size() - 16).c_str(), NULL, 10);
+    }
+    else if (strArg.size() > 8 && strArg.substr(0, 8) == "--stall=")
+    {
+      gunStallThreshold = strtoul(strArg.substr(8, strArg.size() - 8).c_str(), NULL, 10);
+    }
     else if (strArg == "-h" || strArg == "--help")
     {
       mUSAGE(argv[0]);
       return 0;
     }
+    else if (strArg.size() > 10 && strArg.substr(0, 10) == "--upgrade=")
+    {
+      fdUpgrade = atoi(strArg.substr(10, strArg.size() - 10).c_str());
+    }
     else if (strArg == "-v" || strArg == "--version")
     {
       mVER_USAGE(argv[0], VERSION);
@@ -294,27 +1474,30 @@ int main(int argc, char *argv[])
   {
     gpCentral->setApplication(gstrApplication);
     gpCentral->setEmail(gstrEmail);
-    gpCentral->setLog(gstrData, "svcmgrd_", "monthly", true, true);
+    gpCentral->setLog(gstrData, LOG_PREFIX, "monthly", true, true);
     // {{{ normal run
     if (!gstrEmail.empty())
     {
-      bool bExit = false;
+      bool bExit = false, bUpgrade = false;
       char szBuffer[4096];
-      int fdUnix = -1, nReturn;
-      list<int> removals;
-      list<string> files;
+      int fdMetrics = -1, fdNotify = -1, fdUnix = -1, nReturn;
+      list<int> pidfds, removals;
+      list<string> files, services;
+      map<int, string> listens, probes;
+      map<int, scrape> scrapes;
       map<int, vector<string> > sockets;
       pollfd *fds;
       rlimit tResourceLimit;
-      size_t unIndex, unPosition;
+      size_t unBoot = timeMonotonic(), unIndex, unLag = 0, unLagMax = 0, unLoop = 0, unPosition, unStart;
       string strJson;
       struct stat tStat;
       time_t CUnixSocketTime[2] = {0, 0};
       // {{{ prep
-      if (gbDaemon)
+      if (gbDaemon && fdUpgrade == -1)
       {
         gpCentral->utility()->daemonize();
       }
+      logStart();
       setlocale(LC_ALL, "");
       SSL_library_init();
       OpenSSL_add_all_algorithms();
@@ -332,13 +1515,14 @@ int main(int argc, char *argv[])
       {
         ssMessage.str("");
         ssMessage << strPrefix << "->chdir() [" << gstrData << "/cores]:  Changed the working directory.";
-        gpCentral->log(ssMessage.str());
+        logMessage(ssMessage.str());
+        coreStart();
       }
       else
       {
         ssMessage.str("");
         ssMessage << strPrefix << "->chdir(" << nReturn << ") [" << gstrData << "/cores]:  " << strerror(errno);
-        gpCentral->notify(ssMessage.str());
+        logNotify(ssMessage.str());
       }
       // {{{ core limit
       if (getrlimit(RLIMIT_CORE, &tResourceLimit) == 0)
@@ -365,7 +1549,7 @@ int main(int argc, char *argv[])
           ssMessage << gResourceLimitCoreHard;
         }
         ssMessage << ".";
-        gpCentral->log(ssMessage.str());
+        logMessage(ssMessage.str());
         if (gResourceLimitCoreSoft != RLIM_INFINITY && (gResourceLimitCoreHard == RLIM_INFINITY || gResourceLimitCoreSoft < gResourceLimitCoreHard))
         {
           if (gResourceLimitCoreHard == RLIM_INFINITY)
@@ -399,13 +1583,13 @@ int main(int argc, char *argv[])
               ssMessage << tResourceLimit.rlim_max;
             }
             ssMessage << ".";
-            gpCentral->log(ssMessage.str());
+            logMessage(ssMessage.str());
           }
           else
           {
             ssMessage.str("");
             ssMessage << strPrefix << "->setrlimit(" << errno << ") error [RLIMIT_CORE]:  " << strerror(errno);
-            gpCentral->notify(ssMessage.str());
+            logNotify(ssMessage.str());
           }
         }
       }
@@ -413,7 +1597,7 @@ int main(int argc, char *argv[])
       {
         ssMessage.str("");
         ssMessage << strPrefix << "->getrlimit(" << errno << ") error [RLIMIT_CORE]:  " << strerror(errno);
-        gpCentral->notify(ssMessage.str());
+        logNotify(ssMessage.str());
       }
       // }}}
       // {{{ file descriptor limit
@@ -441,7 +1625,7 @@ int main(int argc, char *argv[])
           ssMessage << gResourceLimitNoFileHard;
         }
         ssMessage << ".";
-        gpCentral->log(ssMessage.str());
+        logMessage(ssMessage.str());
         if (gResourceLimitNoFileSoft != RLIM_INFINITY && (gResourceLimitNoFileHard == RLIM_INFINITY || gResourceLimitNoFileSoft < gResourceLimitNoFileHard))
         {
           if (gResourceLimitNoFileHard == RLIM_INFINITY)
@@ -475,13 +1659,13 @@ int main(int argc, char *argv[])
               ssMessage << tResourceLimit.rlim_max;
             }
             ssMessage << ".";
-            gpCentral->log(ssMessage.str());
+            logMessage(ssMessage.str());
           }
           else
           {
             ssMessage.str("");
             ssMessage << strPrefix << "->setrlimit(" << errno << ") error [RLIMIT_FILE]:  " << strerror(errno);
-            gpCentral->notify(ssMessage.str());
+            logNotify(ssMessage.str());
           }
         }
       }
@@ -489,10 +1673,165 @@ int main(int argc, char *argv[])
       {
         ssMessage.str("");
         ssMessage << strPrefix << "->getrlimit(" << errno << ") error [RLIMIT_NOFILE]:  " << strerror(errno);
-        gpCentral->notify(ssMessage.str());
+        logNotify(ssMessage.str());
+      }
+      // }}}
+      // {{{ subreaper
+      if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) == 0)
+      {
+        logMessage(strPrefix + (string)"->prctl() [PR_SET_CHILD_SUBREAPER]:  Became the subreaper for service process trees.");
+      }
+      else
+      {
+        ssMessage.str("");
+        ssMessage << strPrefix << "->prctl(" << errno << ") error [PR_SET_CHILD_SUBREAPER]:  " << strerror(errno);
+        logNotify(ssMessage.str());
+      }
+      // }}}
+      // {{{ upgrade state
+      if (fdUpgrade != -1)
+      {
+        string strState;
+        lseek(fdUpgrade, 0, SEEK_SET);
+        while ((nReturn = read(fdUpgrade, szBuffer, 4096)) > 0)
+        {
+          strState.append(szBuffer, nReturn);
+        }
+        close(fdUpgrade);
+        gptUpgrade = new Json(strState);
+        if (gptUpgrade->m.find("Unix") != gptUpgrade->m.end() && !gptUpgrade->m["Unix"]->v.empty())
+        {
+          fdUnix = atoi(gptUpgrade->m["Unix"]->v.c_str());
+        }
+        if (gptUpgrade->m.find("Notify") != gptUpgrade->m.end() && !gptUpgrade->m["Notify"]->v.empty())
+        {
+          fdNotify = atoi(gptUpgrade->m["Notify"]->v.c_str());
+          fcntl(fdNotify, F_SETFD, FD_CLOEXEC);
+        }
+        if (gptUpgrade->m.find("JobId") != gptUpgrade->m.end() && !gptUpgrade->m["JobId"]->v.empty())
+        {
+          gunJobId = strtoul(gptUpgrade->m["JobId"]->v.c_str(), NULL, 10);
+        }
+        if (gptUpgrade->m.find("Watchers") != gptUpgrade->m.end())
+        {
+          for (list<Json *>::iterator i = gptUpgrade->m["Watchers"]->l.begin(); i != gptUpgrade->m["Watchers"]->l.end(); i++)
+          {
+            string strService = (((*i)->m.find("Service") != (*i)->m.end())?(*i)->m["Service"]->v:"");
+            if ((*i)->m.find("Code") != (*i)->m.end())
+            {
+              frameHeader tFrame;
+              memset(&tFrame, 0, sizeof(frameHeader));
+              tFrame.unId = strtoul((*i)->m["Id"]->v.c_str(), NULL, 10);
+              tFrame.usFunction = atoi((*i)->m["Code"]->v.c_str());
+              watchAdd(atoi((*i)->m["Socket"]->v.c_str()), strService, "", &tFrame);
+            }
+            else
+            {
+              watchAdd(atoi((*i)->m["Socket"]->v.c_str()), strService, (*i)->m["Prefix"]->v, NULL);
+            }
+          }
+        }
+        if (gptUpgrade->m.find("Sockets") != gptUpgrade->m.end())
+        {
+          for (map<string, Json *>::iterator i = gptUpgrade->m["Sockets"]->m.begin(); i != gptUpgrade->m["Sockets"]->m.end(); i++)
+          {
+            vector<string> buffers;
+            for (list<Json *>::iterator j = i->second->l.begin(); j != i->second->l.end(); j++)
+            {
+              buffers.push_back((*j)->v);
+            }
+            buffers.resize(3);
+            if (buffers[2] == "binary")
+            {
+              string strData;
+              buffers[0] = frameUnhex(buffers[0], strData);
+              buffers[1] = frameUnhex(buffers[1], strData);
+            }
+            sockets[atoi(i->first.c_str())] = buffers;
+            buffers.clear();
+          }
+        }
+        ssMessage.str("");
+        ssMessage << strPrefix << " [" << gstrBinary << "]:  Resumed from a live upgrade.";
+        logMessage(ssMessage.str());
+      }
+      // }}}
+      // {{{ notify socket
+      if (fdNotify != -1)
+      {
+        ssMessage.str("");
+        ssMessage << strPrefix << " [" << gstrData << NOTIFY << "," << fdNotify << "]:  Reusing notify socket.";
+        logMessage(ssMessage.str());
+      }
+      else if ((fdNotify = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) >= 0)
+      {
+        int nOn = 1;
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, (gstrData + NOTIFY).c_str(), sizeof(addr.sun_path) - 1);
+        remove((gstrData + NOTIFY).c_str());
+        if (setsockopt(fdNotify, SOL_SOCKET, SO_PASSCRED, &nOn, sizeof(nOn)) == 0 && bind(fdNotify, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0)
+        {
+          ssMessage.str("");
+          ssMessage << strPrefix << "->bind() [" << gstrData << NOTIFY << "," << fdNotify << "]:  Bound notify socket.";
+          logMessage(ssMessage.str());
+        }
+        else
+        {
+          ssMessage.str("");
+          ssMessage << strPrefix << "->bind(" << errno << ") error [" << gstrData << NOTIFY << "," << fdNotify << "]:  " << strerror(errno);
+          logNotify(ssMessage.str());
+          close(fdNotify);
+          fdNotify = -1;
+        }
+      }
+      else
+      {
+        ssMessage.str("");
+        ssMessage << strPrefix << "->socket(" << errno << ") error [" << gstrData << NOTIFY << "]:  " << strerror(errno);
+        logNotify(ssMessage.str());
+      }
+      // }}}
+      // {{{ metrics socket
+      if (!gstrMetrics.empty())
+      {
+        gstrMetricsBuffer.reserve(65536);
+        if (metricsListen(gstrMetrics, fdMetrics, strError))
+        {
+          ssMessage.str("");
+          ssMessage << strPrefix << "->metricsListen() [" << gstrMetrics << "," << fdMetrics << "]:  Listening for metrics scrapes.";
+          logMessage(ssMessage.str());
+        }
+        else
+        {
+          ssMessage.str("");
+          ssMessage << strPrefix << "->metricsListen() error:  " << strError;
+          logNotify(ssMessage.str());
+        }
       }
       // }}}
+      if (!journalOpen(strError))
+      {
+        ssMessage.str("");
+        ssMessage << strPrefix << "->journalOpen() error:  " << strError;
+        logNotify(ssMessage.str());
+      }
+      unStart = timeMonotonic();
       gpCentral->file()->directoryList(gstrData + "/enabled", files);
+      statsRecord("directoryList", "enabled", unStart);
+      // {{{ definitions
+      definitionOpen();
+      for (list<string>::iterator i = files.begin(); i != files.end(); i++)
+      {
+        if ((*i) != "." && (*i) != ".." && i->size() > 8 && i->substr((i->size() - 8), 8) == ".service")
+        {
+          services.push_back(i->substr(0, (i->size() - 8)));
+        }
+      }
+      definitionPrepare(services);
+      services.clear();
+      // }}}
       for (list<string>::iterator i = files.begin(); i != files.end(); i++)
       {
         if ((*i) != "." && (*i) != ".." && i->size() > 8 && i->substr((i->size() - 8), 8) == ".service")
@@ -502,38 +1841,71 @@ int main(int argc, char *argv[])
           {
             if (serviceEnable(i->substr(0, (i->size() - 8)), strError))
             {
-              if (!serviceStart(i->substr(0, (i->size() - 8)), strError))
+              if (gptUpgrade == NULL && gServiceHot[gServices[i->substr(0, (i->size() - 8))]->unId].nPid == -1 && gServices[i->substr(0, (i->size() - 8))]->listens.empty() && !serviceStart(i->substr(0, (i->size() - 8)), strError))
               {
                 ssMessage.str("");
                 ssMessage << strPrefix << "->serviceStart() error [" << i->substr(0, (i->size() - 8)) << "]:  " << strError;
-                gpCentral->notify(ssMessage.str());
+                logNotify(ssMessage.str());
               }
             }
             else
             {
               ssMessage.str("");
               ssMessage << strPrefix << "->serviceEnable() error [" << i->substr(0, (i->size() - 8)) << "]:  " << strError;
-              gpCentral->notify(ssMessage.str());
+              logNotify(ssMessage.str());
             }
           }
           else
           {
             ssMessage.str("");
             ssMessage << strPrefix << "->stat(" << errno << ") error [" << gstrData << "/enabled/" << (*i) << "]:  " << strerror(errno);
-            gpCentral->notify(ssMessage.str());
+            logNotify(ssMessage.str());
           }
         }
       }
       files.clear();
+      // definitions whose services failed to enable
+      while (!gDefinitions.empty())
+      {
+        delete gDefinitions.begin()->second;
+        gDefinitions.erase(gDefinitions.begin());
+      }
+      traceRecord(((gptUpgrade != NULL)?"upgrade":"boot"), "", unBoot);
+      journalRecord("", ((gptUpgrade != NULL)?"upgrade":"boot"), getpid(), -1, ((timeMonotonic() - unBoot) / 1000));
+      if (gptUpgrade != NULL)
+      {
+        delete gptUpgrade;
+        gptUpgrade = NULL;
+      }
       umask(strtol("0007", 0, 8));
       ssMessage.str("");
       ssMessage << strPrefix << "->umask() [0007]:  Set the umask.";
-      gpCentral->log(ssMessage.str());
+      logMessage(ssMessage.str());
       // }}}
       while (!gbShutdown && !bExit)
       {
         // {{{ prep
-        fds = new pollfd[sockets.size()+1];
+        // the dense per tick state avoids visiting every service struct
+        for (size_t i = 0; i < gServiceHot.size(); i++)
+        {
+          serviceHot &tHot = gServiceHot[i];
+          if (tHot.fdHealthCheck != -1)
+          {
+            probes[tHot.fdHealthCheck] = gServiceNames[i];
+          }
+          if (tHot.fdPid != -1)
+          {
+            pidfds.push_back(tHot.fdPid);
+          }
+          if (tHot.bListening && tHot.nPid == -1 && tHot.unCrashes == 0)
+          {
+            for (vector<int>::iterator j = tHot.ptService->listens.begin(); j != tHot.ptService->listens.end(); j++)
+            {
+              listens[*j] = gServiceNames[i];
+            }
+          }
+        }
+        fds = new pollfd[sockets.size()+probes.size()+listens.size()+pidfds.size()+scrapes.size()+3];
         unIndex = 0;
         time(&(CUnixSocketTime[1]));
         if ((CUnixSocketTime[1] - CUnixSocketTime[0]) >= 30)
@@ -545,21 +1917,21 @@ int main(int argc, char *argv[])
             {
               ssMessage.str("");
               ssMessage << strPrefix << "->remove(" << errno << ") error [" << UNIX_SOCKET << "]:  " << strerror(errno);
-              gpCentral->notify(ssMessage.str());
+              logNotify(ssMessage.str());
             }
             if (fdUnix != -1)
             {
               close(fdUnix);
               ssMessage.str("");
               ssMessage << strPrefix << "->close() [" << UNIX_SOCKET << "]:  Closed socket.";
-              gpCentral->log(ssMessage.str());
+              logMessage(ssMessage.str());
             }
             if ((fdUnix = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0)
             {
               sockaddr_un addr;
               ssMessage.str("");
               ssMessage << strPrefix << "->socket() [" << UNIX_SOCKET << "," << fdUnix << "]:  Created socket.";
-              gpCentral->log(ssMessage.str());
+              logMessage(ssMessage.str());
               memset(&addr, 0, sizeof(sockaddr_un));
               addr.sun_family = AF_UNIX;
               strncpy(addr.sun_path, UNIX_SOCKET, sizeof(addr.sun_path) - 1);
@@ -567,19 +1939,19 @@ int main(int argc, char *argv[])
               {
                 ssMessage.str("");
                 ssMessage << strPrefix << "->bind() [" << UNIX_SOCKET << "," << fdUnix << "]:  Bound socket.";
-                gpCentral->log(ssMessage.str());
+                logMessage(ssMessage.str());
                 if (listen(fdUnix, 5) == 0)
                 {
                   ssMessage.str("");
                   ssMessage << strPrefix << "->listen() [" << UNIX_SOCKET << "," << fdUnix << "]:  Listening to socket.";
-                  gpCentral->log(ssMessage.str());
+                  logMessage(ssMessage.str());
                 }
                 else
                 {
                   close(fdUnix);
                   ssMessage.str("");
                   ssMessage << strPrefix << "->listen(" << errno << ") error [" << UNIX_SOCKET << "," << fdUnix << "]:  " << strerror(errno);
-                  gpCentral->notify(ssMessage.str());
+                  logNotify(ssMessage.str());
                 }
               }
               else
@@ -587,20 +1959,39 @@ int main(int argc, char *argv[])
                 close(fdUnix);
                 ssMessage.str("");
                 ssMessage << strPrefix << "->bind(" << errno << ") error [" << UNIX_SOCKET << "," << fdUnix << "]:  " << strerror(errno);
-                gpCentral->notify(ssMessage.str());
+                logNotify(ssMessage.str());
               }
             }
             else
             {
               ssMessage.str("");
               ssMessage << strPrefix << "->socket(" << errno << ") error [" << UNIX_SOCKET << "]:  " << strerror(errno);
-              gpCentral->notify(ssMessage.str());
+              logNotify(ssMessage.str());
             }
           }
         }
         fds[unIndex].fd = fdUnix;
         fds[unIndex].events = POLLIN;
         unIndex++;
+        for (map<int, string>::iterator i = gWatchBuffers.begin(); i != gWatchBuffers.end(); i++)
+        {
+          if (sockets.find(i->first) != sockets.end())
+          {
+            // a watcher which stopped reading is dropped rather than buffered without bound
+            if (sockets[i->first][1].size() > WATCH_BUFFER)
+            {
+              removals.push_back(i->first);
+              ssMessage.str("");
+              ssMessage << strPrefix << " error [" << fdUnix << "," << i->first << "]:  Closed a watching connection which fell more than " << WATCH_BUFFER << " bytes behind.";
+              logMessage(ssMessage.str());
+            }
+            else
+            {
+              sockets[i->first][1].append(i->second);
+            }
+          }
+        }
+        gWatchBuffers.clear();
         for (map<int, vector<string> >::iterator i = sockets.begin(); i != sockets.end(); i++)
         {
           fds[unIndex].fd = i->first;
@@ -611,13 +2002,86 @@ int main(int argc, char *argv[])
           }
           unIndex++;
         }
+        for (map<int, string>::iterator i = probes.begin(); i != probes.end(); i++)
+        {
+          fds[unIndex].fd = i->first;
+          fds[unIndex].events = ((!gServices[i->second]->bHealthCheckConnected || !gServices[i->second]->strHealthCheckBuffer[1].empty())?POLLOUT:POLLIN);
+          unIndex++;
+        }
+        for (map<int, string>::iterator i = listens.begin(); i != listens.end(); i++)
+        {
+          fds[unIndex].fd = i->first;
+          fds[unIndex].events = POLLIN;
+          unIndex++;
+        }
+        if (fdNotify != -1)
+        {
+          fds[unIndex].fd = fdNotify;
+          fds[unIndex].events = POLLIN;
+          unIndex++;
+        }
+        for (list<int>::iterator i = pidfds.begin(); i != pidfds.end(); i++)
+        {
+          fds[unIndex].fd = *i;
+          fds[unIndex].events = POLLIN;
+          unIndex++;
+        }
+        if (fdMetrics != -1)
+        {
+          fds[unIndex].fd = fdMetrics;
+          fds[unIndex].events = POLLIN;
+          unIndex++;
+        }
+        for (map<int, scrape>::iterator i = scrapes.begin(); i != scrapes.end();)
+        {
+          // a scrape which has not finished in time is dropped so an idle client cannot hold its slot
+          if ((timeMonotonic() - i->second.unAccepted) >= ((size_t)SCRAPE_TIMEOUT * 1000000000))
+          {
+            close(i->first);
+            scrapes.erase(i++);
+          }
+          else
+          {
+            fds[unIndex].fd = i->first;
+            fds[unIndex].events = ((i->second.strBuffer[1].empty())?POLLIN:POLLOUT);
+            unIndex++;
+            i++;
+          }
+        }
         // }}}
-        if ((nReturn = poll(fds, unIndex, 250)) > 0)
+        if (unLoop != 0)
+        {
+          unLag = timeMonotonic() - unLoop;
+          if (unLag > unLagMax)
+          {
+            unLagMax = unLag;
+          }
+          statsValue("loop", (unLag / 1000));
+          if (gunStallThreshold > 0 && (unLag / 1000000) >= gunStallThreshold)
+          {
+            gunStalls++;
+            ssMessage.str("");
+            ssMessage << strPrefix << " [" << (unLag / 1000000) << " ms]:  Event loop iteration stalled";
+            if (!gstrStall.empty())
+            {
+              ssMessage << " in " << gstrStall << " for " << (gunStall / 1000000) << " ms";
+            }
+            ssMessage << ".";
+            logMessage(ssMessage.str());
+          }
+        }
+        gstrStall.clear();
+        gunStall = 0;
+        // running jobs are polled more often so stops finish promptly
+        nReturn = poll(fds, unIndex, ((gJobQueues.empty())?250:100));
+        unLoop = timeMonotonic();
+        if (nReturn > 0)
         {
           // {{{ accept
           if (fds[0].revents & POLLIN)
           {
             int fdClient;
+            unStart = timeMonotonic();
             sockaddr_un cli_addr;
             socklen_t clilen = sizeof(sockaddr_un);
             if ((fdClient = accept(fdUnix, (sockaddr *)&cli_addr, &clilen)) >= 0)
@@ -625,6 +2089,7 @@ int main(int argc, char *argv[])
               vector<string> buffers;
               buffers.push_back("");
               buffers.push_back("");
+              buffers.push_back("");
               sockets[fdClient] = buffers;
               buffers.clear();
             }
@@ -632,14 +2097,59 @@ int main(int argc, char *argv[])
             {
               ssMessage.str("");
               ssMessage << strPrefix << "->accept(" << errno << ") error [" << fdUnix << "]:  " << strerror(errno);
-              gpCentral->notify(ssMessage.str());
+              logNotify(ssMessage.str());
               close(fdUnix);
               ssMessage.str("");
               ssMessage << strPrefix << "->close() [" << UNIX_SOCKET << "," << fdUnix << "]:  Closed socket.";
-              gpCentral->log(ssMessage.str());
+              logMessage(ssMessage.str());
               fdUnix = -1;
             }
+            statsRecord("accept", "", unStart);
+          }
+          // }}}
+          // {{{ health checks
+          for (size_t i = 1; i < unIndex; i++)
+          {
+            if (fds[i].revents != 0 && probes.find(fds[i].fd) != probes.end())
+            {
+              unStart = timeMonotonic();
+              healthCheckPoll(probes[fds[i].fd], fds[i].revents);
+              statsRecord("healthCheckPoll", probes[fds[i].fd], unStart);
+            }
+          }
+          // }}}
+          // {{{ notify
+          for (size_t i = 1; i < unIndex; i++)
+          {
+            if (fds[i].fd == fdNotify && (fds[i].revents & POLLIN))
+            {
+              unStart = timeMonotonic();
+              if (!serviceNotify(fdNotify, strError))
+              {
+                ssMessage.str("");
+                ssMessage << strPrefix << "->serviceNotify() error [" << gstrData << NOTIFY << "," << fdNotify << "]:  " << strError;
+                logMessage(ssMessage.str());
+              }
+              statsRecord("serviceNotify", "", unStart);
+            }
+          }
+          strError.clear();
+          // }}}
+          // {{{ socket activation
+          for (size_t i = 1; i < unIndex; i++)
+          {
+            if ((fds[i].revents & POLLIN) && listens.find(fds[i].fd) != listens.end() && !serviceActive(listens[fds[i].fd], strError))
+            {
+              logMessage((string)"main() [" + listens[fds[i].fd] + (string)"]:  Activating service.");
+              if (!serviceStart(listens[fds[i].fd], strError))
+              {
+                ssMessage.str("");
+                ssMessage << strPrefix << "->serviceStart() error [" << listens[fds[i].fd] << "]:  " << strError;
+                logMessage(ssMessage.str());
+              }
+            }
           }
+          strError.clear();
           // }}}
           // {{{ clients
           for (size_t i = 1; i < unIndex; i++)
@@ -651,54 +2161,184 @@ int main(int argc, char *argv[])
               {
                 if ((nReturn = read(fds[i].fd, szBuffer, 4096)) > 0)
                 {
-                  sockets[fds[i].fd][0].append(szBuffer, nReturn);
-                  while ((unPosition = sockets[fds[i].fd][0].find("\n")) != string::npos)
+                  bool bClose = false;
+                  size_t unConsumed = 0;
+                  string &strInput = sockets[fds[i].fd][0], &strMode = sockets[fds[i].fd][2];
+                  frameHeader tFrame;
+                  request tRequest;
+                  strInput.append(szBuffer, nReturn);
+                  // {{{ negotiate
+                  if (strMode.empty())
+                  {
+                    if ((unsigned char)strInput[0] != FRAME_MAGIC)
+                    {
+                      strMode = "json";
+                    }
+                    else if (strInput.size() >= 2 && (unsigned char)strInput[1] == FRAME_VERSION)
+                    {
+                      strMode = "binary";
+                      strInput.erase(0, 2);
+                      sockets[fds[i].fd][1].push_back((char)FRAME_MAGIC);
+                      sockets[fds[i].fd][1].push_back((char)FRAME_VERSION);
+                    }
+                    else if (strInput.size() >= 2)
+                    {
+                      // the supported version is answered before closing so the client can fall back
+                      char szVersion[2] = {(char)FRAME_MAGIC, (char)FRAME_VERSION};
+                      if (write(fds[i].fd, szVersion, 2) != 2)
+                      {
+                        ssMessage.str("");
+                        ssMessage << strPrefix << "->write(" << errno << ") error [" << fdUnix << "," << fds[i].fd << "]:  " << strerror(errno);
+                        logMessage(ssMessage.str());
+                      }
+                      removals.push_back(fds[i].fd);
+                      ssMessage.str("");
+                      ssMessage << strPrefix << " error [" << fdUnix << "," << fds[i].fd << "]:  Closed a connection which requested frame version " << (unsigned int)(unsigned char)strInput[1] << " instead of " << FRAME_VERSION << ".";
+                      logMessage(ssMessage.str());
+                      strInput.clear();
+                    }
+                  }
+                  // }}}
+                  while ((strMode == "binary" && frameParse(strInput, unConsumed, tRequest, tFrame, bClose)) || (strMode == "json" && (unPosition = strInput.find('\n', unConsumed)) != string::npos))
                   {
                     bool bProcessed = false;
-                    Json *ptJson = new Json(sockets[fds[i].fd][0].substr(0, unPosition));
-                    sockets[fds[i].fd][0].erase(0, (unPosition + 1));
+                    size_t unRequest = timeMonotonic();
+                    list<watcher> *ptDeferred = NULL;
+                    Json *ptJson = NULL, *ptResponse = NULL;
                     strError.clear();
-                    if (ptJson->m.find("Function") != ptJson->m.end() && !ptJson->m["Function"]->v.empty())
+                    // {{{ parse
+                    // binary frames were already parsed by the loop condition
+                    if (strMode == "json")
+                    {
+                      if (!requestParse(&strInput[unConsumed], (unPosition - unConsumed), tRequest))
+                      {
+                        requestValue *fields[7] = {&tRequest.tAsync, &tRequest.tEnd, &tRequest.tFunction, &tRequest.tJob, &tRequest.tLimit, &tRequest.tService, &tRequest.tStart};
+                        const char *names[7] = {"Async", "End", "Function", "Job", "Limit", "Service", "Start"};
+                        ptJson = new Json(strInput.substr(unConsumed, (unPosition - unConsumed)));
+                        memset(&tRequest, 0, sizeof(request));
+                        for (size_t j = 0; j < 7; j++)
+                        {
+                          if (ptJson->m.find(names[j]) != ptJson->m.end())
+                          {
+                            fields[j]->pszData = ptJson->m[names[j]]->v.c_str();
+                            fields[j]->unSize = ptJson->m[names[j]]->v.size();
+                            fields[j]->bString = true;
+                          }
+                        }
+                      }
+                      unConsumed = unPosition + 1;
+                    }
+                    // }}}
+                    if (tRequest.tFunction.unSize > 0)
                     {
                       string strService;
-                      if (ptJson->m.find("Service") != ptJson->m.end() && !ptJson->m["Service"]->v.empty())
+                      if (tRequest.tService.unSize > 0)
+                      {
+                        strService.assign(tRequest.tService.pszData, tRequest.tService.unSize);
+                      }
+                      // {{{ disable, enable, reload, reload-or-restart, restart, start, stop
+                      if (requestIs(tRequest.tFunction, "disable") || requestIs(tRequest.tFunction, "enable") || requestIs(tRequest.tFunction, "reload") || requestIs(tRequest.tFunction, "reload-or-restart") || requestIs(tRequest.tFunction, "restart") || requestIs(tRequest.tFunction, "start") || requestIs(tRequest.tFunction, "stop"))
                       {
-                        strService = ptJson->m["Service"]->v;
+                        size_t unJob = jobAdd(string(tRequest.tFunction.pszData, tRequest.tFunction.unSize), strService);
+                        // lifecycle operations run as jobs so a slow stop never blocks the event loop
+                        if (requestIs(tRequest.tAsync, "1") || requestIs(tRequest.tAsync, "true") || requestIs(tRequest.tAsync, "yes"))
+                        {
+                          bProcessed = true;
+                          ptResponse = new Json;
+                          jobDescribe(gJobs[unJob], ptResponse);
+                        }
+                        else
+                        {
+                          ptDeferred = &(gJobs[unJob].replies);
+                        }
+                      }
+                      // }}}
+                      // {{{ daemon-reload
+                      else if (requestIs(tRequest.tFunction, "daemon-reload"))
+                      {
+                        map<string, string> changes;
+                        bProcessed = true;
+                        daemonReload(changes);
+                        ptResponse = new Json(changes);
+                        changes.clear();
+                      }
+                      // }}}
+                      // {{{ history
+                      else if (requestIs(tRequest.tFunction, "history"))
+                      {
+                        time_t CEnd, CStart = 0;
+                        time(&CEnd);
+                        CStart = requestNumber(tRequest.tStart, CStart);
+                        CEnd = requestNumber(tRequest.tEnd, CEnd);
+                        bProcessed = true;
+                        ptResponse = new Json;
+                        journalQuery(strService, CStart, CEnd, requestNumber(tRequest.tLimit, 1000), ptResponse);
                       }
-                      // {{{ disable
-                      if (ptJson->m["Function"]->v == "disable")
+                      // }}}
+                      // {{{ job-cancel
+                      else if (requestIs(tRequest.tFunction, "job-cancel"))
+                      {
+                        bProcessed = jobCancel(requestNumber(tRequest.tJob, 0), strError);
+                      }
+                      // }}}
+                      // {{{ job-wait
+                      else if (requestIs(tRequest.tFunction, "job-wait"))
                       {
-                        bProcessed = serviceDisable(strService, strError);
+                        size_t unJob = requestNumber(tRequest.tJob, 0);
+                        if (gJobs.find(unJob) == gJobs.end())
+                        {
+                          strError = "Failed to find the job.";
+                        }
+                        else if (gJobs[unJob].CFinished == 0)
+                        {
+                          ptDeferred = &(gJobs[unJob].waiters);
+                        }
+                        else
+                        {
+                          bProcessed = true;
+                          ptResponse = new Json;
+                          jobDescribe(gJobs[unJob], ptResponse);
+                        }
                       }
                       // }}}
-                      // {{{ enable
-                      else if (ptJson->m["Function"]->v == "enable")
+                      // {{{ jobs
+                      else if (requestIs(tRequest.tFunction, "jobs"))
                       {
-                        bProcessed = serviceEnable(strService, strError);
+                        bProcessed = true;
+                        ptResponse = new Json;
+                        for (map<size_t, job>::iterator j = gJobs.begin(); j != gJobs.end(); j++)
+                        {
+                          if (strService.empty() || j->second.strService == strService)
+                          {
+                            Json *ptJob = new Json;
+                            jobDescribe(j->second, ptJob);
+                            ptResponse->l.push_back(ptJob);
+                          }
+                        }
                       }
                       // }}}
                       // {{{ list
-                      else if (ptJson->m["Function"]->v == "list")
+                      else if (requestIs(tRequest.tFunction, "list"))
                       {
                         if (!strService.empty())
                         {
                           if (gServices.find(strService) != gServices.end())
                           {
                             bProcessed = true;
-                            ptJson->m["Response"] = new Json;
-                            ptJson->m["Response"]->v = ((gServices[strService]->nPid != -1)?"active":"enabled");
+                            ptResponse = new Json;
+                            ptResponse->v = serviceState(strService);
                           }
                           else if (gpCentral->file()->fileExist(gstrData + (string)"/enabled/" + strService + (string)".service"))
                           {
                             bProcessed = true;
-                            ptJson->m["Response"] = new Json;
-                            ptJson->m["Response"]->v = "enabled";
+                            ptResponse = new Json;
+                            ptResponse->v = "enabled";
                           }
                           else if (gpCentral->file()->fileExist(gstrData + (string)"/services/" + strService + (string)".service"))
                           {
                             bProcessed = true;
-                            ptJson->m["Response"] = new Json;
-                            ptJson->m["Response"]->v = "disabled";
+                            ptResponse = new Json;
+                            ptResponse->v = "disabled";
                           }
                           else
                           {
@@ -709,7 +2349,9 @@ int main(int argc, char *argv[])
                         {
                           map<string, string> services;
                           bProcessed = true;
+                          unStart = timeMonotonic();
                           gpCentral->file()->directoryList(gstrData + "/services", files);
+                          statsRecord("directoryList", "services", unStart);
                           for (list<string>::iterator j = files.begin(); j != files.end(); j++)
                           {
                             if ((*j) != "." && (*j) != ".." && j->size() > 8 && j->substr((j->size() - 8), 8) == ".service")
@@ -722,7 +2364,9 @@ int main(int argc, char *argv[])
                             }
                           }
                           files.clear();
+                          unStart = timeMonotonic();
                           gpCentral->file()->directoryList(gstrData + "/enabled", files);
+                          statsRecord("directoryList", "enabled", unStart);
                           for (list<string>::iterator j = files.begin(); j != files.end(); j++)
                           {
                             if ((*j) != "." && (*j) != ".." && j->size() > 8 && j->substr((j->size() - 8), 8) == ".service")
@@ -734,43 +2378,89 @@ int main(int argc, char *argv[])
                               }
                             }
                           }
-                          for (map<string, service *>::iterator j = gServices.begin(); j != gServices.end(); j++)
+                          for (unordered_map<string, service *>::iterator j = gServices.begin(); j != gServices.end(); j++)
                           {
-                            services[j->first] = ((j->second->nPid != -1)?"active":"enabled");
+                            services[j->first] = serviceState(j->first);
                           }
-                          ptJson->m["Response"] = new Json(services);
+                          ptResponse = new Json(services);
                           services.clear();
                         }
                       }
                       // }}}
-                      // {{{ reload
-                      else if (ptJson->m["Function"]->v == "reload")
+                      // {{{ ping
+                      else if (requestIs(tRequest.tFunction, "ping"))
+                      {
+                        map<string, string> ping;
+                        bProcessed = true;
+                        ssMessage.str("");
+                        ssMessage << (unLag / 1000000) << " ms";
+                        ping["Lag"] = ssMessage.str();
+                        ssMessage.str("");
+                        ssMessage << (unLagMax / 1000000) << " ms";
+                        ping["LagMax"] = ssMessage.str();
+                        ssMessage.str("");
+                        ssMessage << getpid();
+                        ping["Pid"] = ssMessage.str();
+                        ptResponse = new Json(ping);
+                        ping.clear();
+                        unLagMax = 0;
+                      }
+                      // }}}
+                      // {{{ stats
+                      else if (requestIs(tRequest.tFunction, "stats"))
+                      {
+                        map<string, string> stats;
+                        bProcessed = true;
+                        statsSummary(stats);
+                        ptResponse = new Json(stats);
+                        stats.clear();
+                      }
+                      // }}}
+                      // {{{ status
+                      else if (requestIs(tRequest.tFunction, "status"))
                       {
-                        bProcessed = serviceReload(strService, strError);
+                        map<string, string> status;
+                        if (serviceStatus(strService, status, strError))
+                        {
+                          bProcessed = true;
+                          ptResponse = new Json(status);
+                        }
+                        status.clear();
                       }
                       // }}}
-                      // {{{ restart
-                      else if (ptJson->m["Function"]->v == "restart")
+                      // {{{ trace
+                      else if (requestIs(tRequest.tFunction, "trace"))
                       {
-                        bProcessed = serviceRestart(strService, strError);
+                        bProcessed = true;
+                        ptResponse = new Json;
+                        traceExport(ptResponse);
                       }
                       // }}}
-                      // {{{ start
-                      else if (ptJson->m["Function"]->v == "start")
+                      // {{{ upgrade
+                      else if (requestIs(tRequest.tFunction, "upgrade"))
                       {
-                        bProcessed = serviceStart(strService, strError);
+                        if (!gstrBinary.empty() && access(gstrBinary.c_str(), X_OK) == 0)
+                        {
+                          bProcessed = bUpgrade = true;
+                        }
+                        else
+                        {
+                          strError = (string)"Failed to find an executable binary at " + gstrBinary + (string)".";
+                        }
                       }
                       // }}}
-                      // {{{ stop
-                      else if (ptJson->m["Function"]->v == "stop")
+                      // {{{ watch
+                      else if (requestIs(tRequest.tFunction, "watch"))
                       {
-                        bProcessed = serviceStop(strService, strError);
+                        watcher tWatcher;
+                        bProcessed = true;
+                        gWatchers.push_back(requestWatcher(fds[i].fd, tRequest, ptJson, ((strMode == "binary")?&tFrame:NULL), tWatcher));
                       }
                       // }}}
                       // {{{ invalid 
                       else
                       {
-                        strError = "Please a valid Function:  disable, enable, list, reload, restart, start, stop.";
+                        strError = "Please a valid Function:  daemon-reload, disable, enable, history, job-cancel, job-wait, jobs, list, ping, reload, reload-or-restart, restart, start, stats, status, stop, trace, upgrade, watch.";
                       }
                       // }}}
                     }
@@ -778,13 +2468,61 @@ int main(int argc, char *argv[])
                     {
                       strError = "Please provide the Function.";
                     }
-                    ptJson->insert("Status", ((bProcessed)?"okay":"error"));
-                    if (!strError.empty())
+                    // {{{ reply
+                    statsRecord("request", string(((tRequest.tFunction.pszData != NULL)?tRequest.tFunction.pszData:""), tRequest.tFunction.unSize), unRequest);
+                    if (ptDeferred != NULL)
+                    {
+                      // the reply is queued once the job finishes
+                      watcher tWatcher;
+                      ptDeferred->push_back(requestWatcher(fds[i].fd, tRequest, ptJson, ((strMode == "binary")?&tFrame:NULL), tWatcher));
+                      if (ptJson != NULL)
+                      {
+                        delete ptJson;
+                      }
+                    }
+                    else if (strMode == "binary")
+                    {
+                      frameReply(tFrame, bProcessed, strError, ptResponse, sockets[fds[i].fd][1]);
+                      if (ptResponse != NULL)
+                      {
+                        delete ptResponse;
+                      }
+                    }
+                    else if (ptJson == NULL)
+                    {
+                      requestReply(tRequest, bProcessed, strError, ptResponse, sockets[fds[i].fd][1]);
+                      if (ptResponse != NULL)
+                      {
+                        delete ptResponse;
+                      }
+                    }
+                    else
                     {
-                      ptJson->insert("Error", strError);
+                      if (ptResponse != NULL)
+                      {
+                        if (ptJson->m.find("Response") != ptJson->m.end())
+                        {
+                          delete ptJson->m["Response"];
+                        }
+                        ptJson->m["Response"] = ptResponse;
+                      }
+                      ptJson->insert("Status", ((bProcessed)?"okay":"error"));
+                      if (!strError.empty())
+                      {
+                        ptJson->insert("Error", strError);
+                      }
+                      sockets[fds[i].fd][1].append(ptJson->json(strJson)+"\n");
+                      delete ptJson;
                     }
-                    sockets[fds[i].fd][1].append(ptJson->json(strJson)+"\n");
-                    delete ptJson;
+                    // }}}
+                  }
+                  strInput.erase(0, unConsumed);
+                  if (bClose)
+                  {
+                    removals.push_back(fds[i].fd);
+                    ssMessage.str("");
+                    ssMessage << strPrefix << " error [" << fdUnix << "," << fds[i].fd << "]:  Closed a connection which sent a frame larger than " << FRAME_MAX << " bytes.";
+                    logMessage(ssMessage.str());
                   }
                 }
                 else
@@ -794,7 +2532,7 @@ int main(int argc, char *argv[])
                   {
                     ssMessage.str("");
                     ssMessage << strPrefix << "->read(" << errno << ") error [" << fdUnix << "," << fds[i].fd << "]:  " << strerror(errno);
-                    gpCentral->log(ssMessage.str());
+                    logMessage(ssMessage.str());
                   }
                 }
               }
@@ -813,7 +2551,7 @@ int main(int argc, char *argv[])
                   {
                     ssMessage.str("");
                     ssMessage << strPrefix << "->write(" << errno << ") error [" << fdUnix << "," << fds[i].fd << "]:  " << strerror(errno);
-                    gpCentral->log(ssMessage.str());
+                    logMessage(ssMessage.str());
                   }
                 }
               }
@@ -821,139 +2559,136 @@ int main(int argc, char *argv[])
             }
           }
           // }}}
-        }
-        else if (nReturn < 0 && errno != EINTR)
-        {
-          bExit = true;
-          ssMessage.str("");
-          ssMessage << strPrefix << "->poll(" << errno << ") error:  " << strerror(errno);
-          gpCentral->notify(ssMessage.str());
-        }
-        delete[] fds;
-        while (!removals.empty())
-        {
-          if (sockets.find(removals.front()) != sockets.end())
-          {
-            sockets[removals.front()].clear();
-            sockets.erase(removals.front());
-            close(removals.front());
-          }
-          removals.pop_front();
-        }
-        for (map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
-        {
-          if (i->second->nPid != -1)
+          // {{{ metrics
+          for (size_t i = 1; i < unIndex; i++)
           {
-            stringstream ssProc;
-            ssProc << "/proc/" << i->second->nPid;
-            if (!i->second->bStopped && !gpCentral->file()->directoryExist(ssProc.str().c_str()))
+            if (fds[i].fd == fdMetrics && (fds[i].revents & POLLIN))
             {
-              bool bCrashed = true;
-              if (!i->second->strPidFile.empty() && !i->second->bDetached)
+              int fdScrape;
+              if ((fdScrape = accept4(fdMetrics, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
               {
-                time_t CTime[2];
-                ifstream inPid;
-                pid_t nPid = 0;
-                gpCentral->log((string)"main() [" + i->first + (string)"]:  Service detached.");
-                time(&(CTime[0]));
-                usleep(250000);
-                time(&(CTime[1]));
-                while (nPid == 0 && (CTime[1] - CTime[0]) < 5)
+                if (scrapes.size() < SCRAPE_MAX)
                 {
-                  inPid.open(i->second->strPidFile.c_str());
-                  if (inPid)
-                  {
-                    inPid >> nPid;
-                  }
-                  inPid.close();
-                  usleep(100000);
-                  time(&(CTime[1]));
+                  scrapes[fdScrape].unAccepted = timeMonotonic();
+                }
+                else
+                {
+                  close(fdScrape);
                 }
-                if (nPid != 0)
+              }
+            }
+            else if (fds[i].revents != 0 && scrapes.find(fds[i].fd) != scrapes.end())
+            {
+              bool bClose = false;
+              string *buffers = scrapes[fds[i].fd].strBuffer;
+              if (fds[i].revents & POLLIN)
+              {
+                if ((nReturn = read(fds[i].fd, szBuffer, 4096)) > 0)
                 {
-                  ofstream outPid;
-                  i->second->bDetached = true;
-                  i->second->nPid = nPid;
-                  outPid.open((gstrData + (string)"/active/" + i->first + (string)".pid").c_str());
-                  if (outPid)
+                  buffers[0].append(szBuffer, nReturn);
+                  if (buffers[0].find("\r\n\r\n") != string::npos || buffers[0].find("\n\n") != string::npos)
                   {
-                    bCrashed = false;
-                    outPid << nPid << endl;
+                    unStart = timeMonotonic();
+                    metricsRender(unLag);
+                    ssMessage.str("");
+                    ssMessage << "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << gstrMetricsBuffer.size() << "\r\nConnection: close\r\n\r\n";
+                    buffers[1] = ssMessage.str() + gstrMetricsBuffer;
+                    statsRecord("metricsRender", "", unStart);
                   }
-                  else
+                  else if (buffers[0].size() > 65536)
                   {
-                    ssMessage.str("");
-                    ssMessage << "main()->ifstream::open(" << errno << ") error [" << i->first << "," << gstrData << "/active/" << i->first << ".pid]:  " << strerror(errno);
-                    gpCentral->log(ssMessage.str());
+                    bClose = true;
                   }
-                  outPid.close();
                 }
                 else
                 {
-                  ssMessage.str("");
-                  ssMessage << "main()->ifstream::open(" << errno << ") error [" << i->first << (string)"," + i->second->strPidFile << "]:  " << strerror(errno);
-                  gpCentral->log(ssMessage.str());
+                  bClose = true;
                 }
               }
-              if (bCrashed)
+              else if (fds[i].revents & POLLOUT)
               {
-                gpCentral->log((string)"main() [" + i->first + (string)"]:  Service crashed.");
-                if (serviceStop(i->first, strError))
+                if ((nReturn = write(fds[i].fd, buffers[1].c_str(), buffers[1].size())) > 0)
                 {
-                  if (i->second->strRestart == "always")
+                  buffers[1].erase(0, nReturn);
+                  if (buffers[1].empty())
                   {
-                    time_t CTime;
-                    time(&CTime);
-                    if ((CTime - i->second->CStart) < 60)
-                    {
-                      i->second->unCrashes++;
-                    }
-                    else
-                    {
-                      i->second->unCrashes = 0;
-                    }
-                    if (i->second->unCrashes <= 1)
-                    {
-                      if (!serviceStart(i->first, strError))
-                      {
-                        gpCentral->log((string)"main()->serviceStart() error [" + i->first + (string)"]:  " + strError);
-                      }
-                    }
+                    bClose = true;
                   }
                 }
-                else
+                else if (nReturn < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
                 {
-                  gpCentral->log((string)"main()->serviceStop() error [" + i->first + (string)"]:  " + strError);
+                  bClose = true;
                 }
               }
-            }
-          }
-          if (i->second->unCrashes > 0)
-          {
-            if (i->second->strRestart == "always")
-            {
-              if (i->second->unCrashes >= 10)
+              else
               {
-                i->second->unCrashes = 0;
-                gpCentral->log((string)"main() [" + i->first + (string)"]:  Leaving service stopped due to too many crashes");
+                bClose = true;
               }
-              else
+              if (bClose)
               {
-                time_t CTime;
-                time(&CTime);
-                if ((CTime - i->second->CStart) >= 60)
-                {
-                  if (!serviceStart(i->first, strError))
-                  {
-                    gpCentral->log((string)"main()->serviceStart() error [" + i->first + (string)"]:  " + strError);
-                  }
-                }
+                close(fds[i].fd);
+                scrapes.erase(fds[i].fd);
               }
             }
-            else
-            {
-              i->second->unCrashes = 0;
-            }
+          }
+          // }}}
+        }
+        else if (nReturn < 0 && errno != EINTR)
+        {
+          bExit = true;
+          ssMessage.str("");
+          ssMessage << strPrefix << "->poll(" << errno << ") error:  " << strerror(errno);
+          logNotify(ssMessage.str());
+        }
+        delete[] fds;
+        listens.clear();
+        pidfds.clear();
+        probes.clear();
+        while (!removals.empty())
+        {
+          if (sockets.find(removals.front()) != sockets.end())
+          {
+            sockets[removals.front()].clear();
+            sockets.erase(removals.front());
+            close(removals.front());
+            watchRemove(removals.front());
+            jobRemove(removals.front());
+          }
+          removals.pop_front();
+        }
+        unStart = timeMonotonic();
+        processReap();
+        statsRecord("processReap", "", unStart);
+        unStart = timeMonotonic();
+        serviceScan();
+        statsRecord("serviceScan", "", unStart);
+        if (!gJobQueues.empty())
+        {
+          unStart = timeMonotonic();
+          jobProcess();
+          statsRecord("jobProcess", "", unStart);
+        }
+        if (gbDefinitionsDirty)
+        {
+          definitionSave();
+        }
+        signalDispatch();
+        if (gbReload)
+        {
+          map<string, string> changes;
+          gbReload = false;
+          daemonReload(changes);
+          changes.clear();
+        }
+        // an upgrade waits for the running jobs and their queued replies so no reply is lost and for the hang diagnostics so no capture is cut short
+        if (bUpgrade && gJobQueues.empty() && gWatchBuffers.empty() && gunDiagnosing == 0)
+        {
+          bUpgrade = false;
+          if (!upgrade(argc, argv, fdUnix, fdNotify, sockets, strError))
+          {
+            ssMessage.str("");
+            ssMessage << strPrefix << "->upgrade() error [" << gstrBinary << "]:  " << strError;
+            logNotify(ssMessage.str());
           }
         }
       }
@@ -963,16 +2698,34 @@ int main(int argc, char *argv[])
         sockets.begin()->second.clear();
         sockets.erase(sockets.begin()->first);
       }
+      if (fdNotify != -1)
+      {
+        close(fdNotify);
+        remove((gstrData + NOTIFY).c_str());
+      }
+      while (!scrapes.empty())
+      {
+        close(scrapes.begin()->first);
+        scrapes.erase(scrapes.begin());
+      }
+      if (fdMetrics != -1)
+      {
+        close(fdMetrics);
+        if (gstrMetrics[0] == '/')
+        {
+          remove(gstrMetrics.c_str());
+        }
+      }
       if (fdUnix != -1)
       {
         close(fdUnix);
         ssMessage.str("");
         ssMessage << strPrefix << "->close() [" << UNIX_SOCKET << "," << fdUnix << "]:  Closed socket.";
-        gpCentral->log(ssMessage.str());
+        logMessage(ssMessage.str());
         remove(UNIX_SOCKET);
         ssMessage.str("");
         ssMessage << strPrefix << "->remove() [" << UNIX_SOCKET << "]:  Removed socket.";
-        gpCentral->log(ssMessage.str());
+        logMessage(ssMessage.str());
       }
       while (!gServices.empty())
       {
@@ -980,8 +2733,10 @@ int main(int argc, char *argv[])
         {
           ssMessage.str("");
           ssMessage << strPrefix << "->serviceRemove() error [" << gServices.begin()->first << "]:  " << strError;
-          gpCentral->log(ssMessage.str());
+          logMessage(ssMessage.str());
+          serviceUnlisten(gServices.begin()->first);
           gServices.begin()->second->environment.clear();
+          serviceRelease(gServices.begin()->second);
           delete gServices.begin()->second;
           gServices.erase(gServices.begin());
         }
@@ -992,6 +2747,14 @@ int main(int argc, char *argv[])
         remove((gstrData + PID).c_str());
       }
       // }}}
+      while (gunDiagnosing > 0)
+      {
+        usleep(100000);
+      }
+      journalClose();
+      definitionClose();
+      coreStop();
+      logStop();
     }
     // }}}
     // {{{ usage statement
@@ -1010,218 +2773,4494 @@ int main(int argc, char *argv[])
   return 0;
 }
 // }}}
-// {{{ service
-// {{{ serviceActive()
-bool serviceActive(const string strService, string &strError)
+// {{{ core
+// {{{ coreBacktrace()
+bool coreBacktrace(const string strBinary, const string strCore, string &strBacktrace)
 {
-  bool bResult = false;
+  int fdOutput[2];
 
-  if (serviceExist(strService, strError) && gServices[strService]->nPid != -1)
+  strBacktrace.clear();
+  if (pipe2(fdOutput, O_CLOEXEC) == 0)
   {
-    bResult = true;
+    pid_t nChild;
+    // the child is registered before it can exit so processReap() leaves it to the waitpid() below
+    gWorkerMutex.lock();
+    if ((nChild = fork()) == 0)
+    {
+      int fdNull = open("/dev/null", O_RDWR | O_CLOEXEC);
+      dup2(fdNull, 0);
+      dup2(fdOutput[1], 1);
+      dup2(fdNull, 2);
+      execlp("gdb", "gdb", "-batch", "-nx", "-ex", "bt 20", strBinary.c_str(), strCore.c_str(), (char *)NULL);
+      _exit(127);
+    }
+    else if (nChild > 0)
+    {
+      gWorkerPids.push_back(nChild);
+    }
+    gWorkerMutex.unlock();
+    close(fdOutput[1]);
+    if (nChild > 0)
+    {
+      char szLine[1024];
+      FILE *pfProcess;
+      if ((pfProcess = fdopen(fdOutput[0], "r")) != NULL)
+      {
+        while (fgets(szLine, sizeof(szLine), pfProcess) != NULL)
+        {
+          if (szLine[0] == '#')
+          {
+            strBacktrace += szLine;
+          }
+        }
+        fclose(pfProcess);
+      }
+      else
+      {
+        close(fdOutput[0]);
+      }
+      while (waitpid(nChild, NULL, 0) < 0 && errno == EINTR);
+      gWorkerMutex.lock();
+      gWorkerPids.remove(nChild);
+      gWorkerMutex.unlock();
+    }
+    else
+    {
+      close(fdOutput[0]);
+    }
   }
 
-  return bResult;
+  return !strBacktrace.empty();
 }
 // }}}
-// {{{ serviceAdd()
-bool serviceAdd(const string strService, string &strError)
+// {{{ coreCompress()
+bool coreCompress(const string strCore, string &strError)
 {
   bool bResult = false;
+  int fdCore;
+  string strTarget = strCore + ".gz";
+  stringstream ssError;
 
-  if (serviceExist(strService, strError))
-  {
-    bResult = true;
-  }
-  else
+  if ((fdCore = open(strCore.c_str(), O_RDONLY | O_CLOEXEC)) != -1)
   {
-    ifstream inService((gstrData + (string)"/services/" + strService + (string)".service").c_str());
-    string strLine;
-    stringstream ssJson;
-    Json *ptJson;
-    while (getline(inService, strLine))
-    {
-      ssJson << strLine;
-    }
-    inService.close();
-    ptJson = new Json(ssJson.str());
-    if (ptJson->m.find("ExecStart") != ptJson->m.end() && !ptJson->m["ExecStart"]->v.empty())
+    gzFile pgzTarget;
+    if ((pgzTarget = gzopen(strTarget.c_str(), "wb3")) != NULL)
     {
-      service *ptService = new service;
-      bResult = true;
-      ptService->bDetached = false;
-      ptService->bStopped = false;
-      ptService->CStart = 0;
-      ptService->nPid = -1;
-      ptService->unCrashes = 0;
-      ptService->strExecStart = ptJson->m["ExecStart"]->v;
-      if (ptJson->m.find("ExecStartPost") != ptJson->m.end() && !ptJson->m["ExecStartPost"]->v.empty())
-      {
-        ptService->strExecStartPost = ptJson->m["ExecStartPost"]->v;
-      }
-      if (ptJson->m.find("ExecStartPre") != ptJson->m.end() && !ptJson->m["ExecStartPre"]->v.empty())
-      {
-        ptService->strExecStartPre = ptJson->m["ExecStartPre"]->v;
-      }
-      if (ptJson->m.find("ExecStopPost") != ptJson->m.end() && !ptJson->m["ExecStopPost"]->v.empty())
-      {
-        ptService->strExecStopPost = ptJson->m["ExecStopPost"]->v;
-      }
-      if (ptJson->m.find("Environment") != ptJson->m.end() && !ptJson->m["Environment"]->l.empty())
+      bool bDone = false;
+      char *pszBuffer = new char[1048576];
+      // work in bounded chunks so a stop request is noticed between them
+      while (!bDone && !gbCoreStop)
       {
-        for (list<Json *>::iterator i = ptJson->m["Environment"]->l.begin(); i != ptJson->m["Environment"]->l.end(); i++)
+        ssize_t nSize;
+        if ((nSize = read(fdCore, pszBuffer, 1048576)) > 0)
         {
-          if (!(*i)->v.empty())
+          if (gzwrite(pgzTarget, pszBuffer, nSize) != nSize)
           {
-            ptService->environment.push_back((*i)->v);
+            bDone = true;
+            ssError << "gzwrite() Failed to write the compressed core dump.";
+          }
+        }
+        else
+        {
+          bDone = true;
+          if (nSize == 0)
+          {
+            bResult = true;
+          }
+          else
+          {
+            ssError << "read(" << errno << ") " << strerror(errno);
           }
         }
       }
-      ptService->strLimitCore = "0";
-      if (ptJson->m.find("LimitCORE") != ptJson->m.end() && !ptJson->m["LimitCORE"]->v.empty())
-      {
-        ptService->strLimitCore = ptJson->m["LimitCORE"]->v;
-      }
-      ptService->strLimitNoFile = "1024";
-      if (ptJson->m.find("LimitNOFILE") != ptJson->m.end() && !ptJson->m["LimitNOFILE"]->v.empty())
+      delete[] pszBuffer;
+      if (gzclose(pgzTarget) != Z_OK && bResult)
       {
-        ptService->strLimitNoFile = ptJson->m["LimitNOFILE"]->v;
+        bResult = false;
+        ssError << "gzclose() Failed to finish the compressed core dump.";
       }
-      if (ptJson->m.find("PIDFile") != ptJson->m.end() && !ptJson->m["PIDFile"]->v.empty())
+      if (bResult)
       {
-        ptService->strPidFile = ptJson->m["PIDFile"]->v;
+        unlink(strCore.c_str());
       }
-      ptService->strRestart = "always";
-      if (ptJson->m.find("Restart") != ptJson->m.end() && !ptJson->m["Restart"]->v.empty())
+      else
       {
-        ptService->strRestart = ptJson->m["Restart"]->v;
+        if (gbCoreStop)
+        {
+          ssError << "Interrupted by a stop request.";
+        }
+        unlink(strTarget.c_str());
       }
-      gServices[strService] = ptService;
     }
     else
     {
-      strError = "Please provide the Command within the Service configuration.";
+      ssError << "gzopen() Failed to open [" << strTarget << "].";
     }
-    delete ptJson;
-    strError.clear();
+    close(fdCore);
   }
-
-  return bResult;
-}
-// }}}
-// {{{ serviceDisable()
-bool serviceDisable(const string strService, string &strError)
-{
-  bool bResult = false;
-
-  if (serviceRemove(strService, strError) && serviceUnlink(strService, strError))
+  else
   {
-    bResult = true;
-    gpCentral->log((string)"serviceDisable() [" + strService + (string)"]:  Disabled service.");
+    ssError << "open(" << errno << ") " << strerror(errno);
   }
-
-  return bResult;
-}
-// }}}
-// {{{ serviceEnable()
-bool serviceEnable(const string strService, string &strError)
-{
-  bool bResult = false;
-
-  if (serviceLink(strService, strError) && serviceAdd(strService, strError))
+  if (!bResult)
   {
-    bResult = true;
-    gpCentral->log((string)"serviceEnable() [" + strService + (string)"]:  Enabled service.");
+    strError = ssError.str();
   }
 
   return bResult;
 }
 // }}}
-// {{{ serviceExist()
-bool serviceExist(const string strService, string &strError)
+// {{{ coreManager()
+void coreManager()
 {
-  bool bResult = false;
+  char szBuffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+  int fdNotify;
+  map<string, time_t> pending;
+  string strCores = gstrData + "/cores", strError;
+  stringstream ssMessage;
 
-  if (serviceValid(strService, strError))
+  threadSignals();
+  // the work must not compete with the services
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+  syscall(SYS_ioprio_set, 1, syscall(SYS_gettid), (3 << 13));
+  if ((fdNotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) != -1 && inotify_add_watch(fdNotify, strCores.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) != -1)
   {
-    if (gServices.find(strService) != gServices.end())
-    {
-      bResult = true;
-    }
-    else
+    DIR *pDir;
+    list<string> leftovers;
+    time_t CNow;
+    // {{{ leftovers
+    time(&CNow);
+    if ((pDir = opendir(strCores.c_str())) != NULL)
     {
-      strError = "Please provide a valid Service.";
+      dirent *ptEntry;
+      while ((ptEntry = readdir(pDir)) != NULL)
+      {
+        string strName = ptEntry->d_name;
+        if (strName == "core" || (strName.size() > 5 && strName.substr(0, 5) == "core."))
+        {
+          pending[strName] = CNow;
+        }
+        else if (strName.size() > 5 && strName.substr(strName.size() - 5, 5) == ".core")
+        {
+          leftovers.push_back(strName);
+        }
+      }
+      closedir(pDir);
     }
-  }
-
-  return bResult;
-}
-// }}}
-// {{{ serviceLink()
-bool serviceLink(const string strService, string &strError)
-{
-  bool bResult = false;
-  stringstream ssMessage;
-
-  if (serviceValid(strService, strError))
-  {
-    struct stat tStat;
-    if (stat((gstrData + (string)"/services/" + strService + (string)".service").c_str(), &tStat) == 0)
+    for (list<string>::iterator i = leftovers.begin(); !gbCoreStop && i != leftovers.end(); i++)
     {
-      if (stat((gstrData + (string)"/enabled/" + strService + (string)".service").c_str(), &tStat) == 0 || symlink((gstrData + (string)"/services/" + strService + (string)".service").c_str(), (gstrData + (string)"/enabled/" + strService + (string)".service").c_str()) == 0)
+      if (coreCompress(strCores + "/" + (*i), strError))
       {
-        bResult = true;
+        gunCoresCompressed++;
       }
-      else
+      else if (!gbCoreStop)
       {
         ssMessage.str("");
-        ssMessage << "symlink(" << errno << ") " << strerror(errno);
-        strError = ssMessage.str();
+        ssMessage << "coreManager()->coreCompress() error [" << (*i) << "]:  " << strError;
+        logMessage(ssMessage.str());
       }
     }
-    else
-    {
-      strError = "Please provide a valid Service.";
-    }
-  }
-
-  return bResult;
-}
-// }}}
-// {{{ serviceReload()
-bool serviceReload(const string strService, string &strError)
-{
-  bool bResult = false;
-  stringstream ssMessage;
-
-  if (serviceActive(strService, strError))
-  {
-    gpCentral->log((string)"serviceReload() [" + strService + (string)"]:  Reloading service.");
-    if (kill(gServices[strService]->nPid, SIGHUP) == 0)
-    {
-      bResult = true;
-      gpCentral->log((string)"serviceReload() [" + strService + (string)"]:  Reloaded service.");
-    }
-    else
+    leftovers.clear();
+    coreQuota();
+    // }}}
+    while (!gbCoreStop)
     {
-      ssMessage.str("");
-      ssMessage << "kill(" << errno << ") " << strerror(errno);
-      strError = ssMessage.str();
-    }
-  }
-
-  return bResult;
-}
-// }}}
-// {{{ serviceRemove()
-bool serviceRemove(const string strService, string &strError)
-{
-  bool bResult = false;
-
-  if (serviceExist(strService, strError) && (!serviceActive(strService, strError) || serviceStop(strService, strError)))
-  {
-    bResult = true;
-    gServices[strService]->environment.clear();
+      pollfd fds[1];
+      fds[0].fd = fdNotify;
+      fds[0].events = POLLIN;
+      // {{{ new core dumps
+      if (poll(fds, 1, 1000) > 0 && (fds[0].revents & POLLIN))
+      {
+        ssize_t nSize;
+        time(&CNow);
+        while ((nSize = read(fdNotify, szBuffer, sizeof(szBuffer))) > 0)
+        {
+          for (char *pszEvent = szBuffer; pszEvent < (szBuffer + nSize); pszEvent += sizeof(inotify_event) + ((inotify_event *)pszEvent)->len)
+          {
+            inotify_event *ptEvent = (inotify_event *)pszEvent;
+            if (ptEvent->len > 0)
+            {
+              string strName = ptEvent->name;
+              if (strName == "core" || (strName.size() > 5 && strName.substr(0, 5) == "core."))
+              {
+                pending[strName] = CNow;
+              }
+            }
+          }
+        }
+      }
+      // }}}
+      // {{{ pending core dumps
+      time(&CNow);
+      for (map<string, time_t>::iterator i = pending.begin(); !gbCoreStop && i != pending.end();)
+      {
+        bool bFound = false;
+        crash tCrash;
+        pid_t nPid = 0;
+        // core.<pid> names its process while a plain core belongs to the newest crash
+        if (i->first.size() > 5 && i->first.find_first_not_of("0123456789", 5) == string::npos)
+        {
+          nPid = atoi(i->first.substr(5, i->first.size() - 5).c_str());
+        }
+        gCoreMutex.lock();
+        for (map<pid_t, crash>::iterator j = gCrashes.begin(); j != gCrashes.end(); j++)
+        {
+          if ((nPid != 0)?(j->first == nPid):(!bFound || j->second.CTime > tCrash.CTime))
+          {
+            bFound = true;
+            nPid = j->first;
+            tCrash = j->second;
+          }
+        }
+        if (bFound)
+        {
+          gCrashes.erase(nPid);
+        }
+        gCoreMutex.unlock();
+        if (bFound || (CNow - i->second) >= 10)
+        {
+          char szTime[16];
+          string strBacktrace, strTarget;
+          stringstream ssTarget;
+          struct tm tTime;
+          localtime_r(((bFound)?&(tCrash.CTime):&(i->second)), &tTime);
+          strftime(szTime, sizeof(szTime), "%Y%m%d-%H%M%S", &tTime);
+          ssTarget << ((bFound)?tCrash.strService:"unknown") << "_" << szTime << "_" << nPid << ".core";
+          strTarget = ssTarget.str();
+          if (rename((strCores + "/" + i->first).c_str(), (strCores + "/" + strTarget).c_str()) == 0)
+          {
+            ssMessage.str("");
+            ssMessage << "coreManager()->rename() [" << i->first << "," << strTarget << "]:  Collected the core dump.";
+            logMessage(ssMessage.str());
+            if (gbCoreBacktrace && bFound && coreBacktrace(tCrash.strBinary, strCores + "/" + strTarget, strBacktrace))
+            {
+              // notified separately but within the digest window of the crash notification
+              ssMessage.str("");
+              ssMessage << "Backtrace of the core dump from the " << tCrash.strService << " service [" << strTarget << "]:" << endl << strBacktrace;
+              notifyPush(ssMessage.str());
+            }
+            if (coreCompress(strCores + "/" + strTarget, strError))
+            {
+              gunCoresCompressed++;
+            }
+            else if (!gbCoreStop)
+            {
+              ssMessage.str("");
+              ssMessage << "coreManager()->coreCompress() error [" << strTarget << "]:  " << strError;
+              logMessage(ssMessage.str());
+            }
+            coreQuota();
+          }
+          else
+          {
+            ssMessage.str("");
+            ssMessage << "coreManager()->rename(" << errno << ") error [" << i->first << "," << strTarget << "]:  " << strerror(errno);
+            logMessage(ssMessage.str());
+          }
+          pending.erase(i++);
+        }
+        else
+        {
+          i++;
+        }
+      }
+      // }}}
+      // {{{ expire crashes
+      gCoreMutex.lock();
+      for (map<pid_t, crash>::iterator i = gCrashes.begin(); i != gCrashes.end();)
+      {
+        if ((CNow - i->second.CTime) > 60)
+        {
+          gCrashes.erase(i++);
+        }
+        else
+        {
+          i++;
+        }
+      }
+      gCoreMutex.unlock();
+      // }}}
+    }
+  }
+  else
+  {
+    ssMessage << "coreManager()->inotify(" << errno << ") error [" << strCores << "]:  " << strerror(errno);
+    logMessage(ssMessage.str());
+  }
+  if (fdNotify != -1)
+  {
+    close(fdNotify);
+  }
+}
+// }}}
+// {{{ coreQuota()
+void coreQuota()
+{
+  DIR *pDir;
+  map<string, size_t> totals;
+  multimap<time_t, pair<string, size_t> > files;
+  size_t unTotal = 0;
+  string strCores = gstrData + "/cores";
+  stringstream ssMessage;
+
+  if ((pDir = opendir(strCores.c_str())) != NULL)
+  {
+    dirent *ptEntry;
+    while ((ptEntry = readdir(pDir)) != NULL)
+    {
+      string strName = ptEntry->d_name;
+      struct stat tStat;
+      if (strName.size() > 8 && strName.substr(strName.size() - 8, 8) == ".core.gz" && stat((strCores + "/" + strName).c_str(), &tStat) == 0)
+      {
+        files.insert(make_pair(tStat.st_mtime, make_pair(strName, (size_t)tStat.st_size)));
+      }
+    }
+    closedir(pDir);
+  }
+  for (multimap<time_t, pair<string, size_t> >::iterator i = files.begin(); i != files.end(); i++)
+  {
+    totals[coreService(i->second.first)] += i->second.second;
+    unTotal += i->second.second;
+  }
+  // the oldest dumps go first, per service before the total
+  for (multimap<time_t, pair<string, size_t> >::iterator i = files.begin(); i != files.end();)
+  {
+    string strService = coreService(i->second.first);
+    if (totals[strService] > (gunCoreServiceLimit * 1048576) || unTotal > (gunCoreLimit * 1048576))
+    {
+      if (unlink((strCores + "/" + i->second.first).c_str()) == 0)
+      {
+        gunCoresRemoved++;
+        ssMessage.str("");
+        ssMessage << "coreQuota()->unlink() [" << i->second.first << "]:  Removed the core dump to honor the quota.";
+        logMessage(ssMessage.str());
+      }
+      totals[strService] -= i->second.second;
+      unTotal -= i->second.second;
+      files.erase(i++);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+// }}}
+// {{{ coreRecord()
+void coreRecord(const string strService, const pid_t nPid)
+{
+  crash tCrash;
+  stringstream ssExecStart(gServices[strService]->strExecStart);
+
+  time(&(tCrash.CTime));
+  ssExecStart >> tCrash.strBinary;
+  tCrash.strService = strService;
+  gCoreMutex.lock();
+  gCrashes[nPid] = tCrash;
+  gCoreMutex.unlock();
+}
+// }}}
+// {{{ coreService()
+string coreService(const string strName)
+{
+  size_t unPosition = strName.rfind('_');
+  string strService;
+
+  if (unPosition != string::npos && unPosition > 0 && (unPosition = strName.rfind('_', unPosition - 1)) != string::npos)
+  {
+    strService = strName.substr(0, unPosition);
+  }
+
+  return strService;
+}
+// }}}
+// {{{ coreStart()
+void coreStart()
+{
+  if (gptCoreManager == NULL)
+  {
+    gbCoreStop = false;
+    gptCoreManager = new thread(coreManager);
+  }
+}
+// }}}
+// {{{ coreStop()
+void coreStop()
+{
+  if (gptCoreManager != NULL)
+  {
+    gbCoreStop = true;
+    gptCoreManager->join();
+    delete gptCoreManager;
+    gptCoreManager = NULL;
+  }
+}
+// }}}
+// }}}
+// {{{ daemon
+// {{{ daemonReload()
+void daemonReload(map<string, string> &changes)
+{
+  size_t unStart = timeMonotonic();
+
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    struct stat tStat;
+    // an unchanged definition costs a single stat()
+    if (stat((gstrData + (string)"/services/" + i->first + (string)".service").c_str(), &tStat) == 0 && (tStat.st_mtim.tv_sec != i->second->tDefinitionModified.tv_sec || tStat.st_mtim.tv_nsec != i->second->tDefinitionModified.tv_nsec || (size_t)tStat.st_size != i->second->unDefinitionSize))
+    {
+      service tDefinition;
+      string strChanges, strError;
+      if (serviceParse(i->first, &tDefinition, strError))
+      {
+        serviceRefresh(i->first, tDefinition, strChanges);
+        if (!strChanges.empty())
+        {
+          changes[i->first] = strChanges;
+          logMessage((string)"daemonReload() [" + i->first + (string)"]:  Reloaded the definition:  " + strChanges + (string)".");
+        }
+      }
+      else
+      {
+        changes[i->first] = (string)"error:  " + strError;
+        logMessage((string)"daemonReload()->serviceParse() error [" + i->first + (string)"]:  " + strError);
+      }
+    }
+  }
+  statsRecord("daemonReload", "", unStart);
+}
+// }}}
+// }}}
+// {{{ definition
+// {{{ definitionClose()
+void definitionClose()
+{
+  if (gpszDefinitions != NULL)
+  {
+    munmap(gpszDefinitions, gunDefinitions);
+    gpszDefinitions = NULL;
+    gunDefinitions = 0;
+  }
+}
+// }}}
+// {{{ definitionDecode()
+bool definitionDecode(const char *pszRecord, const size_t unSize, service *ptService)
+{
+  bool bResult = true;
+  size_t unPosition = 0;
+  uint64_t unNumber;
+  vector<list<string> *> lists;
+  vector<size_t *> numbers;
+  vector<string *> strings;
+
+  definitionFields(ptService, strings, lists, numbers);
+  for (size_t i = 0; bResult && i < strings.size(); i++)
+  {
+    uint32_t unLength;
+    if ((unPosition + sizeof(uint32_t)) <= unSize)
+    {
+      memcpy(&unLength, pszRecord + unPosition, sizeof(uint32_t));
+      unPosition += sizeof(uint32_t);
+      if ((unPosition + unLength) <= unSize)
+      {
+        strings[i]->assign(pszRecord + unPosition, unLength);
+        unPosition += unLength;
+      }
+      else
+      {
+        bResult = false;
+      }
+    }
+    else
+    {
+      bResult = false;
+    }
+  }
+  for (size_t i = 0; bResult && i < lists.size(); i++)
+  {
+    uint32_t unCount;
+    if ((unPosition + sizeof(uint32_t)) <= unSize)
+    {
+      memcpy(&unCount, pszRecord + unPosition, sizeof(uint32_t));
+      unPosition += sizeof(uint32_t);
+      for (uint32_t j = 0; bResult && j < unCount; j++)
+      {
+        uint32_t unLength = 0;
+        if ((unPosition + sizeof(uint32_t)) <= unSize)
+        {
+          memcpy(&unLength, pszRecord + unPosition, sizeof(uint32_t));
+          unPosition += sizeof(uint32_t);
+          if ((unPosition + unLength) <= unSize)
+          {
+            lists[i]->push_back(string(pszRecord + unPosition, unLength));
+            unPosition += unLength;
+          }
+          else
+          {
+            bResult = false;
+          }
+        }
+        else
+        {
+          bResult = false;
+        }
+      }
+    }
+    else
+    {
+      bResult = false;
+    }
+  }
+  for (size_t i = 0; bResult && i <= numbers.size(); i++)
+  {
+    if ((unPosition + sizeof(uint64_t)) <= unSize)
+    {
+      memcpy(&unNumber, pszRecord + unPosition, sizeof(uint64_t));
+      unPosition += sizeof(uint64_t);
+      if (i < numbers.size())
+      {
+        *numbers[i] = unNumber;
+      }
+      else
+      {
+        ptService->nKillSignal = (int)unNumber;
+      }
+    }
+    else
+    {
+      bResult = false;
+    }
+  }
+  // health is runtime state so it is derived the same way definitionParse() sets it
+  if (bResult && !ptService->strHealthCheckType.empty())
+  {
+    ptService->strHealth = "unknown";
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ definitionEncode()
+string &definitionEncode(service *ptService, string &strRecord)
+{
+  uint64_t unNumber;
+  vector<list<string> *> lists;
+  vector<size_t *> numbers;
+  vector<string *> strings;
+
+  strRecord.clear();
+  definitionFields(ptService, strings, lists, numbers);
+  for (size_t i = 0; i < strings.size(); i++)
+  {
+    uint32_t unLength = strings[i]->size();
+    strRecord.append((char *)&unLength, sizeof(uint32_t));
+    strRecord.append(*strings[i]);
+  }
+  for (size_t i = 0; i < lists.size(); i++)
+  {
+    uint32_t unCount = lists[i]->size();
+    strRecord.append((char *)&unCount, sizeof(uint32_t));
+    for (list<string>::iterator j = lists[i]->begin(); j != lists[i]->end(); j++)
+    {
+      uint32_t unLength = j->size();
+      strRecord.append((char *)&unLength, sizeof(uint32_t));
+      strRecord.append(*j);
+    }
+  }
+  for (size_t i = 0; i < numbers.size(); i++)
+  {
+    unNumber = *numbers[i];
+    strRecord.append((char *)&unNumber, sizeof(uint64_t));
+  }
+  unNumber = ptService->nKillSignal;
+  strRecord.append((char *)&unNumber, sizeof(uint64_t));
+
+  return strRecord;
+}
+// }}}
+// {{{ definitionFields()
+void definitionFields(service *ptService, vector<string *> &strings, vector<list<string> *> &lists, vector<size_t *> &numbers)
+{
+  // the order is the cache format so changing it requires a new DEFINITIONS_MAGIC
+  strings = {&ptService->strDescription, &ptService->strExecStart, &ptService->strExecStartPost, &ptService->strExecStartPre, &ptService->strExecStopPost, &ptService->strHealthCheckCommand, &ptService->strHealthCheckHost, &ptService->strHealthCheckPath, &ptService->strHealthCheckPort, &ptService->strHealthCheckType, &ptService->strKillMode, &ptService->strLimitCore, &ptService->strLimitNoFile, &ptService->strPidFile, &ptService->strRestart, &ptService->strStopDiagnostics, &ptService->strType};
+  lists = {&ptService->environment, &ptService->listenDatagram, &ptService->listenStream};
+  numbers = {&ptService->unFdStoreMax, &ptService->unHealthCheckInterval, &ptService->unHealthCheckThreshold, &ptService->unHealthCheckTimeout, &ptService->unIdleStopSec, &ptService->unTimeoutStopSec};
+}
+// }}}
+// {{{ definitionFind()
+bool definitionFind(const string strService, const char *&pszRecord, size_t &unSize, definitionRecord &tRecord)
+{
+  bool bResult = false;
+
+  if (gpszDefinitions != NULL)
+  {
+    definitionHeader tHeader;
+    size_t unFirst = 0, unLast;
+    memcpy(&tHeader, gpszDefinitions, sizeof(definitionHeader));
+    unLast = tHeader.unCount;
+    // records are written in name order behind a table of their offsets
+    while (!bResult && unFirst < unLast)
+    {
+      int nCompare;
+      size_t unMiddle = unFirst + ((unLast - unFirst) / 2);
+      uint64_t unOffset;
+      memcpy(&unOffset, gpszDefinitions + sizeof(definitionHeader) + (unMiddle * sizeof(uint64_t)), sizeof(uint64_t));
+      if ((unOffset + sizeof(definitionRecord)) <= gunDefinitions)
+      {
+        memcpy(&tRecord, gpszDefinitions + unOffset, sizeof(definitionRecord));
+      }
+      // a truncated cache simply misses
+      if ((unOffset + sizeof(definitionRecord)) > gunDefinitions || (unOffset + sizeof(definitionRecord) + tRecord.unNameLength + tRecord.unLength) > gunDefinitions)
+      {
+        unLast = unFirst;
+      }
+      else if ((nCompare = strService.compare(0, string::npos, gpszDefinitions + unOffset + sizeof(definitionRecord), tRecord.unNameLength)) == 0)
+      {
+        bResult = true;
+        pszRecord = gpszDefinitions + unOffset + sizeof(definitionRecord) + tRecord.unNameLength;
+        unSize = tRecord.unLength;
+      }
+      else if (nCompare < 0)
+      {
+        unLast = unMiddle;
+      }
+      else
+      {
+        unFirst = unMiddle + 1;
+      }
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ definitionLookup()
+bool definitionLookup(const string strService, const struct stat &tStat, service *ptService)
+{
+  bool bResult = false;
+  const char *pszRecord;
+  size_t unSize;
+  definitionRecord tRecord;
+
+  if (definitionFind(strService, pszRecord, unSize, tRecord) && tRecord.nModifiedSec == (int64_t)tStat.st_mtim.tv_sec && tRecord.nModifiedNsec == (int64_t)tStat.st_mtim.tv_nsec && tRecord.unSize == (uint64_t)tStat.st_size)
+  {
+    if (ptService == NULL)
+    {
+      bResult = true;
+    }
+    else
+    {
+      service tDefinition;
+      if (definitionDecode(pszRecord, unSize, &tDefinition))
+      {
+        bResult = true;
+        definitionMove(&tDefinition, ptService);
+      }
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ definitionMove()
+void definitionMove(service *ptSource, service *ptTarget)
+{
+  vector<list<string> *> lists[2];
+  vector<size_t *> numbers[2];
+  vector<string *> strings[2];
+
+  definitionFields(ptSource, strings[0], lists[0], numbers[0]);
+  definitionFields(ptTarget, strings[1], lists[1], numbers[1]);
+  for (size_t i = 0; i < strings[0].size(); i++)
+  {
+    strings[1][i]->swap(*strings[0][i]);
+  }
+  for (size_t i = 0; i < lists[0].size(); i++)
+  {
+    lists[1][i]->swap(*lists[0][i]);
+  }
+  for (size_t i = 0; i < numbers[0].size(); i++)
+  {
+    *numbers[1][i] = *numbers[0][i];
+  }
+  ptTarget->nKillSignal = ptSource->nKillSignal;
+}
+// }}}
+// {{{ definitionOpen()
+void definitionOpen()
+{
+  int fdCache;
+  string strPath = gstrData + "/services.cache";
+
+  definitionClose();
+  if ((fdCache = open(strPath.c_str(), O_RDONLY | O_CLOEXEC)) != -1)
+  {
+    struct stat tStat;
+    if (fstat(fdCache, &tStat) == 0 && (size_t)tStat.st_size >= sizeof(definitionHeader))
+    {
+      void *pCache;
+      if ((pCache = mmap(NULL, tStat.st_size, PROT_READ, MAP_SHARED, fdCache, 0)) != MAP_FAILED)
+      {
+        definitionHeader tHeader;
+        memcpy(&tHeader, pCache, sizeof(definitionHeader));
+        if (memcmp(tHeader.szMagic, DEFINITIONS_MAGIC, 8) == 0 && (sizeof(definitionHeader) + (tHeader.unCount * sizeof(uint64_t))) <= (size_t)tStat.st_size)
+        {
+          gpszDefinitions = (char *)pCache;
+          gunDefinitions = tStat.st_size;
+        }
+        else
+        {
+          munmap(pCache, tStat.st_size);
+          logMessage((string)"definitionOpen() [" + strPath + (string)"]:  Ignoring the service definition cache written by another version.");
+        }
+      }
+    }
+    close(fdCache);
+  }
+}
+// }}}
+// {{{ definitionParse()
+bool definitionParse(const string strService, service *ptService, string &strError)
+{
+  bool bResult = false;
+  string strLine;
+  stringstream ssJson;
+  Json *ptJson;
+  ifstream inService((gstrData + (string)"/services/" + strService + (string)".service").c_str());
+  while (getline(inService, strLine))
+  {
+    ssJson << strLine;
+  }
+  inService.close();
+  ptJson = new Json(ssJson.str());
+  if (ptJson->m.find("ExecStart") != ptJson->m.end() && !ptJson->m["ExecStart"]->v.empty())
+  {
+    bResult = true;
+    ptService->nKillSignal = SIGTERM;
+    ptService->unFdStoreMax = 64;
+    ptService->unHealthCheckInterval = 30;
+    ptService->unHealthCheckThreshold = 3;
+    ptService->unHealthCheckTimeout = 5;
+    ptService->unIdleStopSec = 0;
+    ptService->unTimeoutStopSec = 300;
+    ptService->strExecStart = ptJson->m["ExecStart"]->v;
+    if (ptJson->m.find("Description") != ptJson->m.end() && !ptJson->m["Description"]->v.empty())
+    {
+      ptService->strDescription = ptJson->m["Description"]->v;
+    }
+    if (ptJson->m.find("ExecStartPost") != ptJson->m.end() && !ptJson->m["ExecStartPost"]->v.empty())
+    {
+      ptService->strExecStartPost = ptJson->m["ExecStartPost"]->v;
+    }
+    if (ptJson->m.find("ExecStartPre") != ptJson->m.end() && !ptJson->m["ExecStartPre"]->v.empty())
+    {
+      ptService->strExecStartPre = ptJson->m["ExecStartPre"]->v;
+    }
+    if (ptJson->m.find("ExecStopPost") != ptJson->m.end() && !ptJson->m["ExecStopPost"]->v.empty())
+    {
+      ptService->strExecStopPost = ptJson->m["ExecStopPost"]->v;
+    }
+    if (ptJson->m.find("Environment") != ptJson->m.end() && !ptJson->m["Environment"]->l.empty())
+    {
+      for (list<Json *>::iterator i = ptJson->m["Environment"]->l.begin(); i != ptJson->m["Environment"]->l.end(); i++)
+      {
+        if (!(*i)->v.empty())
+        {
+          ptService->environment.push_back((*i)->v);
+        }
+      }
+    }
+    ptService->strLimitCore = "0";
+    if (ptJson->m.find("LimitCORE") != ptJson->m.end() && !ptJson->m["LimitCORE"]->v.empty())
+    {
+      ptService->strLimitCore = ptJson->m["LimitCORE"]->v;
+    }
+    ptService->strLimitNoFile = "1024";
+    if (ptJson->m.find("LimitNOFILE") != ptJson->m.end() && !ptJson->m["LimitNOFILE"]->v.empty())
+    {
+      ptService->strLimitNoFile = ptJson->m["LimitNOFILE"]->v;
+    }
+    if (ptJson->m.find("PIDFile") != ptJson->m.end() && !ptJson->m["PIDFile"]->v.empty())
+    {
+      ptService->strPidFile = ptJson->m["PIDFile"]->v;
+    }
+    ptService->strRestart = "always";
+    if (ptJson->m.find("Restart") != ptJson->m.end() && !ptJson->m["Restart"]->v.empty())
+    {
+      ptService->strRestart = ptJson->m["Restart"]->v;
+    }
+    ptService->strType = "simple";
+    if (ptJson->m.find("Type") != ptJson->m.end() && !ptJson->m["Type"]->v.empty())
+    {
+      ptService->strType = ptJson->m["Type"]->v;
+    }
+    if (ptJson->m.find("FileDescriptorStoreMax") != ptJson->m.end() && !ptJson->m["FileDescriptorStoreMax"]->v.empty())
+    {
+      ptService->unFdStoreMax = atoi(ptJson->m["FileDescriptorStoreMax"]->v.c_str());
+    }
+    // {{{ health check
+    if (ptJson->m.find("HealthCheck") != ptJson->m.end() && ptJson->m["HealthCheck"]->m.find("Type") != ptJson->m["HealthCheck"]->m.end() && !ptJson->m["HealthCheck"]->m["Type"]->v.empty())
+    {
+      Json *ptHealthCheck = ptJson->m["HealthCheck"];
+      ptService->strHealthCheckType = ptHealthCheck->m["Type"]->v;
+      if (ptHealthCheck->m.find("Command") != ptHealthCheck->m.end() && !ptHealthCheck->m["Command"]->v.empty())
+      {
+        ptService->strHealthCheckCommand = ptHealthCheck->m["Command"]->v;
+      }
+      ptService->strHealthCheckHost = "127.0.0.1";
+      if (ptHealthCheck->m.find("Host") != ptHealthCheck->m.end() && !ptHealthCheck->m["Host"]->v.empty())
+      {
+        ptService->strHealthCheckHost = ptHealthCheck->m["Host"]->v;
+      }
+      if (ptHealthCheck->m.find("Interval") != ptHealthCheck->m.end() && atoi(ptHealthCheck->m["Interval"]->v.c_str()) > 0)
+      {
+        ptService->unHealthCheckInterval = atoi(ptHealthCheck->m["Interval"]->v.c_str());
+      }
+      ptService->strHealthCheckPath = "/";
+      if (ptHealthCheck->m.find("Path") != ptHealthCheck->m.end() && !ptHealthCheck->m["Path"]->v.empty())
+      {
+        ptService->strHealthCheckPath = ptHealthCheck->m["Path"]->v;
+      }
+      if (ptHealthCheck->m.find("Port") != ptHealthCheck->m.end() && !ptHealthCheck->m["Port"]->v.empty())
+      {
+        ptService->strHealthCheckPort = ptHealthCheck->m["Port"]->v;
+      }
+      if (ptHealthCheck->m.find("Threshold") != ptHealthCheck->m.end() && atoi(ptHealthCheck->m["Threshold"]->v.c_str()) > 0)
+      {
+        ptService->unHealthCheckThreshold = atoi(ptHealthCheck->m["Threshold"]->v.c_str());
+      }
+      if (ptHealthCheck->m.find("Timeout") != ptHealthCheck->m.end() && atoi(ptHealthCheck->m["Timeout"]->v.c_str()) > 0)
+      {
+        ptService->unHealthCheckTimeout = atoi(ptHealthCheck->m["Timeout"]->v.c_str());
+      }
+      if (((ptService->strHealthCheckType == "http" || ptService->strHealthCheckType == "tcp") && !ptService->strHealthCheckPort.empty()) || (ptService->strHealthCheckType == "exec" && !ptService->strHealthCheckCommand.empty()))
+      {
+        ptService->strHealth = "unknown";
+      }
+      else
+      {
+        logMessage((string)"definitionParse() [" + strService + (string)"]:  Ignoring the HealthCheck which requires a Type of exec with a Command or a Type of http or tcp with a Port.");
+        ptService->strHealthCheckType.clear();
+      }
+    }
+    // }}}
+    // {{{ socket activation
+    for (int i = 0; i < 2; i++)
+    {
+      string strKey = ((i == 0)?"ListenStream":"ListenDatagram");
+      list<string> &addresses = ((i == 0)?ptService->listenStream:ptService->listenDatagram);
+      if (ptJson->m.find(strKey) != ptJson->m.end())
+      {
+        if (!ptJson->m[strKey]->v.empty())
+        {
+          addresses.push_back(ptJson->m[strKey]->v);
+        }
+        for (list<Json *>::iterator j = ptJson->m[strKey]->l.begin(); j != ptJson->m[strKey]->l.end(); j++)
+        {
+          if (!(*j)->v.empty())
+          {
+            addresses.push_back((*j)->v);
+          }
+        }
+      }
+    }
+    if (ptJson->m.find("IdleStopSec") != ptJson->m.end() && atoi(ptJson->m["IdleStopSec"]->v.c_str()) > 0)
+    {
+      ptService->unIdleStopSec = atoi(ptJson->m["IdleStopSec"]->v.c_str());
+    }
+    ptService->strKillMode = "control-group";
+    if (ptJson->m.find("KillMode") != ptJson->m.end() && (ptJson->m["KillMode"]->v == "mixed" || ptJson->m["KillMode"]->v == "process" || ptJson->m["KillMode"]->v == "process-group"))
+    {
+      ptService->strKillMode = ptJson->m["KillMode"]->v;
+    }
+    if (ptJson->m.find("KillSignal") != ptJson->m.end() && signalNumber(ptJson->m["KillSignal"]->v) > 0)
+    {
+      ptService->nKillSignal = signalNumber(ptJson->m["KillSignal"]->v);
+    }
+    if (ptJson->m.find("StopDiagnostics") != ptJson->m.end() && !ptJson->m["StopDiagnostics"]->v.empty())
+    {
+      ptService->strStopDiagnostics = ptJson->m["StopDiagnostics"]->v;
+    }
+    if (ptJson->m.find("TimeoutStopSec") != ptJson->m.end() && atoi(ptJson->m["TimeoutStopSec"]->v.c_str()) > 0)
+    {
+      ptService->unTimeoutStopSec = atoi(ptJson->m["TimeoutStopSec"]->v.c_str());
+    }
+    // }}}
+  }
+  else
+  {
+    strError = "Please provide the Command within the Service configuration.";
+  }
+  delete ptJson;
+
+  return bResult;
+}
+// }}}
+// {{{ definitionPrepare()
+void definitionPrepare(const list<string> &services)
+{
+  atomic<size_t> unNext(0);
+  size_t unStart = timeMonotonic(), unThreads = thread::hardware_concurrency();
+  vector<string> misses;
+  vector<service *> parsed;
+
+  for (list<string>::const_iterator i = services.begin(); i != services.end(); i++)
+  {
+    struct stat tStat;
+    if (stat((gstrData + (string)"/services/" + (*i) + (string)".service").c_str(), &tStat) == 0 && !definitionLookup(*i, tStat, NULL))
+    {
+      misses.push_back(*i);
+    }
+  }
+  if (!misses.empty())
+  {
+    vector<thread *> workers;
+    parsed.resize(misses.size(), NULL);
+    unThreads = min(max(unThreads, (size_t)1), min((size_t)16, misses.size()));
+    for (size_t i = 0; i < unThreads; i++)
+    {
+      workers.push_back(new thread(definitionWorker, cref(misses), ref(parsed), ref(unNext)));
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      workers[i]->join();
+      delete workers[i];
+    }
+    workers.clear();
+    for (size_t i = 0; i < misses.size(); i++)
+    {
+      if (parsed[i] != NULL)
+      {
+        gbDefinitionsDirty = true;
+        gDefinitions[misses[i]] = parsed[i];
+      }
+    }
+    parsed.clear();
+  }
+  statsRecord("definitionPrepare", "", unStart);
+}
+// }}}
+// {{{ definitionSave()
+void definitionSave()
+{
+  map<string, string> records;
+  string strPath = gstrData + "/services.cache", strRecord;
+
+  gbDefinitionsDirty = false;
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    if (i->second->unDefinitionSize > 0 || i->second->tDefinitionModified.tv_sec > 0)
+    {
+      definitionRecord tRecord;
+      memset(&tRecord, 0, sizeof(definitionRecord));
+      tRecord.nModifiedSec = i->second->tDefinitionModified.tv_sec;
+      tRecord.nModifiedNsec = i->second->tDefinitionModified.tv_nsec;
+      tRecord.unSize = i->second->unDefinitionSize;
+      tRecord.unNameLength = i->first.size();
+      definitionEncode(i->second, strRecord);
+      tRecord.unLength = strRecord.size();
+      records[i->first].assign((char *)&tRecord, sizeof(definitionRecord));
+      records[i->first].append(i->first);
+      records[i->first].append(strRecord);
+    }
+  }
+  // definitions of services which are not loaded are carried over while their files exist
+  if (gpszDefinitions != NULL)
+  {
+    definitionHeader tHeader;
+    memcpy(&tHeader, gpszDefinitions, sizeof(definitionHeader));
+    for (uint32_t i = 0; i < tHeader.unCount; i++)
+    {
+      definitionRecord tRecord;
+      uint64_t unOffset;
+      memcpy(&unOffset, gpszDefinitions + sizeof(definitionHeader) + (i * sizeof(uint64_t)), sizeof(uint64_t));
+      if ((unOffset + sizeof(definitionRecord)) <= gunDefinitions)
+      {
+        memcpy(&tRecord, gpszDefinitions + unOffset, sizeof(definitionRecord));
+        if ((unOffset + sizeof(definitionRecord) + tRecord.unNameLength + tRecord.unLength) <= gunDefinitions)
+        {
+          string strName(gpszDefinitions + unOffset + sizeof(definitionRecord), tRecord.unNameLength);
+          if (records.find(strName) == records.end() && access((gstrData + (string)"/services/" + strName + (string)".service").c_str(), F_OK) == 0)
+          {
+            records[strName].assign(gpszDefinitions + unOffset, sizeof(definitionRecord) + tRecord.unNameLength + tRecord.unLength);
+          }
+        }
+      }
+    }
+  }
+  ofstream outCache((strPath + ".tmp").c_str(), ios::out | ios::binary | ios::trunc);
+  if (outCache)
+  {
+    definitionHeader tHeader;
+    uint64_t unOffset = sizeof(definitionHeader) + (records.size() * sizeof(uint64_t));
+    memset(&tHeader, 0, sizeof(definitionHeader));
+    memcpy(tHeader.szMagic, DEFINITIONS_MAGIC, 8);
+    tHeader.unCount = records.size();
+    outCache.write((char *)&tHeader, sizeof(definitionHeader));
+    for (map<string, string>::iterator i = records.begin(); i != records.end(); i++)
+    {
+      outCache.write((char *)&unOffset, sizeof(uint64_t));
+      unOffset += i->second.size();
+    }
+    for (map<string, string>::iterator i = records.begin(); i != records.end(); i++)
+    {
+      outCache.write(i->second.c_str(), i->second.size());
+    }
+    outCache.close();
+    if (outCache.good() && rename((strPath + ".tmp").c_str(), strPath.c_str()) == 0)
+    {
+      definitionOpen();
+    }
+    else
+    {
+      stringstream ssMessage;
+      ssMessage << "definitionSave() error [" << strPath << "]:  Failed to write the service definition cache.";
+      logMessage(ssMessage.str());
+      remove((strPath + ".tmp").c_str());
+    }
+  }
+  records.clear();
+}
+// }}}
+// {{{ definitionWorker()
+void definitionWorker(const vector<string> &misses, vector<service *> &parsed, atomic<size_t> &unNext)
+{
+  size_t unIndex;
+
+  threadSignals();
+  while ((unIndex = unNext++) < misses.size())
+  {
+    service *ptService = new service;
+    string strError;
+    struct stat tStat;
+    // the stamp is taken before reading so a concurrent edit is picked up again
+    if (stat((gstrData + (string)"/services/" + misses[unIndex] + (string)".service").c_str(), &tStat) == 0 && definitionParse(misses[unIndex], ptService, strError))
+    {
+      ptService->tDefinitionModified = tStat.st_mtim;
+      ptService->unDefinitionSize = tStat.st_size;
+      parsed[unIndex] = ptService;
+      gunDefinitionsParsed++;
+    }
+    else
+    {
+      // the event loop parses it again to report the error
+      delete ptService;
+    }
+  }
+}
+// }}}
+// }}}
+// {{{ health check
+// {{{ healthCheck()
+void healthCheck(const size_t unId)
+{
+  service *ptService = gServiceHot[unId].ptService;
+
+  if (!ptService->strHealthCheckType.empty() && gServiceHot[unId].nPid != -1 && !ptService->bStopped)
+  {
+    size_t unNow = timeMonotonic();
+    string strError;
+    if (gServiceHot[unId].fdHealthCheck != -1 || ptService->nHealthCheckPid != -1)
+    {
+      int nStatus;
+      if (ptService->nHealthCheckPid != -1 && waitpid(ptService->nHealthCheckPid, &nStatus, WNOHANG) == ptService->nHealthCheckPid)
+      {
+        stringstream ssError;
+        processTrack(ptService, ptService->nHealthCheckPid, -1);
+        if (WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0)
+        {
+          healthCheckFinish(gServiceNames[unId], true, "");
+        }
+        else
+        {
+          if (WIFEXITED(nStatus))
+          {
+            ssError << "Command exited with a status of " << WEXITSTATUS(nStatus) << ".";
+          }
+          else
+          {
+            ssError << "Command terminated by signal " << WTERMSIG(nStatus) << ".";
+          }
+          healthCheckFinish(gServiceNames[unId], false, ssError.str());
+        }
+      }
+      else if ((unNow - ptService->unHealthCheckStart) >= (ptService->unHealthCheckTimeout * 1000000000))
+      {
+        healthCheckFinish(gServiceNames[unId], false, "Timed out.");
+      }
+    }
+    else if ((unNow - ptService->unHealthCheckStart) >= (ptService->unHealthCheckInterval * 1000000000) && !healthCheckStart(gServiceNames[unId], strError))
+    {
+      healthCheckFinish(gServiceNames[unId], false, strError);
+    }
+  }
+}
+// }}}
+// {{{ healthCheckCancel()
+void healthCheckCancel(const string strService)
+{
+  if (gServiceHot[gServices[strService]->unId].fdHealthCheck != -1)
+  {
+    close(gServiceHot[gServices[strService]->unId].fdHealthCheck);
+    gServiceHot[gServices[strService]->unId].fdHealthCheck = -1;
+  }
+  if (gServices[strService]->nHealthCheckPid != -1)
+  {
+    kill(-gServices[strService]->nHealthCheckPid, SIGKILL);
+    waitpid(gServices[strService]->nHealthCheckPid, NULL, 0);
+    processTrack(gServices[strService], gServices[strService]->nHealthCheckPid, -1);
+  }
+  gServices[strService]->bHealthCheckConnected = false;
+  gServices[strService]->strHealthCheckBuffer[0].clear();
+  gServices[strService]->strHealthCheckBuffer[1].clear();
+}
+// }}}
+// {{{ healthCheckFinish()
+void healthCheckFinish(const string strService, const bool bHealthy, const string strError)
+{
+  stringstream ssMessage;
+
+  healthCheckCancel(strService);
+  gServices[strService]->unHealthCheckLatency = (timeMonotonic() - gServices[strService]->unHealthCheckStart) / 1000000;
+  if (bHealthy)
+  {
+    if (gServices[strService]->strHealth != "healthy")
+    {
+      ssMessage << "healthCheckFinish() [" << strService << "," << gServices[strService]->strHealthCheckType << "," << gServices[strService]->unHealthCheckLatency << " ms]:  Service healthy.";
+      logMessage(ssMessage.str());
+    }
+    gServices[strService]->strHealth = "healthy";
+    gServices[strService]->unHealthCheckFailures = 0;
+  }
+  else
+  {
+    gServices[strService]->unHealthCheckFailures++;
+    ssMessage << "healthCheckFinish() error [" << strService << "," << gServices[strService]->strHealthCheckType << "," << gServices[strService]->unHealthCheckFailures << "/" << gServices[strService]->unHealthCheckThreshold << "]:  " << strError;
+    logMessage(ssMessage.str());
+    if (gServices[strService]->unHealthCheckFailures >= gServices[strService]->unHealthCheckThreshold)
+    {
+      gServices[strService]->strHealth = "unhealthy";
+    }
+  }
+}
+// }}}
+// {{{ healthCheckPoll()
+void healthCheckPoll(const string strService, const short sRevents)
+{
+  char szBuffer[4096];
+  int nReturn;
+  size_t unPosition;
+  stringstream ssError;
+
+  if (!gServices[strService]->bHealthCheckConnected)
+  {
+    int nError = 0;
+    socklen_t unLength = sizeof(nError);
+    if (getsockopt(gServiceHot[gServices[strService]->unId].fdHealthCheck, SOL_SOCKET, SO_ERROR, &nError, &unLength) == 0 && nError == 0)
+    {
+      gServices[strService]->bHealthCheckConnected = true;
+      if (gServices[strService]->strHealthCheckType == "tcp")
+      {
+        healthCheckFinish(strService, true, "");
+      }
+      else
+      {
+        gServices[strService]->strHealthCheckBuffer[1] = (string)"GET " + gServices[strService]->strHealthCheckPath + (string)" HTTP/1.0\r\nHost: " + gServices[strService]->strHealthCheckHost + (string)"\r\nConnection: close\r\n\r\n";
+      }
+    }
+    else
+    {
+      ssError << "connect(" << nError << ") " << strerror(nError);
+      healthCheckFinish(strService, false, ssError.str());
+    }
+  }
+  else if (!gServices[strService]->strHealthCheckBuffer[1].empty())
+  {
+    if ((nReturn = write(gServiceHot[gServices[strService]->unId].fdHealthCheck, gServices[strService]->strHealthCheckBuffer[1].c_str(), gServices[strService]->strHealthCheckBuffer[1].size())) > 0)
+    {
+      gServices[strService]->strHealthCheckBuffer[1].erase(0, nReturn);
+    }
+    else
+    {
+      ssError << "write(" << errno << ") " << strerror(errno);
+      healthCheckFinish(strService, false, ssError.str());
+    }
+  }
+  else if ((nReturn = read(gServiceHot[gServices[strService]->unId].fdHealthCheck, szBuffer, 4096)) > 0)
+  {
+    gServices[strService]->strHealthCheckBuffer[0].append(szBuffer, nReturn);
+    if ((unPosition = gServices[strService]->strHealthCheckBuffer[0].find("\n")) != string::npos)
+    {
+      int nCode = 0;
+      string strVersion;
+      stringstream ssLine(gServices[strService]->strHealthCheckBuffer[0].substr(0, unPosition));
+      ssLine >> strVersion >> nCode;
+      if (nCode >= 200 && nCode < 400)
+      {
+        healthCheckFinish(strService, true, "");
+      }
+      else
+      {
+        ssError << "Received an HTTP status code of " << nCode << ".";
+        healthCheckFinish(strService, false, ssError.str());
+      }
+    }
+  }
+  else if (nReturn == 0)
+  {
+    healthCheckFinish(strService, false, "Connection closed before receiving the HTTP status line.");
+  }
+  else if (errno != EAGAIN && errno != EINTR)
+  {
+    ssError << "read(" << errno << ") " << strerror(errno);
+    healthCheckFinish(strService, false, ssError.str());
+  }
+}
+// }}}
+// {{{ healthCheckStart()
+bool healthCheckStart(const string strService, string &strError)
+{
+  bool bResult = false;
+  stringstream ssMessage;
+
+  gServices[strService]->unHealthCheckStart = timeMonotonic();
+  if (gServices[strService]->strHealthCheckType == "exec")
+  {
+    const char *pszCommand = gServices[strService]->strHealthCheckCommand.c_str();
+    long lMax = sysconf(_SC_OPEN_MAX);
+    pid_t nPid;
+    if ((nPid = fork()) == 0)
+    {
+      setpgid(0, 0);
+      // a hung probe must not hold the activation sockets or stored descriptors open
+      if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+      {
+        for (long i = 3; i < lMax; i++)
+        {
+          close(i);
+        }
+      }
+      execl("/bin/sh", "sh", "-c", pszCommand, (char *)NULL);
+      _exit(127);
+    }
+    else if (nPid > 0)
+    {
+      bResult = true;
+      setpgid(nPid, nPid);
+      processTrack(gServices[strService], gServices[strService]->nHealthCheckPid, nPid);
+    }
+    else
+    {
+      ssMessage.str("");
+      ssMessage << "fork(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+    }
+  }
+  else
+  {
+    int fdProbe;
+    if ((fdProbe = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0)
+    {
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(sockaddr_in));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(atoi(gServices[strService]->strHealthCheckPort.c_str()));
+      if (inet_pton(AF_INET, gServices[strService]->strHealthCheckHost.c_str(), &addr.sin_addr) == 1)
+      {
+        if (connect(fdProbe, (sockaddr *)&addr, sizeof(sockaddr_in)) == 0 || errno == EINPROGRESS)
+        {
+          bResult = true;
+          gServices[strService]->bHealthCheckConnected = false;
+          gServiceHot[gServices[strService]->unId].fdHealthCheck = fdProbe;
+        }
+        else
+        {
+          ssMessage.str("");
+          ssMessage << "connect(" << errno << ") " << strerror(errno);
+          strError = ssMessage.str();
+        }
+      }
+      else
+      {
+        strError = "Please provide a valid IPv4 Host.";
+      }
+      if (!bResult)
+      {
+        close(fdProbe);
+      }
+    }
+    else
+    {
+      ssMessage.str("");
+      ssMessage << "socket(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// }}}
+// {{{ frame
+// {{{ frameEncode()
+string &frameEncode(Json *ptJson, string &strBuffer)
+{
+  uint32_t unValue;
+
+  if (!ptJson->m.empty())
+  {
+    strBuffer.push_back('o');
+    unValue = htonl(ptJson->m.size());
+    strBuffer.append((char *)&unValue, sizeof(unValue));
+    for (map<string, Json *>::iterator i = ptJson->m.begin(); i != ptJson->m.end(); i++)
+    {
+      unValue = htonl(i->first.size());
+      strBuffer.append((char *)&unValue, sizeof(unValue));
+      strBuffer.append(i->first);
+      frameEncode(i->second, strBuffer);
+    }
+  }
+  else if (!ptJson->l.empty())
+  {
+    strBuffer.push_back('a');
+    unValue = htonl(ptJson->l.size());
+    strBuffer.append((char *)&unValue, sizeof(unValue));
+    for (list<Json *>::iterator i = ptJson->l.begin(); i != ptJson->l.end(); i++)
+    {
+      frameEncode(*i, strBuffer);
+    }
+  }
+  else
+  {
+    strBuffer.push_back('s');
+    unValue = htonl(ptJson->v.size());
+    strBuffer.append((char *)&unValue, sizeof(unValue));
+    strBuffer.append(ptJson->v);
+  }
+
+  return strBuffer;
+}
+// }}}
+// {{{ frameField()
+void frameField(const uint8_t ucTag, const char *pszData, const size_t unSize, string &strBuffer)
+{
+  uint32_t unLength = htonl(unSize);
+
+  strBuffer.push_back(ucTag);
+  strBuffer.append((char *)&unLength, sizeof(unLength));
+  strBuffer.append(pszData, unSize);
+}
+// }}}
+// {{{ frameHex()
+string &frameHex(const string strData, string &strHex)
+{
+  const char szDigits[] = "0123456789abcdef";
+
+  strHex.clear();
+  strHex.reserve(strData.size() * 2);
+  for (size_t i = 0; i < strData.size(); i++)
+  {
+    strHex.push_back(szDigits[(unsigned char)strData[i] >> 4]);
+    strHex.push_back(szDigits[(unsigned char)strData[i] & 0x0F]);
+  }
+
+  return strHex;
+}
+// }}}
+// {{{ frameParse()
+bool frameParse(string &strBuffer, size_t &unConsumed, request &tRequest, frameHeader &tFrame, bool &bClose)
+{
+  bool bResult = false;
+
+  if ((strBuffer.size() - unConsumed) >= sizeof(frameHeader))
+  {
+    memcpy(&tFrame, strBuffer.data() + unConsumed, sizeof(frameHeader));
+    tFrame.unLength = ntohl(tFrame.unLength);
+    tFrame.unId = ntohl(tFrame.unId);
+    tFrame.usFunction = ntohs(tFrame.usFunction);
+    tFrame.usStatus = ntohs(tFrame.usStatus);
+    if (tFrame.unLength > FRAME_MAX)
+    {
+      bClose = true;
+    }
+    else if ((strBuffer.size() - unConsumed - sizeof(frameHeader)) >= tFrame.unLength)
+    {
+      bool bValid = true;
+      size_t unPosition = unConsumed + sizeof(frameHeader), unEnd = unPosition + tFrame.unLength;
+      bResult = true;
+      memset(&tRequest, 0, sizeof(request));
+      if (tFrame.usFunction < (sizeof(gstrFunctions) / sizeof(string)))
+      {
+        tRequest.tFunction.pszData = gstrFunctions[tFrame.usFunction].c_str();
+        tRequest.tFunction.unSize = gstrFunctions[tFrame.usFunction].size();
+      }
+      else
+      {
+        tRequest.tFunction.pszData = "unknown";
+        tRequest.tFunction.unSize = 7;
+      }
+      tRequest.tFunction.bString = true;
+      // fields are spans into the buffer and unknown tags are skipped
+      while (bValid && (unEnd - unPosition) >= 5)
+      {
+        uint8_t ucTag = strBuffer[unPosition];
+        uint32_t unLength;
+        memcpy(&unLength, strBuffer.data() + unPosition + 1, sizeof(unLength));
+        unLength = ntohl(unLength);
+        unPosition += 5;
+        if (unLength <= (unEnd - unPosition))
+        {
+          requestValue *ptField = NULL;
+          if (ucTag == FRAME_ASYNC)
+          {
+            ptField = &tRequest.tAsync;
+          }
+          else if (ucTag == FRAME_END)
+          {
+            ptField = &tRequest.tEnd;
+          }
+          else if (ucTag == FRAME_JOB)
+          {
+            ptField = &tRequest.tJob;
+          }
+          else if (ucTag == FRAME_LIMIT)
+          {
+            ptField = &tRequest.tLimit;
+          }
+          else if (ucTag == FRAME_SERVICE)
+          {
+            ptField = &tRequest.tService;
+          }
+          else if (ucTag == FRAME_START)
+          {
+            ptField = &tRequest.tStart;
+          }
+          if (ptField != NULL)
+          {
+            ptField->pszData = strBuffer.data() + unPosition;
+            ptField->unSize = unLength;
+            ptField->bString = true;
+          }
+          unPosition += unLength;
+        }
+        else
+        {
+          bValid = false;
+        }
+      }
+      unConsumed = unEnd;
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ frameReply()
+string &frameReply(const frameHeader &tFrame, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer)
+{
+  size_t unStart = strBuffer.size();
+  frameHeader tReply = {0, 0, 0, 0};
+
+  strBuffer.append((char *)&tReply, sizeof(frameHeader));
+  if (!strError.empty())
+  {
+    frameField(FRAME_ERROR, strError.c_str(), strError.size(), strBuffer);
+  }
+  if (ptResponse != NULL)
+  {
+    size_t unField = strBuffer.size();
+    uint32_t unLength;
+    frameField(FRAME_RESPONSE, "", 0, strBuffer);
+    frameEncode(ptResponse, strBuffer);
+    unLength = htonl(strBuffer.size() - unField - 5);
+    strBuffer.replace(unField + 1, sizeof(unLength), (char *)&unLength, sizeof(unLength));
+  }
+  // the header is written last once the payload length is known
+  tReply.unLength = htonl(strBuffer.size() - unStart - sizeof(frameHeader));
+  tReply.unId = htonl(tFrame.unId);
+  tReply.usFunction = htons(tFrame.usFunction);
+  tReply.usStatus = htons((bProcessed)?0:1);
+  strBuffer.replace(unStart, sizeof(frameHeader), (char *)&tReply, sizeof(frameHeader));
+
+  return strBuffer;
+}
+// }}}
+// {{{ frameUnhex()
+string &frameUnhex(const string strHex, string &strData)
+{
+  strData.clear();
+  for (size_t i = 0; (i + 1) < strHex.size(); i += 2)
+  {
+    strData.push_back((char)strtoul(strHex.substr(i, 2).c_str(), NULL, 16));
+  }
+
+  return strData;
+}
+// }}}
+// }}}
+// {{{ job
+// {{{ jobAdd()
+size_t jobAdd(const string strFunction, const string strService)
+{
+  job tJob;
+
+  tJob.bStopping = false;
+  tJob.nPid = -1;
+  tJob.CFinished = tJob.CStarted = 0;
+  time(&(tJob.CQueued));
+  tJob.strFunction = strFunction;
+  tJob.strService = strService;
+  tJob.strState = "queued";
+  tJob.unId = ++gunJobId;
+  tJob.unStart = 0;
+  gJobs[tJob.unId] = tJob;
+  gJobQueues[strService].push_back(tJob.unId);
+
+  return tJob.unId;
+}
+// }}}
+// {{{ jobCancel()
+bool jobCancel(const size_t unId, string &strError)
+{
+  bool bResult = false;
+
+  if (gJobs.find(unId) == gJobs.end())
+  {
+    strError = "Failed to find the job.";
+  }
+  else if (gJobs[unId].strState == "queued")
+  {
+    bResult = true;
+    jobFinish(unId, false, "The job was canceled.", "canceled");
+  }
+  else if (gJobs[unId].strState == "running")
+  {
+    strError = "The job is already running and cannot be canceled.";
+  }
+  else
+  {
+    strError = "The job has already finished.";
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ jobDescribe()
+void jobDescribe(const job &tJob, Json *ptJob)
+{
+  time_t times[3] = {tJob.CQueued, tJob.CStarted, tJob.CFinished};
+  string names[3] = {"Queued", "Started", "Finished"};
+  stringstream ssValue;
+
+  ssValue << tJob.unId;
+  ptJob->insert("Job", ssValue.str());
+  ptJob->insert("Function", tJob.strFunction);
+  ptJob->insert("Service", tJob.strService);
+  ptJob->insert("State", tJob.strState);
+  if (!tJob.strError.empty())
+  {
+    ptJob->insert("Error", tJob.strError);
+  }
+  for (size_t i = 0; i < 3; i++)
+  {
+    if (times[i] > 0)
+    {
+      char szTime[32];
+      struct tm tTime;
+      localtime_r(&(times[i]), &tTime);
+      strftime(szTime, sizeof(szTime), "%Y-%m-%d %H:%M:%S", &tTime);
+      ptJob->insert(names[i], szTime);
+    }
+  }
+}
+// }}}
+// {{{ jobFinish()
+void jobFinish(const size_t unId, const bool bResult, const string strError, const string strState)
+{
+  job &tJob = gJobs[unId];
+  Json *ptJob = new Json;
+
+  time(&(tJob.CFinished));
+  tJob.bStopping = false;
+  if (!bResult && strState == "failed")
+  {
+    logMessage((string)"jobFinish() error [" + tJob.strService + (string)"," + tJob.strFunction + (string)"]:  " + strError);
+  }
+  tJob.strError = strError;
+  tJob.strState = strState;
+  gJobQueues[tJob.strService].remove(unId);
+  if (gJobQueues[tJob.strService].empty())
+  {
+    gJobQueues.erase(tJob.strService);
+  }
+  // deferred lifecycle requests get the reply they would have gotten synchronously
+  for (list<watcher>::iterator i = tJob.replies.begin(); i != tJob.replies.end(); i++)
+  {
+    watchReply(*i, bResult, strError, NULL);
+  }
+  tJob.replies.clear();
+  jobDescribe(tJob, ptJob);
+  for (list<watcher>::iterator i = tJob.waiters.begin(); i != tJob.waiters.end(); i++)
+  {
+    watchReply(*i, true, "", ptJob);
+  }
+  tJob.waiters.clear();
+  delete ptJob;
+  gJobsFinished.push_back(unId);
+  while (gJobsFinished.size() > JOB_HISTORY)
+  {
+    gJobs.erase(gJobsFinished.front());
+    gJobsFinished.pop_front();
+  }
+}
+// }}}
+// {{{ jobProcess()
+void jobProcess()
+{
+  list<size_t> jobs;
+
+  // only the oldest job of each service runs so operations on one service stay ordered
+  for (map<string, list<size_t> >::iterator i = gJobQueues.begin(); i != gJobQueues.end(); i++)
+  {
+    jobs.push_back(i->second.front());
+  }
+  for (list<size_t>::iterator i = jobs.begin(); i != jobs.end(); i++)
+  {
+    bool bResult = false;
+    job &tJob = gJobs[*i];
+    string strError, strService = tJob.strService;
+    if (tJob.strState == "queued")
+    {
+      bool bStop = (tJob.strFunction == "crash" || tJob.strFunction == "restart" || tJob.strFunction == "stop" || tJob.strFunction == "unhealthy");
+      tJob.strState = "running";
+      time(&(tJob.CStarted));
+      tJob.unStart = timeMonotonic();
+      if (tJob.strFunction == "disable" || tJob.strFunction == "reload-or-restart")
+      {
+        bStop = serviceActive(strService, strError);
+        if (bStop && tJob.strFunction == "reload-or-restart" && (gServiceHot[gServices[strService]->unId].nHandoverPid != -1 || !gServices[strService]->listens.empty() || !gServices[strService]->fdstore.empty()))
+        {
+          bStop = false;
+        }
+        strError.clear();
+      }
+      if (bStop)
+      {
+        tJob.nPid = ((gServices.find(strService) != gServices.end())?gServiceHot[gServices[strService]->unId].nPid:-1);
+        if (serviceStopBegin(strService, strError))
+        {
+          tJob.bStopping = true;
+        }
+        else
+        {
+          jobFinish(*i, false, strError, "failed");
+        }
+      }
+      else
+      {
+        if (tJob.strFunction == "disable")
+        {
+          bResult = serviceDisable(strService, strError);
+        }
+        else if (tJob.strFunction == "enable")
+        {
+          bResult = serviceEnable(strService, strError);
+        }
+        else if (tJob.strFunction == "reload")
+        {
+          bResult = serviceReload(strService, strError);
+        }
+        else if (tJob.strFunction == "reload-or-restart")
+        {
+          bResult = serviceReloadOrRestart(strService, strError);
+        }
+        else if (tJob.strFunction == "start")
+        {
+          bResult = serviceStart(strService, strError);
+        }
+        jobFinish(*i, bResult, strError, ((bResult)?"done":"failed"));
+      }
+    }
+    else if (tJob.bStopping && serviceStopPoll(strService, bResult, strError))
+    {
+      tJob.bStopping = false;
+      if (bResult)
+      {
+        if (tJob.strFunction == "stop")
+        {
+          // a deliberate stop cancels any pending restart after a crash
+          if (gServices.find(strService) != gServices.end())
+          {
+            gServiceHot[gServices[strService]->unId].unCrashes = 0;
+          }
+        }
+        else if (tJob.strFunction == "disable")
+        {
+          bResult = serviceDisable(strService, strError);
+        }
+        else if (tJob.strFunction == "crash" || tJob.strFunction == "unhealthy")
+        {
+          serviceCrashed(strService, tJob.strFunction, tJob.nPid, tJob.unStart);
+        }
+        else if ((bResult = serviceStart(strService, strError)))
+        {
+          traceRecord("restart", strService, tJob.unStart);
+          journalRecord(strService, "restart", gServiceHot[gServices[strService]->unId].nPid, -1, ((timeMonotonic() - tJob.unStart) / 1000));
+        }
+      }
+      jobFinish(*i, bResult, strError, ((bResult)?"done":"failed"));
+    }
+  }
+}
+// }}}
+// {{{ jobRemove()
+void jobRemove(const int fdSocket)
+{
+  for (map<size_t, job>::iterator i = gJobs.begin(); i != gJobs.end(); i++)
+  {
+    list<watcher> *lists[2] = {&(i->second.replies), &(i->second.waiters)};
+    for (size_t j = 0; j < 2; j++)
+    {
+      for (list<watcher>::iterator k = lists[j]->begin(); k != lists[j]->end();)
+      {
+        if (k->fdSocket == fdSocket)
+        {
+          k = lists[j]->erase(k);
+        }
+        else
+        {
+          k++;
+        }
+      }
+    }
+  }
+}
+// }}}
+// }}}
+// {{{ journal
+// {{{ journalClose()
+void journalClose()
+{
+  if (gptJournal != NULL)
+  {
+    munmap(gptJournal, (JOURNAL_ENTRIES * sizeof(journalEntry)));
+    gptJournal = NULL;
+  }
+}
+// }}}
+// {{{ journalOpen()
+bool journalOpen(string &strError)
+{
+  bool bResult = false;
+  list<size_t> segments;
+  string strLine;
+  stringstream ssError;
+  struct stat tStat;
+
+  if ((stat((gstrData + "/journal").c_str(), &tStat) == 0 && S_ISDIR(tStat.st_mode)) || mkdir((gstrData + "/journal").c_str(), 00770) == 0)
+  {
+    ifstream inServices((gstrData + "/journal/services").c_str());
+    gJournalNames.clear();
+    gJournalServices.clear();
+    // identifier zero is the daemon itself
+    gJournalNames.push_back("");
+    gJournalServices[""] = 0;
+    while (getline(inServices, strLine))
+    {
+      gJournalServices[strLine] = gJournalNames.size();
+      gJournalNames.push_back(strLine);
+    }
+    inServices.close();
+    if (!journalSegments(segments).empty())
+    {
+      int fdSegment;
+      stringstream ssPath;
+      gunJournalSegment = segments.back();
+      ssPath << gstrData << "/journal/" << setw(10) << setfill('0') << gunJournalSegment << ".seg";
+      if ((fdSegment = open(ssPath.str().c_str(), O_RDWR | O_CLOEXEC)) >= 0)
+      {
+        void *pMap;
+        if ((pMap = mmap(NULL, (JOURNAL_ENTRIES * sizeof(journalEntry)), PROT_READ | PROT_WRITE, MAP_SHARED, fdSegment, 0)) != MAP_FAILED)
+        {
+          gptJournal = (journalEntry *)pMap;
+          if (memcmp(((journalHeader *)gptJournal)->szMagic, "SVCJRNL1", 8) == 0)
+          {
+            bResult = true;
+          }
+          else
+          {
+            journalClose();
+          }
+        }
+        close(fdSegment);
+      }
+    }
+    if (!bResult)
+    {
+      bResult = journalRotate(strError);
+    }
+  }
+  else
+  {
+    ssError << "mkdir(" << errno << ") error [" << gstrData << "/journal]:  " << strerror(errno);
+    strError = ssError.str();
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ journalFormat()
+void journalFormat(const journalEntry &tEntry, Json *ptEntry)
+{
+  char szTime[32];
+  time_t CTime = tEntry.unTime / 1000000;
+  stringstream ssValue;
+  struct tm tTime;
+
+  localtime_r(&CTime, &tTime);
+  strftime(szTime, sizeof(szTime), "%Y-%m-%d %H:%M:%S", &tTime);
+  ssValue << szTime << "." << setw(3) << setfill('0') << ((tEntry.unTime / 1000) % 1000);
+  ptEntry->insert("Time", ssValue.str());
+  ptEntry->insert("Service", ((tEntry.unService < gJournalNames.size())?gJournalNames[tEntry.unService]:""));
+  ptEntry->insert("Event", ((tEntry.usEvent < (sizeof(gstrJournalEvents) / sizeof(string)))?gstrJournalEvents[tEntry.usEvent]:""));
+  if (tEntry.nPid > 0)
+  {
+    ssValue.str("");
+    ssValue << tEntry.nPid;
+    ptEntry->insert("Pid", ssValue.str());
+  }
+  if (tEntry.nStatus >= 0)
+  {
+    ssValue.str("");
+    ssValue << tEntry.nStatus;
+    ptEntry->insert("Status", ssValue.str());
+  }
+  if (tEntry.unDuration > 0)
+  {
+    ssValue.str("");
+    ssValue << tEntry.unDuration << " ms";
+    ptEntry->insert("Duration", ssValue.str());
+  }
+}
+// }}}
+// {{{ journalQuery()
+void journalQuery(const string strService, const time_t CStart, const time_t CEnd, const size_t unLimit, Json *ptEntries)
+{
+  list<size_t> segments;
+  list<Json *> entries;
+  uint64_t unStart = (uint64_t)CStart * 1000000, unEnd = (uint64_t)CEnd * 1000000;
+
+  if (strService.empty() || gJournalServices.find(strService) != gJournalServices.end())
+  {
+    uint32_t unService = ((!strService.empty())?gJournalServices[strService]:0);
+    journalSegments(segments);
+    // walk the newest segments first so the limit keeps the most recent entries
+    for (list<size_t>::reverse_iterator i = segments.rbegin(); entries.size() < unLimit && i != segments.rend(); i++)
+    {
+      int fdSegment;
+      stringstream ssPath;
+      ssPath << gstrData << "/journal/" << setw(10) << setfill('0') << (*i) << ".seg";
+      if ((fdSegment = open(ssPath.str().c_str(), O_RDONLY | O_CLOEXEC)) >= 0)
+      {
+        void *pMap;
+        if ((pMap = mmap(NULL, (JOURNAL_ENTRIES * sizeof(journalEntry)), PROT_READ, MAP_SHARED, fdSegment, 0)) != MAP_FAILED)
+        {
+          journalEntry *ptSegment = (journalEntry *)pMap;
+          journalHeader *ptHeader = (journalHeader *)pMap;
+          size_t unCount = ptHeader->unCount;
+          if (memcmp(ptHeader->szMagic, "SVCJRNL1", 8) == 0 && unCount > 0 && unCount < JOURNAL_ENTRIES && ptHeader->unFirst <= unEnd && ptHeader->unLast >= unStart)
+          {
+            size_t unHigh = unCount + 1, unLow = 1;
+            // entries are appended in time order so the end of the range is found by bisection
+            while (unLow < unHigh)
+            {
+              size_t unMiddle = unLow + ((unHigh - unLow) / 2);
+              if (ptSegment[unMiddle].unTime <= unEnd)
+              {
+                unLow = unMiddle + 1;
+              }
+              else
+              {
+                unHigh = unMiddle;
+              }
+            }
+            for (size_t j = unLow - 1; entries.size() < unLimit && j >= 1 && ptSegment[j].unTime >= unStart; j--)
+            {
+              if (strService.empty() || ptSegment[j].unService == unService)
+              {
+                Json *ptEntry = new Json;
+                journalFormat(ptSegment[j], ptEntry);
+                entries.push_front(ptEntry);
+              }
+            }
+          }
+          munmap(pMap, (JOURNAL_ENTRIES * sizeof(journalEntry)));
+        }
+        close(fdSegment);
+      }
+    }
+  }
+  ptEntries->l.splice(ptEntries->l.end(), entries);
+}
+// }}}
+// {{{ journalRecord()
+void journalRecord(const string strService, const string strEvent, const pid_t nPid, const int nStatus, const size_t unDuration)
+{
+  string strError;
+
+  if (gptJournal != NULL && ((journalHeader *)gptJournal)->unCount >= (JOURNAL_ENTRIES - 1) && !journalRotate(strError))
+  {
+    logMessage((string)"journalRecord()->journalRotate() error:  " + strError);
+  }
+  if (gptJournal != NULL || !gWatchers.empty())
+  {
+    journalEntry tEntry;
+    timespec tTime;
+    memset(&tEntry, 0, sizeof(journalEntry));
+    if (gJournalServices.find(strService) == gJournalServices.end())
+    {
+      ofstream outServices((gstrData + "/journal/services").c_str(), ios::app);
+      outServices << strService << endl;
+      outServices.close();
+      gJournalServices[strService] = gJournalNames.size();
+      gJournalNames.push_back(strService);
+    }
+    clock_gettime(CLOCK_REALTIME, &tTime);
+    tEntry.unTime = ((uint64_t)tTime.tv_sec * 1000000) + (tTime.tv_nsec / 1000);
+    tEntry.unService = gJournalServices[strService];
+    tEntry.nPid = nPid;
+    tEntry.nStatus = nStatus;
+    tEntry.unDuration = unDuration / 1000;
+    for (uint16_t i = 0; i < (sizeof(gstrJournalEvents) / sizeof(string)); i++)
+    {
+      if (gstrJournalEvents[i] == strEvent)
+      {
+        tEntry.usEvent = i;
+      }
+    }
+    if (gptJournal != NULL)
+    {
+      journalHeader *ptHeader = (journalHeader *)gptJournal;
+      gptJournal[ptHeader->unCount + 1] = tEntry;
+      if (ptHeader->unCount == 0)
+      {
+        ptHeader->unFirst = tEntry.unTime;
+      }
+      ptHeader->unLast = tEntry.unTime;
+      // the count is bumped last so a torn entry is never visible
+      __atomic_store_n(&(ptHeader->unCount), (ptHeader->unCount + 1), __ATOMIC_RELEASE);
+    }
+    watchPush(tEntry);
+  }
+}
+// }}}
+// {{{ journalRotate()
+bool journalRotate(string &strError)
+{
+  bool bResult = false;
+  int fdSegment;
+  list<size_t> segments;
+  stringstream ssError, ssPath;
+
+  journalClose();
+  gunJournalSegment++;
+  ssPath << gstrData << "/journal/" << setw(10) << setfill('0') << gunJournalSegment << ".seg";
+  if ((fdSegment = open(ssPath.str().c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0660)) >= 0)
+  {
+    if (ftruncate(fdSegment, (JOURNAL_ENTRIES * sizeof(journalEntry))) == 0)
+    {
+      void *pMap;
+      if ((pMap = mmap(NULL, (JOURNAL_ENTRIES * sizeof(journalEntry)), PROT_READ | PROT_WRITE, MAP_SHARED, fdSegment, 0)) != MAP_FAILED)
+      {
+        bResult = true;
+        gptJournal = (journalEntry *)pMap;
+        memcpy(((journalHeader *)gptJournal)->szMagic, "SVCJRNL1", 8);
+      }
+      else
+      {
+        ssError << "mmap(" << errno << ") error [" << ssPath.str() << "]:  " << strerror(errno);
+      }
+    }
+    else
+    {
+      ssError << "ftruncate(" << errno << ") error [" << ssPath.str() << "]:  " << strerror(errno);
+    }
+    close(fdSegment);
+  }
+  else
+  {
+    ssError << "open(" << errno << ") error [" << ssPath.str() << "]:  " << strerror(errno);
+  }
+  if (bResult)
+  {
+    journalSegments(segments);
+    while (segments.size() > JOURNAL_SEGMENTS)
+    {
+      ssPath.str("");
+      ssPath << gstrData << "/journal/" << setw(10) << setfill('0') << segments.front() << ".seg";
+      remove(ssPath.str().c_str());
+      segments.pop_front();
+    }
+  }
+  else
+  {
+    strError = ssError.str();
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ journalSegments()
+list<size_t> &journalSegments(list<size_t> &segments)
+{
+  list<string> files;
+
+  segments.clear();
+  gpCentral->file()->directoryList(gstrData + "/journal", files);
+  for (list<string>::iterator i = files.begin(); i != files.end(); i++)
+  {
+    if (i->size() == 14 && i->substr(10, 4) == ".seg")
+    {
+      segments.push_back(strtoul(i->substr(0, 10).c_str(), NULL, 10));
+    }
+  }
+  files.clear();
+  segments.sort();
+
+  return segments;
+}
+// }}}
+// }}}
+// {{{ log
+// {{{ logMessage()
+void logMessage(const string strMessage)
+{
+  if (gptLogWriter != NULL)
+  {
+    logPush(false, strMessage);
+  }
+  else
+  {
+    gpCentral->log(strMessage);
+  }
+}
+// }}}
+// {{{ logNotify()
+void logNotify(const string strMessage)
+{
+  if (gptLogWriter != NULL)
+  {
+    logPush(true, strMessage);
+  }
+  else
+  {
+    gpCentral->notify(strMessage);
+  }
+}
+// }}}
+// {{{ logPath()
+string &logPath(const time_t CTime, string &strPath)
+{
+  char szMonth[16];
+  struct tm tTime;
+
+  localtime_r(&CTime, &tTime);
+  strftime(szMonth, sizeof(szMonth), "%Y-%m", &tTime);
+  strPath = gstrData + (string)"/" + LOG_PREFIX + szMonth + (string)".log";
+
+  return strPath;
+}
+// }}}
+// {{{ logPush()
+bool logPush(const bool bNotify, const string strMessage)
+{
+  bool bResult = false, bFull = false;
+  size_t unTail = gunLogTail.load(memory_order_relaxed);
+
+  // producers reserve a slot by advancing the tail and publish it through its ready flag
+  while (!bResult && !bFull)
+  {
+    if ((unTail - gunLogHead.load(memory_order_acquire)) >= LOG_RECORDS)
+    {
+      bFull = true;
+    }
+    else if (gunLogTail.compare_exchange_weak(unTail, (unTail + 1), memory_order_acq_rel, memory_order_relaxed))
+    {
+      bResult = true;
+    }
+  }
+  if (bResult)
+  {
+    record *ptRecord = &gLogRecords[unTail % LOG_RECORDS];
+    ptRecord->bNotify = bNotify;
+    time(&(ptRecord->CTime));
+    ptRecord->strMessage = strMessage;
+    ptRecord->bReady.store(true, memory_order_release);
+  }
+  else
+  {
+    gunLogDropped++;
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ logStart()
+void logStart()
+{
+  if (gptNotifyWriter == NULL)
+  {
+    gbNotifyStop = false;
+    gptNotifyWriter = new thread(notifyWriter);
+  }
+  if (gptLogWriter == NULL)
+  {
+    gbLogStop = false;
+    gptLogWriter = new thread(logWriter);
+  }
+}
+// }}}
+// {{{ logStop()
+void logStop()
+{
+  if (gptLogWriter != NULL)
+  {
+    gbLogStop = true;
+    gptLogWriter->join();
+    delete gptLogWriter;
+    gptLogWriter = NULL;
+  }
+  if (gptNotifyWriter != NULL)
+  {
+    gNotifyMutex.lock();
+    gbNotifyStop = true;
+    gNotifyMutex.unlock();
+    gNotifyCondition.notify_one();
+    gptNotifyWriter->join();
+    delete gptNotifyWriter;
+    gptNotifyWriter = NULL;
+  }
+}
+// }}}
+// {{{ logWriter()
+void logWriter()
+{
+  char szLine[128], szTime[LOG_BATCH][32];
+  int fdLog = -1;
+  iovec tVector[(LOG_BATCH * 3) + 1];
+  list<string> notifies;
+  size_t unDropped = 0;
+  string strCurrent, strPath;
+  struct tm tTime;
+
+  threadSignals();
+  while (true)
+  {
+    size_t unHead = gunLogHead.load(memory_order_relaxed), unRecords = 0, unTail = gunLogTail.load(memory_order_acquire), unVector = 0;
+    time_t CTime;
+    // a reserved slot is consumed only once its producer has published it
+    while (unRecords < LOG_BATCH && (unHead + unRecords) != unTail && gLogRecords[(unHead + unRecords) % LOG_RECORDS].bReady.load(memory_order_acquire))
+    {
+      unRecords++;
+    }
+    if (unRecords == 0 && unDropped == gunLogDropped)
+    {
+      if (gbLogStop && unHead == unTail)
+      {
+        break;
+      }
+      usleep(((unHead == unTail)?50000:1000));
+      continue;
+    }
+    // {{{ rotate
+    time(&CTime);
+    logPath(CTime, strCurrent);
+    if (fdLog != -1)
+    {
+      struct stat tStat;
+      if (strPath != strCurrent || (fstat(fdLog, &tStat) == 0 && tStat.st_nlink == 0))
+      {
+        close(fdLog);
+        fdLog = -1;
+      }
+    }
+    if (fdLog == -1)
+    {
+      strPath = strCurrent;
+      if ((fdLog = open(strPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640)) == -1)
+      {
+        cerr << "logWriter()->open(" << errno << ") error [" << strPath << "]:  " << strerror(errno) << endl;
+      }
+    }
+    // }}}
+    // {{{ gather
+    for (size_t i = 0; i < unRecords; i++)
+    {
+      record *ptRecord = &gLogRecords[(unHead + i) % LOG_RECORDS];
+      // notifications are logged like any other record and also handed to the notifier
+      if (ptRecord->bNotify)
+      {
+        notifies.push_back(ptRecord->strMessage);
+      }
+      localtime_r(&(ptRecord->CTime), &tTime);
+      strftime(szTime[i], sizeof(szTime[i]), LOG_TIME, &tTime);
+      tVector[unVector].iov_base = szTime[i];
+      tVector[unVector++].iov_len = strlen(szTime[i]);
+      tVector[unVector].iov_base = (void *)ptRecord->strMessage.c_str();
+      tVector[unVector++].iov_len = ptRecord->strMessage.size();
+      tVector[unVector].iov_base = (void *)"\n";
+      tVector[unVector++].iov_len = 1;
+    }
+    if (unDropped != gunLogDropped)
+    {
+      size_t unCount = gunLogDropped - unDropped;
+      unDropped += unCount;
+      localtime_r(&CTime, &tTime);
+      strftime(szLine, sizeof(szLine), LOG_TIME, &tTime);
+      snprintf(szLine + strlen(szLine), sizeof(szLine) - strlen(szLine), "logWriter() [%zu]:  Dropped records because the log queue was full.\n", unCount);
+      tVector[unVector].iov_base = szLine;
+      tVector[unVector++].iov_len = strlen(szLine);
+    }
+    // }}}
+    // {{{ write
+    if (fdLog != -1 && unVector > 0)
+    {
+      iovec *ptVector = tVector;
+      ssize_t nReturn;
+      while (unVector > 0 && ((nReturn = writev(fdLog, ptVector, unVector)) > 0 || (nReturn < 0 && errno == EINTR)))
+      {
+        while (nReturn > 0 && unVector > 0)
+        {
+          if ((size_t)nReturn >= ptVector->iov_len)
+          {
+            nReturn -= ptVector->iov_len;
+            ptVector++;
+            unVector--;
+          }
+          else
+          {
+            ptVector->iov_base = (char *)ptVector->iov_base + nReturn;
+            ptVector->iov_len -= nReturn;
+            nReturn = 0;
+          }
+        }
+      }
+      gunLogBatches++;
+    }
+    gunLogWritten += unRecords;
+    // }}}
+    for (size_t i = 0; i < unRecords; i++)
+    {
+      gLogRecords[(unHead + i) % LOG_RECORDS].bReady.store(false, memory_order_relaxed);
+    }
+    gunLogHead.store((unHead + unRecords), memory_order_release);
+    // {{{ notify
+    while (!notifies.empty())
+    {
+      notifyPush(notifies.front());
+      notifies.pop_front();
+    }
+    // }}}
+  }
+  if (fdLog != -1)
+  {
+    close(fdLog);
+  }
+}
+// }}}
+// }}}
+// {{{ metrics
+// {{{ metricsAppend()
+void metricsAppend(const char *pszFormat, ...)
+{
+  char szLine[1024];
+  int nLength;
+  va_list args;
+
+  va_start(args, pszFormat);
+  nLength = vsnprintf(szLine, sizeof(szLine), pszFormat, args);
+  va_end(args);
+  if (nLength > 0)
+  {
+    gstrMetricsBuffer.append(szLine, (((size_t)nLength < sizeof(szLine))?(size_t)nLength:(sizeof(szLine) - 1)));
+  }
+}
+// }}}
+// {{{ metricsListen()
+bool metricsListen(const string strAddress, int &fdMetrics, string &strError)
+{
+  bool bResult = false;
+  int nOn = 1;
+  stringstream ssError;
+
+  if (strAddress[0] == '/')
+  {
+    if ((fdMetrics = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0)
+    {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(sockaddr_un));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, strAddress.c_str(), sizeof(addr.sun_path) - 1);
+      remove(strAddress.c_str());
+      bResult = (bind(fdMetrics, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0);
+    }
+  }
+  else
+  {
+    size_t unPosition = strAddress.rfind(":");
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(atoi(((unPosition != string::npos)?strAddress.substr(unPosition + 1):strAddress).c_str()));
+    if (unPosition != string::npos && inet_pton(AF_INET, strAddress.substr(0, unPosition).c_str(), &addr.sin_addr) != 1)
+    {
+      errno = EINVAL;
+    }
+    else if ((fdMetrics = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0)
+    {
+      setsockopt(fdMetrics, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn));
+      bResult = (bind(fdMetrics, (sockaddr *)&addr, sizeof(sockaddr_in)) == 0);
+    }
+  }
+  if (bResult && listen(fdMetrics, SOMAXCONN) != 0)
+  {
+    bResult = false;
+  }
+  if (!bResult)
+  {
+    ssError << "socket(" << errno << ") error [" << strAddress << "]:  " << strerror(errno);
+    strError = ssError.str();
+    if (fdMetrics != -1)
+    {
+      close(fdMetrics);
+      fdMetrics = -1;
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ metricsRender()
+void metricsRender(const size_t unLag)
+{
+  char szBuffer[1024], szPath[64];
+  const double dBounds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+  const size_t unBounds = sizeof(dBounds) / sizeof(double);
+  long lPageSize = sysconf(_SC_PAGESIZE), lTicks = sysconf(_SC_CLK_TCK);
+
+  gstrMetricsBuffer.clear();
+  // {{{ services
+  metricsAppend("# HELP svcmgr_service_active Whether the service is running.\n# TYPE svcmgr_service_active gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_active{service=\"%s\"} %d\n", i->first.c_str(), ((gServiceHot[i->second->unId].nPid != -1)?1:0));
+  }
+  metricsAppend("# HELP svcmgr_service_listening Whether the service is waiting for socket activation.\n# TYPE svcmgr_service_listening gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_listening{service=\"%s\"} %d\n", i->first.c_str(), ((gServiceHot[i->second->unId].nPid == -1 && !i->second->listens.empty())?1:0));
+  }
+  metricsAppend("# HELP svcmgr_service_healthy Whether the last health checks of the service passed.\n# TYPE svcmgr_service_healthy gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    if (!i->second->strHealthCheckType.empty() && gServiceHot[i->second->unId].nPid != -1 && i->second->strHealth != "unknown")
+    {
+      metricsAppend("svcmgr_service_healthy{service=\"%s\"} %d\n", i->first.c_str(), ((i->second->strHealth == "healthy")?1:0));
+    }
+  }
+  metricsAppend("# HELP svcmgr_service_starts_total Number of times the service was started.\n# TYPE svcmgr_service_starts_total counter\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_starts_total{service=\"%s\"} %zu\n", i->first.c_str(), i->second->unStarts);
+  }
+  metricsAppend("# HELP svcmgr_service_restarts_total Number of times the service was restarted after a crash or failed health check.\n# TYPE svcmgr_service_restarts_total counter\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_restarts_total{service=\"%s\"} %zu\n", i->first.c_str(), i->second->unRestarts);
+  }
+  metricsAppend("# HELP svcmgr_service_last_exit_code Exit code of the last instance where termination by a signal is 128 plus the signal.\n# TYPE svcmgr_service_last_exit_code gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    if (i->second->nExitStatus != -1)
+    {
+      metricsAppend("svcmgr_service_last_exit_code{service=\"%s\"} %d\n", i->first.c_str(), i->second->nExitStatus);
+    }
+  }
+  metricsAppend("# HELP svcmgr_service_start_duration_seconds Duration of the last start.\n# TYPE svcmgr_service_start_duration_seconds gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_start_duration_seconds{service=\"%s\"} %.6f\n", i->first.c_str(), ((double)i->second->unStartDuration / 1000000));
+  }
+  metricsAppend("# HELP svcmgr_service_stop_duration_seconds Duration of the last stop.\n# TYPE svcmgr_service_stop_duration_seconds gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    metricsAppend("svcmgr_service_stop_duration_seconds{service=\"%s\"} %.6f\n", i->first.c_str(), ((double)i->second->unStopDuration / 1000000));
+  }
+  metricsAppend("# HELP svcmgr_service_cpu_seconds_total User and system CPU time of the main process.\n# TYPE svcmgr_service_cpu_seconds_total counter\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    int fdStat;
+    ssize_t nReturn;
+    snprintf(szPath, sizeof(szPath), "/proc/%d/stat", gServiceHot[i->second->unId].nPid);
+    if (gServiceHot[i->second->unId].nPid != -1 && (fdStat = open(szPath, O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+      if ((nReturn = read(fdStat, szBuffer, sizeof(szBuffer) - 1)) > 0)
+      {
+        char *pszField;
+        szBuffer[nReturn] = '\0';
+        if ((pszField = strrchr(szBuffer, ')')) != NULL)
+        {
+          unsigned long ulSystem = 0, ulUser = 0;
+          // utime and stime are the 14th and 15th fields where the 3rd field follows the command
+          if (sscanf(pszField + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ulUser, &ulSystem) == 2)
+          {
+            metricsAppend("svcmgr_service_cpu_seconds_total{service=\"%s\"} %.2f\n", i->first.c_str(), ((double)(ulUser + ulSystem) / lTicks));
+          }
+        }
+      }
+      close(fdStat);
+    }
+  }
+  metricsAppend("# HELP svcmgr_service_resident_memory_bytes Resident set size of the main process.\n# TYPE svcmgr_service_resident_memory_bytes gauge\n");
+  for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+  {
+    int fdStatm;
+    ssize_t nReturn;
+    snprintf(szPath, sizeof(szPath), "/proc/%d/statm", gServiceHot[i->second->unId].nPid);
+    if (gServiceHot[i->second->unId].nPid != -1 && (fdStatm = open(szPath, O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+      if ((nReturn = read(fdStatm, szBuffer, sizeof(szBuffer) - 1)) > 0)
+      {
+        unsigned long ulResident = 0;
+        szBuffer[nReturn] = '\0';
+        if (sscanf(szBuffer, "%*u %lu", &ulResident) == 1)
+        {
+          metricsAppend("svcmgr_service_resident_memory_bytes{service=\"%s\"} %lu\n", i->first.c_str(), (ulResident * lPageSize));
+        }
+      }
+      close(fdStatm);
+    }
+  }
+  // }}}
+  // {{{ daemon
+  metricsAppend("# HELP svcmgr_loop_lag_seconds Busy time of the last event loop iteration.\n# TYPE svcmgr_loop_lag_seconds gauge\nsvcmgr_loop_lag_seconds %.6f\n", ((double)unLag / 1000000000));
+  metricsAppend("# HELP svcmgr_loop_stalls_total Number of event loop iterations exceeding the stall threshold.\n# TYPE svcmgr_loop_stalls_total counter\nsvcmgr_loop_stalls_total %zu\n", gunStalls);
+  metricsAppend("# HELP svcmgr_log_records_total Number of log records written by the log writer.\n# TYPE svcmgr_log_records_total counter\nsvcmgr_log_records_total %zu\n", gunLogWritten.load());
+  metricsAppend("# HELP svcmgr_log_dropped_total Number of log records dropped because the log queue was full.\n# TYPE svcmgr_log_dropped_total counter\nsvcmgr_log_dropped_total %zu\n", gunLogDropped.load());
+  metricsAppend("# HELP svcmgr_log_queue_depth Number of log records waiting for the log writer.\n# TYPE svcmgr_log_queue_depth gauge\nsvcmgr_log_queue_depth %zu\n", (gunLogTail - gunLogHead));
+  metricsAppend("# HELP svcmgr_notifications_received_total Number of notifications received by the aggregator.\n# TYPE svcmgr_notifications_received_total counter\nsvcmgr_notifications_received_total %zu\n", gunNotifyReceived.load());
+  metricsAppend("# HELP svcmgr_notifications_sent_total Number of notification digests emailed.\n# TYPE svcmgr_notifications_sent_total counter\nsvcmgr_notifications_sent_total %zu\n", gunNotifySent.load());
+  metricsAppend("# HELP svcmgr_notifications_suppressed_total Number of notifications withheld by the per key or global rate caps.\n# TYPE svcmgr_notifications_suppressed_total counter\nsvcmgr_notifications_suppressed_total %zu\n", gunNotifySuppressed.load());
+  metricsAppend("# HELP svcmgr_cores_compressed_total Number of core dumps collected and compressed.\n# TYPE svcmgr_cores_compressed_total counter\nsvcmgr_cores_compressed_total %zu\n", gunCoresCompressed.load());
+  metricsAppend("# HELP svcmgr_cores_removed_total Number of core dumps removed to honor the quotas.\n# TYPE svcmgr_cores_removed_total counter\nsvcmgr_cores_removed_total %zu\n", gunCoresRemoved.load());
+  metricsAppend("# HELP svcmgr_duration_seconds Duration of event loop iterations, requests, and instrumented operations.\n# TYPE svcmgr_duration_seconds histogram\n");
+  for (map<string, histogram>::iterator i = gHistograms.begin(); i != gHistograms.end(); i++)
+  {
+    size_t unBucket = 0, unCumulative = 0;
+    for (size_t j = 0; j < unBounds; j++)
+    {
+      while (unBucket < HISTOGRAM_BUCKETS && statsBucketMax(unBucket) <= (size_t)(dBounds[j] * 1000000))
+      {
+        unCumulative += i->second.buckets[unBucket++];
+      }
+      metricsAppend("svcmgr_duration_seconds_bucket{operation=\"%s\",le=\"%g\"} %zu\n", i->first.c_str(), dBounds[j], unCumulative);
+    }
+    metricsAppend("svcmgr_duration_seconds_bucket{operation=\"%s\",le=\"+Inf\"} %zu\n", i->first.c_str(), i->second.unCount);
+    metricsAppend("svcmgr_duration_seconds_sum{operation=\"%s\"} %.6f\n", i->first.c_str(), ((double)i->second.unSum / 1000000));
+    metricsAppend("svcmgr_duration_seconds_count{operation=\"%s\"} %zu\n", i->first.c_str(), i->second.unCount);
+  }
+  // }}}
+}
+// }}}
+// }}}
+// {{{ notify
+// {{{ notifyFlush()
+void notifyFlush(const bool bForce)
+{
+  bool bEmail = false;
+  list<string> suppressed;
+  map<string, notification> notifications;
+  size_t unDelivered = 0, unSuppressed = 0, unTotal = 0;
+  stringstream ssDigest;
+  time_t CNow;
+
+  time(&CNow);
+  {
+    unique_lock<mutex> lock(gNotifyMutex);
+    if ((CNow - gCNotifyHour) >= 3600)
+    {
+      gCNotifyHour = CNow;
+      gunNotifyDigests = 0;
+      gNotifyKeys.clear();
+    }
+    if (!gNotifications.empty() && (bForce || (size_t)(CNow - gCNotifyWindow) >= gunNotifyWindow))
+    {
+      notifications.swap(gNotifications);
+      for (map<string, notification>::iterator i = notifications.begin(); i != notifications.end(); i++)
+      {
+        unTotal += i->second.unCount;
+        if (gNotifyKeys[i->first] < gunNotifyKeyLimit)
+        {
+          gNotifyKeys[i->first]++;
+          unDelivered += i->second.unCount;
+        }
+        else
+        {
+          unSuppressed += i->second.unCount;
+          ssDigest.str("");
+          ssDigest << i->second.unCount << " x " << i->second.strLast;
+          suppressed.push_back(ssDigest.str());
+          i->second.unCount = 0;
+        }
+      }
+      if (unDelivered > 0)
+      {
+        bEmail = (++gunNotifyDigests <= gunNotifyLimit);
+      }
+    }
+  }
+  if (unTotal > 0)
+  {
+    ssDigest.str("");
+    if (notifications.size() == 1 && unTotal == 1)
+    {
+      ssDigest << notifications.begin()->second.strFirst;
+    }
+    else
+    {
+      ssDigest << "Notification digest of " << unTotal << " notifications across " << notifications.size() << " distinct messages during the last " << gunNotifyWindow << " seconds." << endl;
+      for (map<string, notification>::iterator i = notifications.begin(); i != notifications.end(); i++)
+      {
+        if (i->second.unCount > 0)
+        {
+          ssDigest << endl << i->second.strFirst;
+          if (i->second.unCount > 1)
+          {
+            ssDigest << endl << "  repeated " << i->second.unCount << " times through " << (i->second.CLast - i->second.CFirst) << " seconds, most recently:  " << i->second.strLast;
+          }
+        }
+      }
+      if (!suppressed.empty())
+      {
+        ssDigest << endl << endl << "Suppressed " << unSuppressed << " notifications exceeding " << gunNotifyKeyLimit << " deliveries per hour:";
+        for (list<string>::iterator i = suppressed.begin(); i != suppressed.end(); i++)
+        {
+          ssDigest << endl << "  " << (*i);
+        }
+      }
+    }
+    gunNotifySuppressed += unSuppressed;
+    if (bEmail)
+    {
+      gunNotifySent++;
+      gpCentral->notify(ssDigest.str());
+    }
+    else
+    {
+      stringstream ssMessage;
+      if (unDelivered > 0)
+      {
+        gunNotifySuppressed += unDelivered;
+        ssMessage << "notifyFlush() [" << gunNotifyLimit << " per hour]:  Logged the digest instead of emailing it.  ";
+      }
+      ssMessage << ssDigest.str();
+      logMessage(ssMessage.str());
+    }
+  }
+}
+// }}}
+// {{{ notifyKey()
+string &notifyKey(const string strMessage, string &strKey)
+{
+  strKey.clear();
+  for (size_t i = 0; i < strMessage.size(); i++)
+  {
+    if (isdigit(strMessage[i]))
+    {
+      if (strKey.empty() || strKey[strKey.size() - 1] != '#')
+      {
+        strKey += '#';
+      }
+    }
+    else
+    {
+      strKey += strMessage[i];
+    }
+  }
+
+  return strKey;
+}
+// }}}
+// {{{ notifyPush()
+void notifyPush(const string strMessage)
+{
+  string strKey;
+  time_t CNow;
+
+  notifyKey(strMessage, strKey);
+  time(&CNow);
+  gunNotifyReceived++;
+  gNotifyMutex.lock();
+  if (gNotifications.empty())
+  {
+    gCNotifyWindow = CNow;
+  }
+  if (gNotifications.find(strKey) == gNotifications.end())
+  {
+    gNotifications[strKey].unCount = 0;
+    gNotifications[strKey].CFirst = CNow;
+    gNotifications[strKey].strFirst = strMessage;
+  }
+  gNotifications[strKey].unCount++;
+  gNotifications[strKey].CLast = CNow;
+  gNotifications[strKey].strLast = strMessage;
+  gNotifyMutex.unlock();
+}
+// }}}
+// {{{ notifyWriter()
+void notifyWriter()
+{
+  bool bExit = false;
+
+  threadSignals();
+  while (!bExit)
+  {
+    {
+      unique_lock<mutex> lock(gNotifyMutex);
+      gNotifyCondition.wait_for(lock, chrono::seconds(1), []{return gbNotifyStop;});
+      bExit = gbNotifyStop;
+    }
+    notifyFlush(bExit);
+  }
+}
+// }}}
+// }}}
+// {{{ process
+// {{{ processChildren()
+list<pid_t> &processChildren(const pid_t nPid, list<pid_t> &children)
+{
+  DIR *ptDir;
+  stringstream ssProc;
+
+  ssProc << "/proc/" << nPid << "/task";
+  if ((ptDir = opendir(ssProc.str().c_str())) != NULL)
+  {
+    struct dirent *ptEntry;
+    while ((ptEntry = readdir(ptDir)) != NULL)
+    {
+      if (ptEntry->d_name[0] != '.')
+      {
+        pid_t nChild;
+        ifstream inChildren((ssProc.str() + (string)"/" + ptEntry->d_name + (string)"/children").c_str());
+        while (inChildren >> nChild)
+        {
+          children.push_back(nChild);
+        }
+        inChildren.close();
+      }
+    }
+    closedir(ptDir);
+  }
+
+  return children;
+}
+// }}}
+// {{{ processCommand()
+string &processCommand(const pid_t nPid, string &strCommand)
+{
+  stringstream ssProc;
+
+  strCommand.clear();
+  ssProc << "/proc/" << nPid << "/cmdline";
+  ifstream inCommand(ssProc.str().c_str());
+  if (inCommand)
+  {
+    getline(inCommand, strCommand, '\0');
+  }
+  inCommand.close();
+
+  return strCommand;
+}
+// }}}
+// {{{ processDiagnose()
+void processDiagnose(const string strService, const pid_t nPid, const string strPath, const string strModes)
+{
+  list<pid_t> processes;
+  ofstream outDiag((strPath + ".txt").c_str());
+  stringstream ssMessage;
+
+  threadSignals();
+  // {{{ snapshot
+  processes.push_back(nPid);
+  for (list<pid_t>::iterator i = processes.begin(); i != processes.end(); i++)
+  {
+    processChildren(*i, processes);
+  }
+  outDiag << "service " << strService << endl << "pid " << nPid << endl;
+  for (list<pid_t>::iterator i = processes.begin(); i != processes.end(); i++)
+  {
+    DIR *ptDir;
+    size_t unFds = 0;
+    string strLine;
+    stringstream ssProc;
+    ssProc << "/proc/" << (*i);
+    outDiag << endl << "== process " << (*i) << " ==" << endl;
+    ifstream inStatus((ssProc.str() + "/status").c_str());
+    while (getline(inStatus, strLine))
+    {
+      outDiag << strLine << endl;
+    }
+    inStatus.close();
+    if ((ptDir = opendir((ssProc.str() + "/fd").c_str())) != NULL)
+    {
+      struct dirent *ptEntry;
+      while ((ptEntry = readdir(ptDir)) != NULL)
+      {
+        if (ptEntry->d_name[0] != '.')
+        {
+          unFds++;
+        }
+      }
+      closedir(ptDir);
+    }
+    outDiag << "FDs:\t" << unFds << endl;
+    if ((ptDir = opendir((ssProc.str() + "/task").c_str())) != NULL)
+    {
+      struct dirent *ptEntry;
+      while ((ptEntry = readdir(ptDir)) != NULL)
+      {
+        if (ptEntry->d_name[0] != '.')
+        {
+          string strTask = ssProc.str() + (string)"/task/" + ptEntry->d_name;
+          outDiag << "-- task " << ptEntry->d_name << " --" << endl;
+          ifstream inStat((strTask + "/stat").c_str());
+          if (getline(inStat, strLine))
+          {
+            outDiag << "stat:  " << strLine << endl;
+          }
+          inStat.close();
+          ifstream inWchan((strTask + "/wchan").c_str());
+          if (getline(inWchan, strLine))
+          {
+            outDiag << "wchan:  " << strLine << endl;
+          }
+          inWchan.close();
+          // the kernel stack is only readable with CAP_SYS_ADMIN
+          ifstream inStack((strTask + "/stack").c_str());
+          while (getline(inStack, strLine))
+          {
+            outDiag << "stack:  " << strLine << endl;
+          }
+          inStack.close();
+        }
+      }
+      closedir(ptDir);
+    }
+  }
+  outDiag.close();
+  // }}}
+  // {{{ gcore
+  if (strModes.find("gcore") != string::npos)
+  {
+    pid_t nCore;
+    string strCore = strPath + ".core", strPid = to_string(nPid);
+    // the child is registered before it can exit so processReap() leaves it to the waitpid() below
+    gWorkerMutex.lock();
+    if ((nCore = fork()) == 0)
+    {
+      int fdNull = open("/dev/null", O_RDWR);
+      dup2(fdNull, 0);
+      dup2(fdNull, 1);
+      dup2(fdNull, 2);
+      execlp("gcore", "gcore", "-o", strCore.c_str(), strPid.c_str(), (char *)NULL);
+      _exit(127);
+    }
+    else if (nCore > 0)
+    {
+      gWorkerPids.push_back(nCore);
+    }
+    gWorkerMutex.unlock();
+    if (nCore > 0)
+    {
+      while (waitpid(nCore, NULL, 0) < 0 && errno == EINTR);
+      gWorkerMutex.lock();
+      gWorkerPids.remove(nCore);
+      gWorkerMutex.unlock();
+    }
+  }
+  // }}}
+  // {{{ sigquit
+  if (strModes.find("sigquit") != string::npos)
+  {
+    kill(nPid, SIGQUIT);
+  }
+  // }}}
+  ssMessage << "processDiagnose() [" << strService << "," << nPid << "," << strPath << "]:  Captured hang diagnostics.";
+  logMessage(ssMessage.str());
+  gunDiagnosing--;
+}
+// }}}
+// {{{ processReap()
+void processReap()
+{
+  list<pid_t> children;
+  stringstream ssMessage;
+
+  processChildren(getpid(), children);
+  for (list<pid_t>::iterator i = children.begin(); i != children.end(); i++)
+  {
+    if (gPids.find(*i) == gPids.end() && processState(*i) == 'Z')
+    {
+      bool bWorker;
+      int nStatus;
+      gWorkerMutex.lock();
+      bWorker = (find(gWorkerPids.begin(), gWorkerPids.end(), (*i)) != gWorkerPids.end());
+      gWorkerMutex.unlock();
+      if (!bWorker && waitpid((*i), &nStatus, WNOHANG) == (*i))
+      {
+        ssMessage.str("");
+        ssMessage << "processReap()->waitpid() [" << (*i) << "]:  Reaped orphaned process which ";
+        if (WIFEXITED(nStatus))
+        {
+          ssMessage << "exited with a status of " << WEXITSTATUS(nStatus) << ".";
+        }
+        else
+        {
+          ssMessage << "was terminated by signal " << WTERMSIG(nStatus) << ".";
+        }
+        logMessage(ssMessage.str());
+      }
+    }
+  }
+}
+// }}}
+// {{{ processService()
+string &processService(const pid_t nPid, string &strService)
+{
+  string strVariable;
+  stringstream ssProc;
+
+  strService.clear();
+  ssProc << "/proc/" << nPid << "/environ";
+  ifstream inEnvironment(ssProc.str().c_str());
+  while (strService.empty() && getline(inEnvironment, strVariable, '\0'))
+  {
+    if (strVariable.size() > 15 && strVariable.substr(0, 15) == "SVCMGR_SERVICE=")
+    {
+      strService = strVariable.substr(15, strVariable.size() - 15);
+    }
+  }
+  inEnvironment.close();
+
+  return strService;
+}
+// }}}
+// {{{ processStart()
+size_t processStart(const pid_t nPid)
+{
+  size_t unPosition, unStart = 0;
+  string strLine;
+  stringstream ssProc;
+
+  ssProc << "/proc/" << nPid << "/stat";
+  ifstream inStat(ssProc.str().c_str());
+  if (getline(inStat, strLine) && (unPosition = strLine.rfind(")")) != string::npos)
+  {
+    string strField;
+    stringstream ssStat(strLine.substr(unPosition + 1));
+    // starttime is the 22nd field where the 3rd field follows the command
+    for (int i = 3; i <= 22 && ssStat >> strField; i++)
+    {
+      if (i == 22)
+      {
+        unStart = strtoul(strField.c_str(), NULL, 10);
+      }
+    }
+  }
+  inStat.close();
+
+  return unStart;
+}
+// }}}
+// {{{ processState()
+char processState(const pid_t nPid)
+{
+  char cState = '\0';
+  size_t unPosition;
+  string strLine;
+  stringstream ssProc;
+
+  ssProc << "/proc/" << nPid << "/stat";
+  ifstream inStat(ssProc.str().c_str());
+  if (getline(inStat, strLine) && (unPosition = strLine.rfind(")")) != string::npos && (unPosition + 2) < strLine.size())
+  {
+    cState = strLine[unPosition + 2];
+  }
+  inStat.close();
+
+  return cState;
+}
+// }}}
+// {{{ processTrack()
+void processTrack(service *ptService, pid_t &nField, const pid_t nPid)
+{
+  unordered_map<pid_t, service *>::iterator i;
+
+  if (nField != -1 && (i = gPids.find(nField)) != gPids.end() && i->second == ptService)
+  {
+    gPids.erase(i);
+  }
+  nField = nPid;
+  if (nPid != -1)
+  {
+    gPids[nPid] = ptService;
+  }
+}
+// }}}
+// }}}
+// {{{ request
+// {{{ requestEscape()
+string &requestEscape(string &strBuffer, const char *pszData, const size_t unSize)
+{
+  strBuffer.push_back('"');
+  for (size_t i = 0; i < unSize; i++)
+  {
+    unsigned char cChar = pszData[i];
+    if (cChar == '"' || cChar == '\\')
+    {
+      strBuffer.push_back('\\');
+      strBuffer.push_back(cChar);
+    }
+    else if (cChar == '\n')
+    {
+      strBuffer.append("\\n");
+    }
+    else if (cChar == '\r')
+    {
+      strBuffer.append("\\r");
+    }
+    else if (cChar == '\t')
+    {
+      strBuffer.append("\\t");
+    }
+    else if (cChar < 0x20)
+    {
+      char szHex[8];
+      snprintf(szHex, sizeof(szHex), "\\u%04x", cChar);
+      strBuffer.append(szHex);
+    }
+    else
+    {
+      strBuffer.push_back(cChar);
+    }
+  }
+  strBuffer.push_back('"');
+
+  return strBuffer;
+}
+// }}}
+// {{{ requestIs()
+bool requestIs(const requestValue &tValue, const char *pszText)
+{
+  size_t unSize = strlen(pszText);
+
+  return (tValue.pszData != NULL && tValue.unSize == unSize && memcmp(tValue.pszData, pszText, unSize) == 0);
+}
+// }}}
+// {{{ requestNumber()
+long requestNumber(const requestValue &tValue, const long lDefault)
+{
+  long lResult = lDefault;
+
+  if (tValue.pszData != NULL && tValue.unSize > 0 && tValue.unSize < 32)
+  {
+    char szNumber[32];
+    memcpy(szNumber, tValue.pszData, tValue.unSize);
+    szNumber[tValue.unSize] = '\0';
+    lResult = strtol(szNumber, NULL, 10);
+  }
+
+  return lResult;
+}
+// }}}
+// {{{ requestParse()
+bool requestParse(char *pszLine, const size_t unSize, request &tRequest)
+{
+  bool bDone = false, bFirst = true, bResult = true;
+  size_t unPosition = 0;
+
+  memset(&tRequest, 0, sizeof(request));
+  while (unPosition < unSize && isspace(pszLine[unPosition]))
+  {
+    unPosition++;
+  }
+  if (unPosition < unSize && pszLine[unPosition] == '{')
+  {
+    unPosition++;
+  }
+  else
+  {
+    bResult = false;
+  }
+  // a flat object of scalars is decoded in place and anything else is left to the Json fallback
+  while (bResult && !bDone)
+  {
+    size_t unKey, unKeySize = 0;
+    requestValue tValue = {NULL, 0, false};
+    while (unPosition < unSize && isspace(pszLine[unPosition]))
+    {
+      unPosition++;
+    }
+    if (bFirst && unPosition < unSize && pszLine[unPosition] == '}')
+    {
+      bDone = true;
+      unPosition++;
+      continue;
+    }
+    bFirst = false;
+    // {{{ key
+    if (unPosition < unSize && pszLine[unPosition] == '"')
+    {
+      unKey = ++unPosition;
+      while (unPosition < unSize && pszLine[unPosition] != '"')
+      {
+        unPosition += ((pszLine[unPosition] == '\\')?2:1);
+      }
+      if (unPosition < unSize)
+      {
+        unKeySize = unPosition - unKey;
+        unPosition++;
+      }
+      else
+      {
+        bResult = false;
+      }
+    }
+    else
+    {
+      bResult = false;
+    }
+    while (bResult && unPosition < unSize && isspace(pszLine[unPosition]))
+    {
+      unPosition++;
+    }
+    if (bResult && (unPosition >= unSize || pszLine[unPosition++] != ':'))
+    {
+      bResult = false;
+    }
+    while (bResult && unPosition < unSize && isspace(pszLine[unPosition]))
+    {
+      unPosition++;
+    }
+    // }}}
+    // {{{ value
+    if (bResult && unPosition < unSize && pszLine[unPosition] == '"')
+    {
+      size_t unValue = ++unPosition;
+      while (unPosition < unSize && pszLine[unPosition] != '"')
+      {
+        unPosition += ((pszLine[unPosition] == '\\')?2:1);
+      }
+      if (unPosition < unSize)
+      {
+        tValue.bString = true;
+        tValue.pszData = pszLine + unValue;
+        tValue.unSize = unPosition - unValue;
+        unPosition++;
+      }
+      else
+      {
+        bResult = false;
+      }
+    }
+    else if (bResult && unPosition < unSize && (pszLine[unPosition] == '-' || isalnum(pszLine[unPosition])))
+    {
+      size_t unValue = unPosition;
+      while (unPosition < unSize && (pszLine[unPosition] == '-' || pszLine[unPosition] == '+' || pszLine[unPosition] == '.' || isalnum(pszLine[unPosition])))
+      {
+        unPosition++;
+      }
+      tValue.pszData = pszLine + unValue;
+      tValue.unSize = unPosition - unValue;
+    }
+    else
+    {
+      bResult = false;
+    }
+    // }}}
+    if (bResult)
+    {
+      bool bReply = ((unKeySize == 5 && memcmp(pszLine + unKey, "Error", 5) == 0) || (unKeySize == 8 && memcmp(pszLine + unKey, "Response", 8) == 0) || (unKeySize == 6 && memcmp(pszLine + unKey, "Status", 6) == 0));
+      requestValue *ptField = NULL;
+      if (unKeySize == 5 && memcmp(pszLine + unKey, "Async", 5) == 0)
+      {
+        ptField = &tRequest.tAsync;
+      }
+      else if (unKeySize == 3 && memcmp(pszLine + unKey, "End", 3) == 0)
+      {
+        ptField = &tRequest.tEnd;
+      }
+      else if (unKeySize == 8 && memcmp(pszLine + unKey, "Function", 8) == 0)
+      {
+        ptField = &tRequest.tFunction;
+      }
+      else if (unKeySize == 3 && memcmp(pszLine + unKey, "Job", 3) == 0)
+      {
+        ptField = &tRequest.tJob;
+      }
+      else if (unKeySize == 5 && memcmp(pszLine + unKey, "Limit", 5) == 0)
+      {
+        ptField = &tRequest.tLimit;
+      }
+      else if (unKeySize == 7 && memcmp(pszLine + unKey, "Service", 7) == 0)
+      {
+        ptField = &tRequest.tService;
+      }
+      else if (unKeySize == 5 && memcmp(pszLine + unKey, "Start", 5) == 0)
+      {
+        ptField = &tRequest.tStart;
+      }
+      if (ptField != NULL)
+      {
+        *ptField = tValue;
+      }
+      // unknown keys are echoed back as they arrived except those the reply writes itself
+      else if (!bReply && tRequest.unExtras < REQUEST_EXTRAS)
+      {
+        tRequest.extras[tRequest.unExtras][0].pszData = pszLine + unKey - 1;
+        tRequest.extras[tRequest.unExtras][0].unSize = unKeySize + 2;
+        tRequest.extras[tRequest.unExtras][1].pszData = tValue.pszData - ((tValue.bString)?1:0);
+        tRequest.extras[tRequest.unExtras][1].unSize = tValue.unSize + ((tValue.bString)?2:0);
+        tRequest.unExtras++;
+      }
+      else if (!bReply)
+      {
+        bResult = false;
+      }
+    }
+    while (bResult && unPosition < unSize && isspace(pszLine[unPosition]))
+    {
+      unPosition++;
+    }
+    if (bResult && unPosition < unSize && pszLine[unPosition] == '}')
+    {
+      bDone = true;
+      unPosition++;
+    }
+    else if (!bResult || unPosition >= unSize || pszLine[unPosition++] != ',')
+    {
+      bResult = false;
+    }
+  }
+  while (bResult && unPosition < unSize)
+  {
+    if (!isspace(pszLine[unPosition++]))
+    {
+      bResult = false;
+    }
+  }
+  // the line is only rewritten once it is known not to need the Json fallback
+  if (bResult)
+  {
+    requestValue *fields[7] = {&tRequest.tAsync, &tRequest.tEnd, &tRequest.tFunction, &tRequest.tJob, &tRequest.tLimit, &tRequest.tService, &tRequest.tStart};
+    for (size_t i = 0; i < 7; i++)
+    {
+      if (fields[i]->bString)
+      {
+        requestUnescape(pszLine + (fields[i]->pszData - pszLine), fields[i]->unSize);
+      }
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ requestEcho()
+string &requestEcho(const request &tRequest, string &strBuffer)
+{
+  const requestValue *fields[7] = {&tRequest.tAsync, &tRequest.tEnd, &tRequest.tFunction, &tRequest.tJob, &tRequest.tLimit, &tRequest.tService, &tRequest.tStart};
+  const char *names[7] = {"Async", "End", "Function", "Job", "Limit", "Service", "Start"};
+
+  for (size_t i = 0; i < 7; i++)
+  {
+    if (fields[i]->pszData != NULL)
+    {
+      strBuffer.push_back('"');
+      strBuffer.append(names[i]);
+      strBuffer.append("\":");
+      if (fields[i]->bString)
+      {
+        requestEscape(strBuffer, fields[i]->pszData, fields[i]->unSize);
+      }
+      else
+      {
+        strBuffer.append(fields[i]->pszData, fields[i]->unSize);
+      }
+      strBuffer.push_back(',');
+    }
+  }
+  for (size_t i = 0; i < tRequest.unExtras; i++)
+  {
+    strBuffer.append(tRequest.extras[i][0].pszData, tRequest.extras[i][0].unSize);
+    strBuffer.push_back(':');
+    strBuffer.append(tRequest.extras[i][1].pszData, tRequest.extras[i][1].unSize);
+    strBuffer.push_back(',');
+  }
+
+  return strBuffer;
+}
+// }}}
+// {{{ requestReply()
+string &requestReply(const request &tRequest, const bool bProcessed, const string &strError, Json *ptResponse, string &strBuffer)
+{
+  string strJson;
+
+  strBuffer.push_back('{');
+  requestEcho(tRequest, strBuffer);
+  if (!strError.empty())
+  {
+    strBuffer.append("\"Error\":");
+    requestEscape(strBuffer, strError.c_str(), strError.size());
+    strBuffer.push_back(',');
+  }
+  if (ptResponse != NULL)
+  {
+    strBuffer.append("\"Response\":");
+    strBuffer.append(ptResponse->json(strJson));
+    strBuffer.push_back(',');
+  }
+  strBuffer.append((bProcessed)?"\"Status\":\"okay\"}\n":"\"Status\":\"error\"}\n");
+
+  return strBuffer;
+}
+// }}}
+// {{{ requestUnescape()
+void requestUnescape(char *pszData, size_t &unSize)
+{
+  size_t unRead = 0, unWrite = 0;
+
+  // the decoded text is never longer so it is written over the escaped text
+  while (unRead < unSize)
+  {
+    if (pszData[unRead] != '\\')
+    {
+      pszData[unWrite++] = pszData[unRead++];
+    }
+    else if ((unRead + 1) < unSize)
+    {
+      char cEscape = pszData[unRead + 1];
+      unRead += 2;
+      if (cEscape == '"' || cEscape == '\\' || cEscape == '/')
+      {
+        pszData[unWrite++] = cEscape;
+      }
+      else if (cEscape == 'b' || cEscape == 'f' || cEscape == 'n' || cEscape == 'r' || cEscape == 't')
+      {
+        pszData[unWrite++] = ((cEscape == 'b')?'\b':((cEscape == 'f')?'\f':((cEscape == 'n')?'\n':((cEscape == 'r')?'\r':'\t'))));
+      }
+      else if (cEscape == 'u' && (unRead + 4) <= unSize)
+      {
+        char szHex[5];
+        unsigned long ulCode;
+        memcpy(szHex, pszData + unRead, 4);
+        szHex[4] = '\0';
+        ulCode = strtoul(szHex, NULL, 16);
+        unRead += 4;
+        if (ulCode >= 0xD800 && ulCode <= 0xDBFF && (unRead + 6) <= unSize && pszData[unRead] == '\\' && pszData[unRead + 1] == 'u')
+        {
+          memcpy(szHex, pszData + unRead + 2, 4);
+          ulCode = 0x10000 + ((ulCode - 0xD800) << 10) + (strtoul(szHex, NULL, 16) - 0xDC00);
+          unRead += 6;
+        }
+        if (ulCode < 0x80)
+        {
+          pszData[unWrite++] = ulCode;
+        }
+        else if (ulCode < 0x800)
+        {
+          pszData[unWrite++] = 0xC0 | (ulCode >> 6);
+          pszData[unWrite++] = 0x80 | (ulCode & 0x3F);
+        }
+        else if (ulCode < 0x10000)
+        {
+          pszData[unWrite++] = 0xE0 | (ulCode >> 12);
+          pszData[unWrite++] = 0x80 | ((ulCode >> 6) & 0x3F);
+          pszData[unWrite++] = 0x80 | (ulCode & 0x3F);
+        }
+        else
+        {
+          pszData[unWrite++] = 0xF0 | (ulCode >> 18);
+          pszData[unWrite++] = 0x80 | ((ulCode >> 12) & 0x3F);
+          pszData[unWrite++] = 0x80 | ((ulCode >> 6) & 0x3F);
+          pszData[unWrite++] = 0x80 | (ulCode & 0x3F);
+        }
+      }
+      else
+      {
+        pszData[unWrite++] = cEscape;
+      }
+    }
+    else
+    {
+      pszData[unWrite++] = pszData[unRead++];
+    }
+  }
+  unSize = unWrite;
+}
+// }}}
+// {{{ requestWatcher()
+watcher &requestWatcher(const int fdSocket, const request &tRequest, Json *ptJson, const frameHeader *ptFrame, watcher &tWatcher)
+{
+  string strJson;
+
+  tWatcher.bBinary = (ptFrame != NULL);
+  memset(&tWatcher.tFrame, 0, sizeof(frameHeader));
+  tWatcher.fdSocket = fdSocket;
+  tWatcher.strPrefix = "{";
+  tWatcher.strService.assign(((tRequest.tService.pszData != NULL)?tRequest.tService.pszData:""), tRequest.tService.unSize);
+  if (ptFrame != NULL)
+  {
+    tWatcher.tFrame = *ptFrame;
+    tWatcher.strPrefix.clear();
+  }
+  else if (ptJson != NULL)
+  {
+    for (map<string, Json *>::iterator i = ptJson->m.begin(); i != ptJson->m.end(); i++)
+    {
+      if (i->first != "Error" && i->first != "Response" && i->first != "Status")
+      {
+        requestEscape(tWatcher.strPrefix, i->first.c_str(), i->first.size());
+        tWatcher.strPrefix.push_back(':');
+        tWatcher.strPrefix.append(i->second->json(strJson));
+        tWatcher.strPrefix.push_back(',');
+      }
+    }
+  }
+  else
+  {
+    requestEcho(tRequest, tWatcher.strPrefix);
+  }
+
+  return tWatcher;
+}
+// }}}
+// }}}
+// {{{ service
+// {{{ serviceActive()
+bool serviceActive(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceExist(strService, strError) && gServiceHot[gServices[strService]->unId].nPid != -1)
+  {
+    bResult = true;
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceAdd()
+bool serviceAdd(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceExist(strService, strError))
+  {
+    bResult = true;
+  }
+  else
+  {
+    service *ptService = new service;
+    strError.clear();
+    if (serviceParse(strService, ptService, strError))
+    {
+      bResult = true;
+      serviceIntern(strService, ptService);
+      ptService->bAdopted = false;
+      ptService->bCoreDumped = false;
+      ptService->bDetached = false;
+      ptService->bHandoverStopping = false;
+      ptService->bHealthCheckConnected = false;
+      ptService->bReady = false;
+      ptService->bStopDiagnosed = false;
+      ptService->bStopMain = false;
+      ptService->bStopped = false;
+      ptService->bStopping = false;
+      ptService->CHandover = 0;
+      ptService->CIdle = 0;
+      ptService->CIdleCheck = 0;
+      ptService->CStart = 0;
+      ptService->nExitSignal = 0;
+      ptService->nExitStatus = -1;
+      processTrack(ptService, ptService->nHealthCheckPid, -1);
+      ptService->nStopGroup = -1;
+      memset(&(ptService->tUsage), 0, sizeof(rusage));
+      ptService->unHealthCheckFailures = 0;
+      ptService->unHealthCheckLatency = 0;
+      ptService->unHealthCheckStart = 0;
+      ptService->unIdleCpu = 0;
+      ptService->unRestarts = 0;
+      ptService->unStartDuration = 0;
+      ptService->unStarts = 0;
+      ptService->unStopDuration = 0;
+      ptService->unStopStart = 0;
+      ptService->unStopWait = 0;
+      gServices[strService] = ptService;
+      if (gptUpgrade != NULL && gptUpgrade->m.find("Services") != gptUpgrade->m.end() && gptUpgrade->m["Services"]->m.find(strService) != gptUpgrade->m["Services"]->m.end())
+      {
+        serviceRestore(strService, gptUpgrade->m["Services"]->m[strService]);
+      }
+      else if (serviceAdopt(strService))
+      {
+        if (!ptService->listenStream.empty() || !ptService->listenDatagram.empty())
+        {
+          logMessage((string)"serviceAdd() [" + strService + (string)"]:  Deferring the activation sockets until the adopted instance stops.");
+        }
+      }
+      else if (!serviceListen(strService, strError))
+      {
+        bResult = false;
+        serviceUnlisten(strService);
+        gServices.erase(strService);
+        serviceRelease(ptService);
+        ptService->environment.clear();
+        delete ptService;
+      }
+    }
+    else
+    {
+      delete ptService;
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceAdopt()
+bool serviceAdopt(const string strService)
+{
+  bool bResult = false;
+  ifstream inPid((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
+
+  if (inPid)
+  {
+    int nDetached = 0;
+    pid_t nPid = 0;
+    size_t unStart = 0;
+    stringstream ssMessage;
+    inPid >> nPid >> unStart >> nDetached;
+    if (nPid > 0 && unStart > 0 && processStart(nPid) == unStart)
+    {
+      string strCommand, strExecutable;
+      stringstream ssExecStart(gServices[strService]->strExecStart);
+      ssExecStart >> strExecutable;
+      if (nDetached == 1 || processCommand(nPid, strCommand) == strExecutable)
+      {
+        int fdPid;
+        if ((fdPid = syscall(SYS_pidfd_open, nPid, 0)) >= 0 || errno == ENOSYS)
+        {
+          double dUptime = 0;
+          ifstream inUptime("/proc/uptime");
+          bResult = true;
+          inUptime >> dUptime;
+          inUptime.close();
+          time(&(gServices[strService]->CStart));
+          gServices[strService]->CStart -= (time_t)(dUptime - ((double)unStart / sysconf(_SC_CLK_TCK)));
+          gServices[strService]->CIdle = gServices[strService]->CStart;
+          gServices[strService]->bAdopted = true;
+          gServices[strService]->bDetached = (nDetached == 1);
+          gServices[strService]->bStopped = false;
+          gServiceHot[gServices[strService]->unId].fdPid = fdPid;
+          processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nPid, nPid);
+          // an adopted process proves itself healthy again before any restart
+          if (!gServices[strService]->strHealthCheckType.empty())
+          {
+            gServices[strService]->strHealth = "unknown";
+            gServices[strService]->unHealthCheckFailures = 0;
+          }
+          gServices[strService]->unHealthCheckStart = timeMonotonic();
+          ssMessage << "serviceAdopt() [" << strService << "," << nPid << "]:  Adopted service.";
+          logMessage(ssMessage.str());
+        }
+        else
+        {
+          ssMessage << "serviceAdopt()->pidfd_open(" << errno << ") error [" << strService << "," << nPid << "]:  " << strerror(errno);
+          logMessage(ssMessage.str());
+        }
+      }
+      else
+      {
+        ssMessage << "serviceAdopt() [" << strService << "," << nPid << "]:  Ignoring the recorded process because its command [" << strCommand << "] does not match the ExecStart.";
+        logMessage(ssMessage.str());
+      }
+    }
+    else
+    {
+      ssMessage << "serviceAdopt() [" << strService << "," << nPid << "]:  Ignoring the recorded process because it is no longer running.";
+      logMessage(ssMessage.str());
+    }
+    if (!bResult)
+    {
+      remove((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
+    }
+  }
+  inPid.close();
+
+  return bResult;
+}
+// }}}
+// {{{ serviceCrashed()
+void serviceCrashed(const string strService, string strEvent, const pid_t nCrashed, const size_t unStart)
+{
+  string strError;
+  stringstream ssMessage;
+  service *ptService = gServices[strService];
+  const rusage &tUsage = ptService->tUsage;
+
+  if (strEvent == "crash" && ptService->nExitStatus == 0)
+  {
+    strEvent = "exit";
+  }
+  ssMessage << "serviceCrashed() [" << strService << "," << nCrashed << "]:  Service " << ((strEvent == "unhealthy")?"became unhealthy":((strEvent == "exit")?"stopped on its own":"crashed")) << " and " << ptService->strExitCause << ".";
+  if (tUsage.ru_maxrss > 0)
+  {
+    ssMessage << "  Its last run used a max RSS of " << tUsage.ru_maxrss << " KiB and " << (tUsage.ru_utime.tv_sec + tUsage.ru_stime.tv_sec) << " s of CPU.";
+  }
+  // a clean exit is routine for Restart=on-failure so only failures notify
+  if (strEvent != "exit")
+  {
+    logNotify(ssMessage.str());
+  }
+  else
+  {
+    logMessage(ssMessage.str());
+  }
+  journalRecord(strService, strEvent, nCrashed, ptService->nExitStatus, 0);
+  if (ptService->strRestart == "always" || (ptService->strRestart == "on-failure" && strEvent != "exit"))
+  {
+    time_t CTime;
+    time(&CTime);
+    if ((CTime - ptService->CStart) < 60)
+    {
+      gServiceHot[ptService->unId].unCrashes++;
+    }
+    else
+    {
+      gServiceHot[ptService->unId].unCrashes = 0;
+    }
+    if (gServiceHot[ptService->unId].unCrashes <= 1)
+    {
+      if (serviceStart(strService, strError))
+      {
+        ptService->unRestarts++;
+        traceRecord("restart", strService, unStart);
+        journalRecord(strService, "restart", gServiceHot[ptService->unId].nPid, -1, ((timeMonotonic() - unStart) / 1000));
+      }
+      else
+      {
+        // leave the retry to the delayed restart in the main loop
+        ptService->CStart = CTime;
+        gServiceHot[ptService->unId].unCrashes++;
+        logMessage((string)"serviceCrashed()->serviceStart() error [" + strService + (string)"]:  " + strError);
+      }
+    }
+  }
+}
+// }}}
+// {{{ serviceDiagnose()
+void serviceDiagnose(const string strService)
+{
+  char szTime[16];
+  string strPath;
+  stringstream ssPath;
+  struct stat tStat;
+  struct tm tTime;
+  time_t CTime;
+
+  time(&CTime);
+  localtime_r(&CTime, &tTime);
+  strftime(szTime, sizeof(szTime), "%Y%m%d-%H%M%S", &tTime);
+  if ((stat((gstrData + "/diag").c_str(), &tStat) == 0 && S_ISDIR(tStat.st_mode)) || mkdir((gstrData + "/diag").c_str(), 00770) == 0)
+  {
+    ssPath << gstrData << "/diag/" << strService << "_" << szTime << "_" << gServiceHot[gServices[strService]->unId].nPid;
+    strPath = ssPath.str();
+    logMessage((string)"serviceDiagnose() [" + strService + (string)"," + strPath + (string)"]:  Capturing hang diagnostics before the stop timeout.");
+    journalRecord(strService, "hang", gServiceHot[gServices[strService]->unId].nPid, -1, 0);
+    gunDiagnosing++;
+    thread tDiagnose(processDiagnose, strService, gServiceHot[gServices[strService]->unId].nPid, strPath, gServices[strService]->strStopDiagnostics);
+    tDiagnose.detach();
+  }
+  else
+  {
+    stringstream ssMessage;
+    ssMessage << "serviceDiagnose()->mkdir(" << errno << ") error [" << gstrData << "/diag]:  " << strerror(errno);
+    logMessage(ssMessage.str());
+  }
+}
+// }}}
+// {{{ serviceDisable()
+bool serviceDisable(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceRemove(strService, strError) && serviceUnlink(strService, strError))
+  {
+    bResult = true;
+    logMessage((string)"serviceDisable() [" + strService + (string)"]:  Disabled service.");
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceEnable()
+bool serviceEnable(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceLink(strService, strError) && serviceAdd(strService, strError))
+  {
+    bResult = true;
+    logMessage((string)"serviceEnable() [" + strService + (string)"]:  Enabled service.");
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceExist()
+bool serviceExist(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceValid(strService, strError))
+  {
+    if (gServices.find(strService) != gServices.end())
+    {
+      bResult = true;
+    }
+    else
+    {
+      strError = "Please provide a valid Service.";
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceExited()
+void serviceExited(const string strService, const int nStatus, const rusage &tUsage)
+{
+  stringstream ssCause;
+
+  gServices[strService]->bCoreDumped = false;
+  gServices[strService]->nExitSignal = 0;
+  gServices[strService]->tUsage = tUsage;
+  if (WIFEXITED(nStatus))
+  {
+    gServices[strService]->nExitStatus = WEXITSTATUS(nStatus);
+    ssCause << "exited with status " << WEXITSTATUS(nStatus);
+  }
+  else if (WIFSIGNALED(nStatus))
+  {
+    string strSignal;
+    gServices[strService]->bCoreDumped = WCOREDUMP(nStatus);
+    gServices[strService]->nExitSignal = WTERMSIG(nStatus);
+    gServices[strService]->nExitStatus = 128 + WTERMSIG(nStatus);
+    ssCause << "killed by signal " << WTERMSIG(nStatus) << " (" << sigstring(strSignal, WTERMSIG(nStatus)) << ")";
+    if (gServices[strService]->bCoreDumped)
+    {
+      ssCause << ", core dumped";
+      coreRecord(strService, gServiceHot[gServices[strService]->unId].nPid);
+    }
+    // a SIGKILL we did not send is most likely the kernel out of memory killer
+    else if (WTERMSIG(nStatus) == SIGKILL && gServices[strService]->nKillSignal != SIGKILL)
+    {
+      ssCause << ", possibly out of memory";
+    }
+  }
+  gServices[strService]->strExitCause = ssCause.str();
+}
+// }}}
+// {{{ serviceFollow()
+pid_t serviceFollow(const string strService)
+{
+  pid_t nPid = 0, nPidFile = 0;
+  list<pid_t> children;
+  string strTag;
+  ifstream inPid(gServices[strService]->strPidFile.c_str());
+
+  if (inPid)
+  {
+    inPid >> nPidFile;
+  }
+  inPid.close();
+  if (nPidFile > 0 && nPidFile != gServiceHot[gServices[strService]->unId].nPid && processState(nPidFile) != 'Z' && processService(nPidFile, strTag) == strService)
+  {
+    nPid = nPidFile;
+  }
+  else
+  {
+    processChildren(getpid(), children);
+    for (list<pid_t>::iterator i = children.begin(); nPid == 0 && i != children.end(); i++)
+    {
+      if ((*i) != gServiceHot[gServices[strService]->unId].nPid && (*i) != gServiceHot[gServices[strService]->unId].nHandoverPid && processState(*i) != 'Z' && processService(*i, strTag) == strService)
+      {
+        nPid = (*i);
+      }
+    }
+  }
+
+  return nPid;
+}
+// }}}
+// {{{ serviceHandover()
+void serviceHandover(const size_t unId)
+{
+  service *ptService = gServiceHot[unId].ptService;
+  stringstream ssMessage;
+  time_t CTime;
+
+  time(&CTime);
+  if (!ptService->bHandoverStopping)
+  {
+    if (ptService->bReady || (ptService->strType != "notify" && (CTime - ptService->CHandover) >= 1) || (CTime - ptService->CHandover) >= 90)
+    {
+      ssMessage.str("");
+      ssMessage << "serviceHandover() [" << gServiceNames[unId] << "," << gServiceHot[unId].nHandoverPid << "]:  Stopping the previous instance.";
+      logMessage(ssMessage.str());
+      ptService->bHandoverStopping = true;
+      ptService->CHandover = CTime;
+      kill(((ptService->strKillMode != "process" && getpgid(gServiceHot[unId].nHandoverPid) == gServiceHot[unId].nHandoverPid)?-gServiceHot[unId].nHandoverPid:gServiceHot[unId].nHandoverPid), ptService->nKillSignal);
+    }
+  }
+  else
+  {
+    pid_t nReturn = waitpid(gServiceHot[unId].nHandoverPid, NULL, WNOHANG);
+    if (nReturn == gServiceHot[unId].nHandoverPid || (nReturn < 0 && errno == ECHILD))
+    {
+      ssMessage.str("");
+      ssMessage << "serviceHandover() [" << gServiceNames[unId] << "," << gServiceHot[unId].nHandoverPid << "," << gServiceHot[unId].nPid << "]:  Handed over service.";
+      logMessage(ssMessage.str());
+      ptService->bHandoverStopping = false;
+      processTrack(ptService, gServiceHot[unId].nHandoverPid, -1);
+    }
+    else if ((CTime - ptService->CHandover) >= (time_t)ptService->unTimeoutStopSec)
+    {
+      ssMessage.str("");
+      ssMessage << "serviceHandover() [" << gServiceNames[unId] << "," << gServiceHot[unId].nHandoverPid << "]:  Stopping the previous instance forcefully.";
+      logMessage(ssMessage.str());
+      ptService->CHandover = CTime;
+      kill(((ptService->strKillMode != "process" && getpgid(gServiceHot[unId].nHandoverPid) == gServiceHot[unId].nHandoverPid)?-gServiceHot[unId].nHandoverPid:gServiceHot[unId].nHandoverPid), SIGKILL);
+    }
+  }
+}
+// }}}
+// {{{ serviceIdle()
+bool serviceIdle(const size_t unId)
+{
+  bool bResult = false;
+  service *ptService = gServiceHot[unId].ptService;
+  time_t CTime;
+
+  time(&CTime);
+  if (gServiceHot[unId].bListening && gServiceHot[unId].nPid != -1 && ptService->unIdleStopSec > 0 && CTime != ptService->CIdleCheck)
+  {
+    size_t unPosition;
+    string strLine;
+    stringstream ssProc;
+    ssProc << "/proc/" << gServiceHot[unId].nPid << "/stat";
+    ifstream inStat(ssProc.str().c_str());
+    ptService->CIdleCheck = CTime;
+    if (getline(inStat, strLine) && (unPosition = strLine.rfind(")")) != string::npos)
+    {
+      size_t unCpu = 0;
+      string strField;
+      stringstream ssStat(strLine.substr(unPosition + 1));
+      // utime and stime are the 14th and 15th fields where the 3rd field follows the command
+      for (int i = 3; i <= 15 && ssStat >> strField; i++)
+      {
+        if (i >= 14)
+        {
+          unCpu += strtoul(strField.c_str(), NULL, 10);
+        }
+      }
+      if (unCpu != ptService->unIdleCpu)
+      {
+        ptService->CIdle = CTime;
+        ptService->unIdleCpu = unCpu;
+      }
+      else if ((size_t)(CTime - ptService->CIdle) >= ptService->unIdleStopSec)
+      {
+        bResult = true;
+      }
+    }
+    inStat.close();
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceIntern()
+void serviceIntern(const string strService, service *ptService)
+{
+  serviceHot tHot;
+
+  tHot.bListening = false;
+  tHot.fdHealthCheck = tHot.fdPid = -1;
+  tHot.nHandoverPid = tHot.nPid = -1;
+  tHot.unCrashes = 0;
+  tHot.ptService = ptService;
+  if (!gServiceFree.empty())
+  {
+    ptService->unId = gServiceFree.back();
+    gServiceFree.pop_back();
+    gServiceHot[ptService->unId] = tHot;
+    gServiceNames[ptService->unId] = strService;
+  }
+  else
+  {
+    ptService->unId = gServiceHot.size();
+    gServiceHot.push_back(tHot);
+    gServiceNames.push_back(strService);
+  }
+}
+// }}}
+// {{{ serviceKill()
+bool serviceKill(const string strService, const pid_t nGroup, const int nSignal, const bool bFinal)
+{
+  bool bResult = false;
+
+  if (gServices[strService]->strKillMode == "process" || (gServices[strService]->strKillMode == "mixed" && !bFinal) || (gServices[strService]->strKillMode == "process-group" && nGroup == -1))
+  {
+    char cState = processState(gServiceHot[gServices[strService]->unId].nPid);
+    if (gServiceHot[gServices[strService]->unId].nPid != -1 && cState != '\0' && cState != 'Z' && kill(gServiceHot[gServices[strService]->unId].nPid, nSignal) == 0)
+    {
+      bResult = true;
+    }
+  }
+  else if (gServices[strService]->strKillMode == "process-group")
+  {
+    if (kill(-nGroup, nSignal) == 0)
+    {
+      bResult = true;
+    }
+  }
+  else
+  {
+    list<pid_t> processes;
+    serviceProcesses(strService, processes);
+    for (list<pid_t>::iterator i = processes.begin(); i != processes.end(); i++)
+    {
+      if (kill((*i), nSignal) == 0)
+      {
+        bResult = true;
+      }
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceLink()
+bool serviceLink(const string strService, string &strError)
+{
+  bool bResult = false;
+  stringstream ssMessage;
+
+  if (serviceValid(strService, strError))
+  {
+    struct stat tStat;
+    if (stat((gstrData + (string)"/services/" + strService + (string)".service").c_str(), &tStat) == 0)
+    {
+      if (stat((gstrData + (string)"/enabled/" + strService + (string)".service").c_str(), &tStat) == 0 || symlink((gstrData + (string)"/services/" + strService + (string)".service").c_str(), (gstrData + (string)"/enabled/" + strService + (string)".service").c_str()) == 0)
+      {
+        bResult = true;
+      }
+      else
+      {
+        ssMessage.str("");
+        ssMessage << "symlink(" << errno << ") " << strerror(errno);
+        strError = ssMessage.str();
+      }
+    }
+    else
+    {
+      strError = "Please provide a valid Service.";
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceListen()
+bool serviceListen(const string strService, string &strError)
+{
+  bool bResult = true;
+  stringstream ssMessage;
+
+  for (int i = 0; bResult && i < 2; i++)
+  {
+    int nType = ((i == 0)?SOCK_STREAM:SOCK_DGRAM);
+    list<string> &addresses = ((i == 0)?gServices[strService]->listenStream:gServices[strService]->listenDatagram);
+    for (list<string>::iterator j = addresses.begin(); bResult && j != addresses.end(); j++)
+    {
+      int fdListen = -1, nOn = 1;
+      bResult = false;
+      if ((*j)[0] == '/')
+      {
+        if ((fdListen = socket(AF_UNIX, nType | SOCK_CLOEXEC, 0)) >= 0)
+        {
+          sockaddr_un addr;
+          memset(&addr, 0, sizeof(sockaddr_un));
+          addr.sun_family = AF_UNIX;
+          strncpy(addr.sun_path, j->c_str(), sizeof(addr.sun_path) - 1);
+          remove(j->c_str());
+          if (bind(fdListen, (sockaddr *)&addr, sizeof(sockaddr_un)) == 0)
+          {
+            bResult = true;
+          }
+        }
+      }
+      else
+      {
+        size_t unPosition = j->rfind(":");
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(sockaddr_in));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(atoi(((unPosition != string::npos)?j->substr(unPosition + 1):(*j)).c_str()));
+        if (unPosition != string::npos && inet_pton(AF_INET, j->substr(0, unPosition).c_str(), &addr.sin_addr) != 1)
+        {
+          errno = EINVAL;
+        }
+        else if ((fdListen = socket(AF_INET, nType | SOCK_CLOEXEC, 0)) >= 0)
+        {
+          setsockopt(fdListen, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn));
+          if (bind(fdListen, (sockaddr *)&addr, sizeof(sockaddr_in)) == 0)
+          {
+            bResult = true;
+          }
+        }
+      }
+      if (bResult && nType == SOCK_STREAM && listen(fdListen, SOMAXCONN) != 0)
+      {
+        bResult = false;
+      }
+      if (bResult)
+      {
+        gServices[strService]->listens.push_back(fdListen);
+        gServiceHot[gServices[strService]->unId].bListening = true;
+        ssMessage.str("");
+        ssMessage << "serviceListen() [" << strService << "," << (*j) << "," << fdListen << "]:  Listening to " << ((nType == SOCK_STREAM)?"stream":"datagram") << " socket.";
+        logMessage(ssMessage.str());
+      }
+      else
+      {
+        ssMessage.str("");
+        ssMessage << "socket(" << errno << ") error [" << (*j) << "]:  " << strerror(errno);
+        strError = ssMessage.str();
+        if (fdListen != -1)
+        {
+          close(fdListen);
+        }
+      }
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceNotify()
+bool serviceNotify(const int fdNotify, string &strError)
+{
+  bool bResult = true;
+  char szBuffer[4096], szControl[CMSG_SPACE(sizeof(ucred)) + CMSG_SPACE(sizeof(int) * 253)];
+  ssize_t nReturn;
+  stringstream ssMessage;
+
+  do
+  {
+    iovec tIov;
+    msghdr tMessage;
+    tIov.iov_base = szBuffer;
+    tIov.iov_len = sizeof(szBuffer) - 1;
+    memset(&tMessage, 0, sizeof(msghdr));
+    tMessage.msg_iov = &tIov;
+    tMessage.msg_iovlen = 1;
+    tMessage.msg_control = szControl;
+    tMessage.msg_controllen = sizeof(szControl);
+    if ((nReturn = recvmsg(fdNotify, &tMessage, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) >= 0)
+    {
+      bool bFdStore = false, bFdStoreRemove = false, bReady = false;
+      pid_t nPid = -1;
+      string strLine, strName = "stored", strService;
+      stringstream ssLines(string(szBuffer, nReturn));
+      vector<int> fdReceived;
+      for (cmsghdr *ptControl = CMSG_FIRSTHDR(&tMessage); ptControl != NULL; ptControl = CMSG_NXTHDR(&tMessage, ptControl))
+      {
+        if (ptControl->cmsg_level == SOL_SOCKET && ptControl->cmsg_type == SCM_CREDENTIALS)
+        {
+          ucred tCredentials;
+          memcpy(&tCredentials, CMSG_DATA(ptControl), sizeof(ucred));
+          nPid = tCredentials.pid;
+        }
+        else if (ptControl->cmsg_level == SOL_SOCKET && ptControl->cmsg_type == SCM_RIGHTS)
+        {
+          for (size_t i = 0; i < ((ptControl->cmsg_len - CMSG_LEN(0)) / sizeof(int)); i++)
+          {
+            int fdItem;
+            memcpy(&fdItem, CMSG_DATA(ptControl) + (i * sizeof(int)), sizeof(int));
+            fdReceived.push_back(fdItem);
+          }
+        }
+      }
+      while (getline(ssLines, strLine))
+      {
+        if (strLine == "FDSTORE=1")
+        {
+          bFdStore = true;
+        }
+        else if (strLine == "FDSTOREREMOVE=1")
+        {
+          bFdStoreRemove = true;
+        }
+        else if (strLine.size() > 7 && strLine.substr(0, 7) == "FDNAME=")
+        {
+          strName = strLine.substr(7, strLine.size() - 7);
+        }
+        else if (strLine == "READY=1")
+        {
+          bReady = true;
+        }
+      }
+      for (unordered_map<string, service *>::iterator i = gServices.begin(); strService.empty() && i != gServices.end(); i++)
+      {
+        if (nPid != -1 && (gServiceHot[i->second->unId].nPid == nPid || gServiceHot[i->second->unId].nHandoverPid == nPid))
+        {
+          strService = i->first;
+        }
+      }
+      if (!strService.empty())
+      {
+        if (bReady && gServiceHot[gServices[strService]->unId].nPid == nPid)
+        {
+          gServices[strService]->bReady = true;
+        }
+        if (bFdStoreRemove)
+        {
+          for (vector<pair<string, int> >::iterator i = gServices[strService]->fdstore.begin(); i != gServices[strService]->fdstore.end();)
+          {
+            if (i->first == strName)
+            {
+              close(i->second);
+              i = gServices[strService]->fdstore.erase(i);
+            }
+            else
+            {
+              i++;
+            }
+          }
+        }
+        if (bFdStore)
+        {
+          for (vector<int>::iterator i = fdReceived.begin(); i != fdReceived.end(); i++)
+          {
+            bool bDuplicate = false;
+            struct stat tStat[2];
+            if (fstat(*i, &tStat[0]) == 0)
+            {
+              for (vector<pair<string, int> >::iterator j = gServices[strService]->fdstore.begin(); !bDuplicate && j != gServices[strService]->fdstore.end(); j++)
+              {
+                if (fstat(j->second, &tStat[1]) == 0 && tStat[0].st_dev == tStat[1].st_dev && tStat[0].st_ino == tStat[1].st_ino)
+                {
+                  bDuplicate = true;
+                }
+              }
+              for (vector<int>::iterator j = gServices[strService]->listens.begin(); !bDuplicate && j != gServices[strService]->listens.end(); j++)
+              {
+                if (fstat(*j, &tStat[1]) == 0 && tStat[0].st_dev == tStat[1].st_dev && tStat[0].st_ino == tStat[1].st_ino)
+                {
+                  bDuplicate = true;
+                }
+              }
+            }
+            if (bDuplicate)
+            {
+              close(*i);
+            }
+            else if (gServices[strService]->fdstore.size() < gServices[strService]->unFdStoreMax)
+            {
+              gServices[strService]->fdstore.push_back(make_pair(strName, *i));
+              ssMessage.str("");
+              ssMessage << "serviceNotify() [" << strService << "," << strName << "," << (*i) << "]:  Stored file descriptor.";
+              logMessage(ssMessage.str());
+            }
+            else
+            {
+              close(*i);
+              ssMessage.str("");
+              ssMessage << "serviceNotify() error [" << strService << "," << strName << "]:  Discarded file descriptor which exceeds the FileDescriptorStoreMax of " << gServices[strService]->unFdStoreMax << ".";
+              logMessage(ssMessage.str());
+            }
+          }
+          fdReceived.clear();
+        }
+      }
+      else if (!fdReceived.empty() || bFdStore)
+      {
+        ssMessage.str("");
+        ssMessage << "serviceNotify() error [" << nPid << "]:  Ignored notification from a process which does not belong to a service.";
+        logMessage(ssMessage.str());
+      }
+      for (vector<int>::iterator i = fdReceived.begin(); i != fdReceived.end(); i++)
+      {
+        close(*i);
+      }
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      bResult = false;
+      ssMessage.str("");
+      ssMessage << "recvmsg(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+    }
+  } while (nReturn >= 0);
+
+  return bResult;
+}
+// }}}
+// {{{ serviceParse()
+bool serviceParse(const string strService, service *ptService, string &strError)
+{
+  bool bResult = false;
+  struct stat tStat;
+
+  ptService->tDefinitionModified.tv_sec = ptService->tDefinitionModified.tv_nsec = 0;
+  ptService->unDefinitionSize = 0;
+  if (stat((gstrData + (string)"/services/" + strService + (string)".service").c_str(), &tStat) == 0)
+  {
+    map<string, service *>::iterator i = gDefinitions.find(strService);
+    ptService->tDefinitionModified = tStat.st_mtim;
+    ptService->unDefinitionSize = tStat.st_size;
+    if (i != gDefinitions.end())
+    {
+      if (i->second->tDefinitionModified.tv_sec == tStat.st_mtim.tv_sec && i->second->tDefinitionModified.tv_nsec == tStat.st_mtim.tv_nsec && i->second->unDefinitionSize == (size_t)tStat.st_size)
+      {
+        bResult = true;
+        definitionMove(i->second, ptService);
+      }
+      delete i->second;
+      gDefinitions.erase(i);
+    }
+    else if (definitionLookup(strService, tStat, ptService))
+    {
+      bResult = true;
+      gunDefinitionsCached++;
+    }
+  }
+  if (!bResult && (bResult = definitionParse(strService, ptService, strError)))
+  {
+    gbDefinitionsDirty = true;
+    gunDefinitionsParsed++;
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceProcesses()
+list<pid_t> &serviceProcesses(const string strService, list<pid_t> &processes)
+{
+  list<pid_t> children, pending;
+  string strTag;
+
+  processes.clear();
+  if (gServiceHot[gServices[strService]->unId].nPid != -1)
+  {
+    pending.push_back(gServiceHot[gServices[strService]->unId].nPid);
+  }
+  processChildren(getpid(), children);
+  for (list<pid_t>::iterator i = children.begin(); i != children.end(); i++)
+  {
+    if ((*i) != gServiceHot[gServices[strService]->unId].nPid && (*i) != gServiceHot[gServices[strService]->unId].nHandoverPid && processService(*i, strTag) == strService)
+    {
+      pending.push_back(*i);
+    }
+  }
+  while (!pending.empty())
+  {
+    char cState = processState(pending.front());
+    if (cState != '\0' && cState != 'Z')
+    {
+      processes.push_back(pending.front());
+      processChildren(pending.front(), pending);
+    }
+    pending.pop_front();
+  }
+
+  return processes;
+}
+// }}}
+// {{{ serviceRefresh()
+void serviceRefresh(const string strService, service &tDefinition, string &strChanges)
+{
+  bool bHealthCheck = false;
+  list<string> applied, sockets, stale;
+  service *ptService = gServices[strService];
+  stringstream ssChanges;
+
+  // {{{ stale until the next start
+  if (ptService->strExecStart != tDefinition.strExecStart)
+  {
+    stale.push_back("ExecStart");
+    ptService->strExecStart = tDefinition.strExecStart;
+  }
+  if (ptService->environment != tDefinition.environment)
+  {
+    stale.push_back("Environment");
+    ptService->environment.swap(tDefinition.environment);
+  }
+  if (ptService->strLimitCore != tDefinition.strLimitCore)
+  {
+    stale.push_back("LimitCORE");
+    ptService->strLimitCore = tDefinition.strLimitCore;
+  }
+  if (ptService->strLimitNoFile != tDefinition.strLimitNoFile)
+  {
+    stale.push_back("LimitNOFILE");
+    ptService->strLimitNoFile = tDefinition.strLimitNoFile;
+  }
+  if (ptService->strPidFile != tDefinition.strPidFile)
+  {
+    stale.push_back("PIDFile");
+    ptService->strPidFile = tDefinition.strPidFile;
+  }
+  if (ptService->strType != tDefinition.strType)
+  {
+    stale.push_back("Type");
+    ptService->strType = tDefinition.strType;
+  }
+  // }}}
+  // {{{ applied in place
+  if (ptService->strDescription != tDefinition.strDescription)
+  {
+    applied.push_back("Description");
+    ptService->strDescription = tDefinition.strDescription;
+  }
+  if (ptService->strExecStartPost != tDefinition.strExecStartPost)
+  {
+    applied.push_back("ExecStartPost");
+    ptService->strExecStartPost = tDefinition.strExecStartPost;
+  }
+  if (ptService->strExecStartPre != tDefinition.strExecStartPre)
+  {
+    applied.push_back("ExecStartPre");
+    ptService->strExecStartPre = tDefinition.strExecStartPre;
+  }
+  if (ptService->strExecStopPost != tDefinition.strExecStopPost)
+  {
+    applied.push_back("ExecStopPost");
+    ptService->strExecStopPost = tDefinition.strExecStopPost;
+  }
+  if (ptService->unFdStoreMax != tDefinition.unFdStoreMax)
+  {
+    applied.push_back("FileDescriptorStoreMax");
+    ptService->unFdStoreMax = tDefinition.unFdStoreMax;
+  }
+  if (ptService->unIdleStopSec != tDefinition.unIdleStopSec)
+  {
+    applied.push_back("IdleStopSec");
+    ptService->unIdleStopSec = tDefinition.unIdleStopSec;
+  }
+  if (ptService->strKillMode != tDefinition.strKillMode)
+  {
+    applied.push_back("KillMode");
+    ptService->strKillMode = tDefinition.strKillMode;
+  }
+  if (ptService->nKillSignal != tDefinition.nKillSignal)
+  {
+    applied.push_back("KillSignal");
+    ptService->nKillSignal = tDefinition.nKillSignal;
+  }
+  if (ptService->strRestart != tDefinition.strRestart)
+  {
+    applied.push_back("Restart");
+    ptService->strRestart = tDefinition.strRestart;
+  }
+  if (ptService->strStopDiagnostics != tDefinition.strStopDiagnostics)
+  {
+    applied.push_back("StopDiagnostics");
+    ptService->strStopDiagnostics = tDefinition.strStopDiagnostics;
+  }
+  if (ptService->unTimeoutStopSec != tDefinition.unTimeoutStopSec)
+  {
+    applied.push_back("TimeoutStopSec");
+    ptService->unTimeoutStopSec = tDefinition.unTimeoutStopSec;
+  }
+  // }}}
+  // {{{ health check
+  if (ptService->strHealthCheckType != tDefinition.strHealthCheckType || ptService->strHealthCheckCommand != tDefinition.strHealthCheckCommand || ptService->strHealthCheckHost != tDefinition.strHealthCheckHost || ptService->strHealthCheckPath != tDefinition.strHealthCheckPath || ptService->strHealthCheckPort != tDefinition.strHealthCheckPort)
+  {
+    bHealthCheck = true;
+    // the probe in flight belongs to the previous definition
+    healthCheckCancel(strService);
+    ptService->strHealth = tDefinition.strHealth;
+    ptService->strHealthCheckCommand = tDefinition.strHealthCheckCommand;
+    ptService->strHealthCheckHost = tDefinition.strHealthCheckHost;
+    ptService->strHealthCheckPath = tDefinition.strHealthCheckPath;
+    ptService->strHealthCheckPort = tDefinition.strHealthCheckPort;
+    ptService->strHealthCheckType = tDefinition.strHealthCheckType;
+    ptService->unHealthCheckFailures = 0;
+    ptService->unHealthCheckLatency = 0;
+    ptService->unHealthCheckStart = timeMonotonic();
+  }
+  if (ptService->unHealthCheckInterval != tDefinition.unHealthCheckInterval || ptService->unHealthCheckThreshold != tDefinition.unHealthCheckThreshold || ptService->unHealthCheckTimeout != tDefinition.unHealthCheckTimeout)
+  {
+    bHealthCheck = true;
+    ptService->unHealthCheckInterval = tDefinition.unHealthCheckInterval;
+    ptService->unHealthCheckThreshold = tDefinition.unHealthCheckThreshold;
+    ptService->unHealthCheckTimeout = tDefinition.unHealthCheckTimeout;
+  }
+  if (bHealthCheck)
+  {
+    applied.push_back("HealthCheck");
+  }
+  // }}}
+  // {{{ sockets
+  // bound activation sockets are only replaced by disable and enable
+  if (ptService->listenStream != tDefinition.listenStream)
+  {
+    sockets.push_back("ListenStream");
+  }
+  if (ptService->listenDatagram != tDefinition.listenDatagram)
+  {
+    sockets.push_back("ListenDatagram");
+  }
+  // }}}
+  ptService->tDefinitionModified = tDefinition.tDefinitionModified;
+  ptService->unDefinitionSize = tDefinition.unDefinitionSize;
+  for (list<string>::iterator i = stale.begin(); i != stale.end(); i++)
+  {
+    ssChanges << ((i == stale.begin())?"":", ") << (*i);
+    if (gServiceHot[ptService->unId].nPid != -1 && (", " + ptService->strStale + ", ").find(", " + (*i) + ", ") == string::npos)
+    {
+      ptService->strStale += ((ptService->strStale.empty())?"":", ") + (*i);
+    }
+  }
+  if (!stale.empty() && gServiceHot[ptService->unId].nPid != -1)
+  {
+    ssChanges << " (stale until restarted)";
+  }
+  for (list<string>::iterator i = applied.begin(); i != applied.end(); i++)
+  {
+    ssChanges << ((ssChanges.str().empty())?"":", ") << (*i);
+  }
+  for (list<string>::iterator i = sockets.begin(); i != sockets.end(); i++)
+  {
+    ssChanges << ((ssChanges.str().empty())?"":", ") << (*i) << " (after disable and enable)";
+  }
+  strChanges = ssChanges.str();
+}
+// }}}
+// {{{ serviceRelease()
+void serviceRelease(service *ptService)
+{
+  size_t unId = ptService->unId;
+
+  processTrack(ptService, gServiceHot[unId].nHandoverPid, -1);
+  processTrack(ptService, ptService->nHealthCheckPid, -1);
+  processTrack(ptService, gServiceHot[unId].nPid, -1);
+  // a released slot reads as a stopped service with nothing to poll until it is reused
+  gServiceHot[unId].bListening = false;
+  gServiceHot[unId].fdHealthCheck = gServiceHot[unId].fdPid = -1;
+  gServiceHot[unId].unCrashes = 0;
+  gServiceHot[unId].ptService = NULL;
+  gServiceNames[unId].clear();
+  gServiceFree.push_back(unId);
+}
+// }}}
+// {{{ serviceReload()
+bool serviceReload(const string strService, string &strError)
+{
+  bool bResult = false;
+  stringstream ssMessage;
+
+  if (serviceActive(strService, strError))
+  {
+    logMessage((string)"serviceReload() [" + strService + (string)"]:  Reloading service.");
+    if (kill(gServiceHot[gServices[strService]->unId].nPid, SIGHUP) == 0)
+    {
+      bResult = true;
+      logMessage((string)"serviceReload() [" + strService + (string)"]:  Reloaded service.");
+    }
+    else
+    {
+      ssMessage.str("");
+      ssMessage << "kill(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+    }
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceReloadOrRestart()
+bool serviceReloadOrRestart(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceActive(strService, strError))
+  {
+    if (gServiceHot[gServices[strService]->unId].nHandoverPid != -1)
+    {
+      strError = "Please wait for the previous handover to finish.";
+    }
+    else if (!gServices[strService]->listens.empty() || !gServices[strService]->fdstore.empty())
+    {
+      pid_t nPid = gServiceHot[gServices[strService]->unId].nPid;
+      logMessage((string)"serviceReloadOrRestart() [" + strService + (string)"]:  Starting the replacement instance.");
+      healthCheckCancel(strService);
+      processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nPid, -1);
+      if (serviceStart(strService, strError))
+      {
+        bResult = true;
+        gServices[strService]->bHandoverStopping = false;
+        processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nHandoverPid, nPid);
+        time(&(gServices[strService]->CHandover));
+      }
+      else
+      {
+        processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nPid, nPid);
+      }
+    }
+    else
+    {
+      bResult = serviceRestart(strService, strError);
+    }
+  }
+  else if (serviceExist(strService, strError))
+  {
+    bResult = serviceStart(strService, strError);
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceRemove()
+bool serviceRemove(const string strService, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceExist(strService, strError) && (!serviceActive(strService, strError) || serviceStop(strService, strError)))
+  {
+    bResult = true;
+    serviceUnlisten(strService);
+    for (vector<pair<string, int> >::iterator i = gServices[strService]->fdstore.begin(); i != gServices[strService]->fdstore.end(); i++)
+    {
+      close(i->second);
+    }
+    gServices[strService]->fdstore.clear();
+    gServices[strService]->environment.clear();
+    serviceRelease(gServices[strService]);
     delete gServices[strService];
     gServices.erase(strService);
   }
@@ -1229,249 +7268,959 @@ bool serviceRemove(const string strService, string &strError)
   return bResult;
 }
 // }}}
-// {{{ serviceRestart()
-bool serviceRestart(const string strService, string &strError)
+// {{{ serviceRestore()
+void serviceRestore(const string strService, Json *ptState)
+{
+  stringstream ssMessage;
+
+  if (ptState->m.find("Pid") != ptState->m.end())
+  {
+    gServices[strService]->bAdopted = (ptState->m["Adopted"]->v == "1");
+    gServices[strService]->bDetached = (ptState->m["Detached"]->v == "1");
+    gServices[strService]->bHandoverStopping = (ptState->m["HandoverStopping"]->v == "1");
+    gServices[strService]->bReady = (ptState->m["Ready"]->v == "1");
+    gServices[strService]->bStopped = (ptState->m["Stopped"]->v == "1");
+    gServices[strService]->CHandover = atol(ptState->m["HandoverStart"]->v.c_str());
+    gServices[strService]->CIdle = atol(ptState->m["Idle"]->v.c_str());
+    gServices[strService]->CStart = atol(ptState->m["Start"]->v.c_str());
+    processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nHandoverPid, atoi(ptState->m["HandoverPid"]->v.c_str()));
+    processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nPid, atoi(ptState->m["Pid"]->v.c_str()));
+    gServices[strService]->strHealth = ptState->m["Health"]->v;
+    gServiceHot[gServices[strService]->unId].unCrashes = strtoul(ptState->m["Crashes"]->v.c_str(), NULL, 10);
+    if (ptState->m.find("Starts") != ptState->m.end())
+    {
+      gServices[strService]->nExitStatus = atoi(ptState->m["ExitStatus"]->v.c_str());
+      gServices[strService]->unRestarts = strtoul(ptState->m["Restarts"]->v.c_str(), NULL, 10);
+      gServices[strService]->unStarts = strtoul(ptState->m["Starts"]->v.c_str(), NULL, 10);
+    }
+    if (ptState->m.find("ExitCause") != ptState->m.end())
+    {
+      gServices[strService]->bCoreDumped = (ptState->m["CoreDumped"]->v == "1");
+      gServices[strService]->nExitSignal = atoi(ptState->m["ExitSignal"]->v.c_str());
+      gServices[strService]->strExitCause = ptState->m["ExitCause"]->v;
+    }
+    if (ptState->m.find("Stale") != ptState->m.end())
+    {
+      gServices[strService]->strStale = ptState->m["Stale"]->v;
+    }
+    gServices[strService]->unHealthCheckFailures = strtoul(ptState->m["HealthFailures"]->v.c_str(), NULL, 10);
+    gServices[strService]->unHealthCheckLatency = strtoul(ptState->m["HealthLatency"]->v.c_str(), NULL, 10);
+    gServices[strService]->unIdleCpu = strtoul(ptState->m["IdleCpu"]->v.c_str(), NULL, 10);
+  }
+  gServices[strService]->unHealthCheckStart = timeMonotonic();
+  if (gServiceHot[gServices[strService]->unId].nPid != -1)
+  {
+    gServiceHot[gServices[strService]->unId].fdPid = syscall(SYS_pidfd_open, gServiceHot[gServices[strService]->unId].nPid, 0);
+  }
+  if (ptState->m.find("Listens") != ptState->m.end())
+  {
+    for (list<Json *>::iterator i = ptState->m["Listens"]->l.begin(); i != ptState->m["Listens"]->l.end(); i++)
+    {
+      int fdListen = atoi((*i)->v.c_str());
+      fcntl(fdListen, F_SETFD, FD_CLOEXEC);
+      gServices[strService]->listens.push_back(fdListen);
+      gServiceHot[gServices[strService]->unId].bListening = true;
+    }
+  }
+  if (ptState->m.find("FdStore") != ptState->m.end())
+  {
+    for (list<Json *>::iterator i = ptState->m["FdStore"]->l.begin(); i != ptState->m["FdStore"]->l.end(); i++)
+    {
+      if ((*i)->m.find("Fd") != (*i)->m.end() && (*i)->m.find("Name") != (*i)->m.end())
+      {
+        int fdStore = atoi((*i)->m["Fd"]->v.c_str());
+        fcntl(fdStore, F_SETFD, FD_CLOEXEC);
+        gServices[strService]->fdstore.push_back(make_pair((*i)->m["Name"]->v, fdStore));
+      }
+    }
+  }
+  ssMessage << "serviceRestore() [" << strService << "," << gServiceHot[gServices[strService]->unId].nPid << "]:  Restored service.";
+  logMessage(ssMessage.str());
+}
+// }}}
+// {{{ serviceRestart()
+bool serviceRestart(const string strService, string &strError)
+{
+  bool bResult = false;
+  size_t unStart = timeMonotonic();
+
+  if (serviceStop(strService, strError) && serviceStart(strService, strError))
+  {
+    bResult = true;
+    traceRecord("restart", strService, unStart);
+    journalRecord(strService, "restart", gServiceHot[gServices[strService]->unId].nPid, -1, ((timeMonotonic() - unStart) / 1000));
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceRunning()
+bool serviceRunning(const size_t unId)
+{
+  bool bResult = false;
+
+  if (gServiceHot[unId].fdPid != -1)
+  {
+    pollfd fds[1];
+    fds[0].fd = gServiceHot[unId].fdPid;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    bResult = (poll(fds, 1, 0) == 0);
+  }
+  else
+  {
+    stringstream ssProc;
+    ssProc << "/proc/" << gServiceHot[unId].nPid;
+    bResult = gpCentral->file()->directoryExist(ssProc.str());
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceScan()
+void serviceScan()
 {
-  bool bResult = false;
+  size_t unStart;
+  string strError;
+  stringstream ssMessage;
 
-  if (serviceStop(strService, strError) && serviceStart(strService, strError))
+  for (size_t unId = 0; unId < gServiceHot.size(); unId++)
   {
-    bResult = true;
+    // only services with a process or a pending restart need attention
+    if (gServiceHot[unId].ptService != NULL && (gServiceHot[unId].nHandoverPid != -1 || gServiceHot[unId].nPid != -1 || gServiceHot[unId].unCrashes > 0))
+    {
+      bool bJob;
+      service *ptService = gServiceHot[unId].ptService;
+      const string &strService = gServiceNames[unId];
+      bJob = (!gJobQueues.empty() && gJobQueues.find(strService) != gJobQueues.end());
+      if (gServiceHot[unId].nHandoverPid != -1)
+      {
+        serviceHandover(unId);
+      }
+      // a service with a pending job or a stop under way is left to jobProcess() and serviceStopPoll()
+      if (gServiceHot[unId].nPid != -1 && !ptService->bStopping && !bJob)
+      {
+        healthCheck(unId);
+        if (!ptService->bStopped && (ptService->strHealth == "unhealthy" || !serviceRunning(unId)))
+        {
+          bool bCrashed = true;
+          if (ptService->strHealth != "unhealthy" && !ptService->strPidFile.empty())
+          {
+            pid_t nPid = serviceFollow(strService);
+            if (nPid == 0 && !ptService->bDetached)
+            {
+              time_t CTime[2];
+              ifstream inPid;
+              logMessage((string)"serviceScan() [" + strService + (string)"]:  Service detached.");
+              unStart = timeMonotonic();
+              time(&(CTime[0]));
+              usleep(250000);
+              time(&(CTime[1]));
+              while (nPid == 0 && (CTime[1] - CTime[0]) < 5)
+              {
+                inPid.open(ptService->strPidFile.c_str());
+                if (inPid)
+                {
+                  inPid >> nPid;
+                }
+                inPid.close();
+                usleep(100000);
+                time(&(CTime[1]));
+              }
+              statsRecord("pidFileWait", strService, unStart);
+              traceRecord("pidFileWait", strService, unStart);
+            }
+            if (nPid != 0)
+            {
+              ofstream outPid;
+              ssMessage.str("");
+              ssMessage << "serviceScan() [" << strService << "," << gServiceHot[unId].nPid << "," << nPid << "]:  Following the detached process.";
+              logMessage(ssMessage.str());
+              waitpid(gServiceHot[unId].nPid, NULL, WNOHANG);
+              ptService->bDetached = true;
+              processTrack(ptService, gServiceHot[unId].nPid, nPid);
+              if (gServiceHot[unId].fdPid != -1)
+              {
+                close(gServiceHot[unId].fdPid);
+              }
+              gServiceHot[unId].fdPid = syscall(SYS_pidfd_open, nPid, 0);
+              outPid.open((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
+              if (outPid)
+              {
+                bCrashed = false;
+                outPid << nPid << endl << processStart(nPid) << endl << "1" << endl;
+              }
+              else
+              {
+                ssMessage.str("");
+                ssMessage << "serviceScan()->ifstream::open(" << errno << ") error [" << strService << "," << gstrData << "/active/" << strService << ".pid]:  " << strerror(errno);
+                logMessage(ssMessage.str());
+              }
+              outPid.close();
+            }
+            else if (!ptService->bDetached)
+            {
+              ssMessage.str("");
+              ssMessage << "serviceScan()->ifstream::open(" << errno << ") error [" << strService << (string)"," + ptService->strPidFile << "]:  " << strerror(errno);
+              logMessage(ssMessage.str());
+            }
+          }
+          if (bCrashed)
+          {
+            // the stop runs as a job so a process which ignores its kill signal never blocks the event loop
+            jobAdd(((ptService->strHealth == "unhealthy")?"unhealthy":"crash"), strService);
+          }
+        }
+        else if (serviceIdle(unId))
+        {
+          logMessage((string)"serviceScan() [" + strService + (string)"]:  Stopping idle service.");
+          jobAdd("stop", strService);
+        }
+      }
+      if (!bJob && gServiceHot[unId].unCrashes > 0)
+      {
+        if (ptService->strRestart == "always" || ptService->strRestart == "on-failure")
+        {
+          if (gServiceHot[unId].unCrashes >= 10)
+          {
+            gServiceHot[unId].unCrashes = 0;
+            logMessage((string)"serviceScan() [" + strService + (string)"]:  Leaving service stopped due to too many crashes");
+            journalRecord(strService, "abandon", -1, ptService->nExitStatus, 0);
+          }
+          else
+          {
+            time_t CTime;
+            time(&CTime);
+            // a service which has stayed up for a minute since its delayed restart has recovered
+            if (gServiceHot[unId].nPid != -1)
+            {
+              if ((CTime - ptService->CStart) >= 60)
+              {
+                gServiceHot[unId].unCrashes = 0;
+              }
+            }
+            else if ((CTime - ptService->CStart) >= 60)
+            {
+              unStart = timeMonotonic();
+              if (serviceStart(strService, strError))
+              {
+                ptService->unRestarts++;
+                traceRecord("restart", strService, unStart);
+                journalRecord(strService, "restart", gServiceHot[unId].nPid, -1, ((timeMonotonic() - unStart) / 1000));
+              }
+              else
+              {
+                ptService->CStart = CTime;
+                gServiceHot[unId].unCrashes++;
+                logMessage((string)"serviceScan()->serviceStart() error [" + strService + (string)"]:  " + strError);
+              }
+            }
+          }
+        }
+        else
+        {
+          gServiceHot[unId].unCrashes = 0;
+        }
+      }
+    }
   }
+}
+// }}}
+// {{{ serviceSerialize()
+void serviceSerialize(const string strService, Json *ptState)
+{
+  map<string, string> state;
+  stringstream ssValue;
 
-  return bResult;
+  state["Adopted"] = ((gServices[strService]->bAdopted)?"1":"0");
+  state["Detached"] = ((gServices[strService]->bDetached)?"1":"0");
+  state["HandoverStopping"] = ((gServices[strService]->bHandoverStopping)?"1":"0");
+  state["Ready"] = ((gServices[strService]->bReady)?"1":"0");
+  state["Stopped"] = ((gServices[strService]->bStopped)?"1":"0");
+  state["Health"] = gServices[strService]->strHealth;
+  ssValue.str("");
+  ssValue << gServices[strService]->CHandover;
+  state["HandoverStart"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->CIdle;
+  state["Idle"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->CStart;
+  state["Start"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServiceHot[gServices[strService]->unId].nHandoverPid;
+  state["HandoverPid"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServiceHot[gServices[strService]->unId].nPid;
+  state["Pid"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServiceHot[gServices[strService]->unId].unCrashes;
+  state["Crashes"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->nExitStatus;
+  state["ExitStatus"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->nExitSignal;
+  state["ExitSignal"] = ssValue.str();
+  state["CoreDumped"] = ((gServices[strService]->bCoreDumped)?"1":"0");
+  state["ExitCause"] = gServices[strService]->strExitCause;
+  state["Stale"] = gServices[strService]->strStale;
+  ssValue.str("");
+  ssValue << gServices[strService]->unRestarts;
+  state["Restarts"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->unStarts;
+  state["Starts"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->unHealthCheckFailures;
+  state["HealthFailures"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->unHealthCheckLatency;
+  state["HealthLatency"] = ssValue.str();
+  ssValue.str("");
+  ssValue << gServices[strService]->unIdleCpu;
+  state["IdleCpu"] = ssValue.str();
+  for (map<string, string>::iterator i = state.begin(); i != state.end(); i++)
+  {
+    ptState->insert(i->first, i->second);
+  }
+  state.clear();
+  ptState->m["Listens"] = new Json;
+  for (vector<int>::iterator i = gServices[strService]->listens.begin(); i != gServices[strService]->listens.end(); i++)
+  {
+    Json *ptItem = new Json;
+    ssValue.str("");
+    ssValue << (*i);
+    ptItem->v = ssValue.str();
+    ptState->m["Listens"]->l.push_back(ptItem);
+  }
+  ptState->m["FdStore"] = new Json;
+  for (vector<pair<string, int> >::iterator i = gServices[strService]->fdstore.begin(); i != gServices[strService]->fdstore.end(); i++)
+  {
+    Json *ptItem = new Json;
+    ssValue.str("");
+    ssValue << i->second;
+    ptItem->insert("Fd", ssValue.str());
+    ptItem->insert("Name", i->first);
+    ptState->m["FdStore"]->l.push_back(ptItem);
+  }
 }
 // }}}
 // {{{ serviceStart()
 bool serviceStart(const string strService, string &strError)
 {
   bool bResult = false;
+  size_t unStart = timeMonotonic();
   stringstream ssMessage;
 
   if (serviceExist(strService, strError) && !serviceActive(strService, strError))
   {
-    char *args[100], *env[100], *pszArgument;
+    bool bLimit[2] = {false, false};
+    char szListenPid[32] = "LISTEN_PID=";
+    int fdExec[2] = {-1, -1}, nError = 0;
     pid_t nPid;
-    size_t unArgIndex = 0, unEnvIndex = 0;
-    string strArgument;
+    size_t unFork;
+    string strArgument, strExecutable, strLimits[2];
     stringstream ssExecStart;
-    if (!gServices[strService]->strExecStartPre.empty())
+    rlimit limits[2];
+    service *ptService = gServices[strService];
+    vector<char *> args, env;
+    vector<int> fdPassed, fdHigh;
+    vector<string> arguments, environment;
+    if (!ptService->strExecStartPre.empty())
     {
-      system(gServices[strService]->strExecStartPre.c_str());
+      size_t unHook = timeMonotonic();
+      system(ptService->strExecStartPre.c_str());
+      statsRecord("ExecStartPre", strService, unHook);
+      traceRecord("ExecStartPre", strService, unHook);
     }
-    ssExecStart.str(gServices[strService]->strExecStart);
+    // {{{ prepare
+    // everything the child needs is built before fork() since the other threads may hold the allocator or the log mutex
+    ssExecStart.str(ptService->strExecStart);
     while (ssExecStart >> strArgument)
     {
-      pszArgument = new char[strArgument.size() + 1];
-      strcpy(pszArgument, strArgument.c_str());
-      args[unArgIndex++] = pszArgument;
+      arguments.push_back(strArgument);
+    }
+    for (size_t i = 0; i < arguments.size(); i++)
+    {
+      args.push_back((char *)arguments[i].c_str());
+    }
+    args.push_back(NULL);
+    if (!arguments.empty())
+    {
+      strExecutable = arguments.front();
+    }
+    for (list<string>::iterator i = ptService->environment.begin(); i != ptService->environment.end(); i++)
+    {
+      environment.push_back(*i);
+    }
+    environment.push_back((string)"NOTIFY_SOCKET=" + gstrData + NOTIFY);
+    environment.push_back((string)"SVCMGR_SERVICE=" + strService);
+    if (!ptService->listens.empty() || !ptService->fdstore.empty())
+    {
+      string strNames;
+      for (vector<int>::iterator i = ptService->listens.begin(); i != ptService->listens.end(); i++)
+      {
+        fdPassed.push_back(*i);
+        strNames += (string)((!strNames.empty())?":":"") + (string)"listen";
+      }
+      for (vector<pair<string, int> >::iterator i = ptService->fdstore.begin(); i != ptService->fdstore.end(); i++)
+      {
+        fdPassed.push_back(i->second);
+        strNames += (string)((!strNames.empty())?":":"") + i->first;
+      }
+      fdHigh.resize(fdPassed.size(), -1);
+      ssMessage.str("");
+      ssMessage << "LISTEN_FDS=" << fdPassed.size();
+      environment.push_back(ssMessage.str());
+      environment.push_back((string)"LISTEN_FDNAMES=" + strNames);
     }
-    args[unArgIndex] = NULL;
-    if (!gServices[strService]->environment.empty())
+    if (ptService->environment.empty() && environ != NULL)
     {
-      for (list<string>::iterator i = gServices[strService]->environment.begin(); i != gServices[strService]->environment.end(); i++)
+      for (size_t i = 0; environ[i] != NULL; i++)
       {
-        strArgument = (*i);
-        pszArgument = new char[strArgument.size() + 1];
-        strcpy(pszArgument, strArgument.c_str());
-        env[unEnvIndex++] = pszArgument;
+        env.push_back(environ[i]);
       }
-      env[unEnvIndex] = NULL;
     }
-    strError.clear();
-    gpCentral->log((string)"serviceStart() [" + strService + (string)"]:  Starting service.");
-    if ((nPid = fork()) == 0)
+    for (size_t i = 0; i < environment.size(); i++)
     {
-      rlimit tResourceLimit;
-      // {{{ core limit
-      if (gServices[strService]->strLimitCore == "infinity")
+      env.push_back((char *)environment[i].c_str());
+    }
+    if (!fdPassed.empty())
+    {
+      // the child writes its own process ID here without allocating
+      env.push_back(szListenPid);
+    }
+    env.push_back(NULL);
+    for (int i = 0; i < 2; i++)
+    {
+      rlim_t soft = ((i == 0)?gResourceLimitCoreSoft:gResourceLimitNoFileSoft);
+      string strLimit = ((i == 0)?ptService->strLimitCore:ptService->strLimitNoFile);
+      if (strLimit == "infinity")
       {
-        tResourceLimit.rlim_cur = RLIM_INFINITY;
+        limits[i].rlim_cur = RLIM_INFINITY;
       }
       else
       {
-        stringstream ssLimit(gServices[strService]->strLimitCore);
-        ssLimit >> tResourceLimit.rlim_cur;
+        stringstream ssLimit(strLimit);
+        ssLimit >> limits[i].rlim_cur;
       }
-      tResourceLimit.rlim_max = gResourceLimitCoreHard;
-      if (gResourceLimitCoreSoft != RLIM_INFINITY && (tResourceLimit.rlim_cur == RLIM_INFINITY || tResourceLimit.rlim_cur > gResourceLimitCoreSoft))
+      limits[i].rlim_max = ((i == 0)?gResourceLimitCoreHard:gResourceLimitNoFileHard);
+      if (soft != RLIM_INFINITY && (limits[i].rlim_cur == RLIM_INFINITY || limits[i].rlim_cur > soft))
       {
-        tResourceLimit.rlim_cur = gResourceLimitCoreSoft;
+        limits[i].rlim_cur = soft;
       }
-      if (tResourceLimit.rlim_cur != gResourceLimitCoreSoft)
+      if (limits[i].rlim_cur != soft)
       {
-        if (setrlimit(RLIMIT_CORE, &tResourceLimit) == 0)
+        bLimit[i] = true;
+        ssMessage.str("");
+        if (limits[i].rlim_cur == RLIM_INFINITY)
         {
-          ssMessage.str("");
-          ssMessage << "serviceStart()->setrlimit() [" + strService + ",RLIMIT_CORE]:  Set the core limit to ";
-          if (tResourceLimit.rlim_cur == RLIM_INFINITY)
-          {
-            ssMessage << "infinity";
-          }
-          else
-          {
-            ssMessage << tResourceLimit.rlim_cur;
-          }
-          ssMessage << ".";
-          gpCentral->log(ssMessage.str());
+          ssMessage << "infinity";
         }
         else
         {
-          ssMessage.str("");
-          ssMessage << "serviceStart()->setrlimit(" << errno << ") error [" + strService + ",RLIMIT_CORE]:  " << strerror(errno);
-          gpCentral->notify(ssMessage.str());
+          ssMessage << limits[i].rlim_cur;
         }
+        strLimits[i] = ssMessage.str();
       }
-      // }}}
-      // {{{ file descriptor
-      if (gServices[strService]->strLimitNoFile == "infinity")
+    }
+    // }}}
+    strError.clear();
+    logMessage((string)"serviceStart() [" + strService + (string)"]:  Starting service.");
+    unFork = timeMonotonic();
+    // the child reports each failed step as a step and errno pair through a close-on-exec pipe which otherwise just closes
+    if (pipe2(fdExec, O_CLOEXEC) != 0)
+    {
+      fdExec[0] = fdExec[1] = -1;
+    }
+    else if (fdExec[1] < (int)(3 + fdPassed.size()))
+    {
+      // the write end must stay clear of the descriptors the passed ones are moved to
+      int fdWrite = fcntl(fdExec[1], F_DUPFD_CLOEXEC, (int)(3 + fdPassed.size()));
+      close(fdExec[1]);
+      fdExec[1] = fdWrite;
+    }
+    if ((nPid = fork()) == 0)
+    {
+      // only async-signal-safe calls are made until execve()
+      int nFailure[2];
+      if (setsid() < 0)
       {
-        tResourceLimit.rlim_cur = RLIM_INFINITY;
+        nFailure[0] = 1;
+        nFailure[1] = errno;
+        while (fdExec[1] != -1 && write(fdExec[1], nFailure, sizeof(nFailure)) < 0 && errno == EINTR);
       }
-      else
+      for (int i = 0; i < 2; i++)
       {
-        stringstream ssLimit(gServices[strService]->strLimitNoFile);
-        ssLimit >> tResourceLimit.rlim_cur;
+        if (bLimit[i] && setrlimit(((i == 0)?RLIMIT_CORE:RLIMIT_NOFILE), &limits[i]) != 0)
+        {
+          nFailure[0] = 2 + i;
+          nFailure[1] = errno;
+          while (fdExec[1] != -1 && write(fdExec[1], nFailure, sizeof(nFailure)) < 0 && errno == EINTR);
+        }
+      }
+      if (!fdPassed.empty())
+      {
+        char szDigits[20];
+        size_t unDigits = 0, unPosition = strlen(szListenPid);
+        for (pid_t nValue = getpid(); nValue > 0 && unDigits < sizeof(szDigits); nValue /= 10)
+        {
+          szDigits[unDigits++] = '0' + (nValue % 10);
+        }
+        while (unDigits > 0)
+        {
+          szListenPid[unPosition++] = szDigits[--unDigits];
+        }
+        szListenPid[unPosition] = '\0';
+        for (size_t i = 0; i < fdPassed.size(); i++)
+        {
+          fdHigh[i] = fcntl(fdPassed[i], F_DUPFD, (int)(3 + fdPassed.size()));
+        }
+        for (size_t i = 0; i < fdHigh.size(); i++)
+        {
+          dup2(fdHigh[i], (3 + i));
+          close(fdHigh[i]);
+        }
       }
-      tResourceLimit.rlim_max = gResourceLimitNoFileHard;
-      if (gResourceLimitNoFileSoft != RLIM_INFINITY && (tResourceLimit.rlim_cur == RLIM_INFINITY || tResourceLimit.rlim_cur > gResourceLimitNoFileSoft))
+      execve(args[0], args.data(), env.data());
+      nFailure[0] = 0;
+      nFailure[1] = errno;
+      while (fdExec[1] != -1 && write(fdExec[1], nFailure, sizeof(nFailure)) < 0 && errno == EINTR);
+      _exit(127);
+    }
+    else if (nPid > 0)
+    {
+      bool bFailed[2] = {false, false};
+      if (fdExec[1] != -1)
       {
-        tResourceLimit.rlim_cur = gResourceLimitNoFileSoft;
+        close(fdExec[1]);
       }
-      if (tResourceLimit.rlim_cur != gResourceLimitNoFileSoft)
+      if (fdExec[0] != -1)
       {
-        if (setrlimit(RLIMIT_NOFILE, &tResourceLimit) == 0)
+        int nFailure[2];
+        ssize_t nReturn;
+        while ((nReturn = read(fdExec[0], nFailure, sizeof(nFailure))) != 0)
         {
-          ssMessage.str("");
-          ssMessage << "serviceStart()->setrlimit() [" + strService + ",RLIMIT_NOFILE]:  Set the file descriptor limit to ";
-          if (tResourceLimit.rlim_cur == RLIM_INFINITY)
+          if (nReturn == (ssize_t)sizeof(nFailure))
           {
-            ssMessage << "infinity";
+            ssMessage.str("");
+            if (nFailure[0] == 0)
+            {
+              nError = nFailure[1];
+              ssMessage << "serviceStart()->execve(" << nError << ") error [" << strExecutable << "]:  " << strerror(nError);
+              logMessage(ssMessage.str());
+            }
+            else if (nFailure[0] == 1)
+            {
+              ssMessage << "serviceStart()->setsid(" << nFailure[1] << ") error [" << strService << "]:  " << strerror(nFailure[1]);
+              logMessage(ssMessage.str());
+            }
+            else
+            {
+              bFailed[nFailure[0] - 2] = true;
+              ssMessage << "serviceStart()->setrlimit(" << nFailure[1] << ") error [" << strService << "," << ((nFailure[0] == 2)?"RLIMIT_CORE":"RLIMIT_NOFILE") << "]:  " << strerror(nFailure[1]);
+              logNotify(ssMessage.str());
+            }
           }
-          else
+          else if (nReturn > 0 || errno != EINTR)
           {
-            ssMessage << tResourceLimit.rlim_cur;
+            break;
           }
-          ssMessage << ".";
-          gpCentral->log(ssMessage.str());
+        }
+        close(fdExec[0]);
+      }
+      for (int i = 0; i < 2; i++)
+      {
+        if (bLimit[i] && !bFailed[i])
+        {
+          logMessage((string)"serviceStart()->setrlimit() [" + strService + (string)((i == 0)?",RLIMIT_CORE]:  Set the core limit to ":",RLIMIT_NOFILE]:  Set the file descriptor limit to ") + strLimits[i] + (string)".");
+        }
+      }
+      if (nError != 0)
+      {
+        int nStatus;
+        rusage tUsage;
+        if (wait4(nPid, &nStatus, 0, &tUsage) == nPid)
+        {
+          serviceExited(strService, nStatus, tUsage);
+        }
+        ssMessage.str("");
+        ssMessage << "execve(" << nError << ") error [" << strExecutable << "]:  " << strerror(nError);
+        strError = ssMessage.str();
+        gServices[strService]->strExitCause = (string)"failed to execute " + strExecutable + (string)":  " + strerror(nError);
+        journalRecord(strService, "failed", nPid, gServices[strService]->nExitStatus, 0);
+      }
+      else
+      {
+        ofstream outService;
+        traceRecord("fork", strService, unFork);
+        bResult = true;
+        time(&(gServices[strService]->CStart));
+        gServices[strService]->CIdle = gServices[strService]->CStart;
+        gServices[strService]->bReady = false;
+        gServices[strService]->unIdleCpu = 0;
+        processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nPid, nPid);
+        gServiceHot[gServices[strService]->unId].fdPid = syscall(SYS_pidfd_open, nPid, 0);
+        outService.open((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
+        if (outService)
+        {
+          outService << nPid << endl << processStart(nPid) << endl << "0" << endl;
         }
         else
         {
           ssMessage.str("");
-          ssMessage << "serviceStart()->setrlimit(" << errno << ") error [" + strService + ",RLIMIT_NOFILE]:  " << strerror(errno);
-          gpCentral->notify(ssMessage.str());
+          ssMessage << "serviceStart()->ifstream::open(" << errno << ") error [" << gstrData << "/active/" << strService << ".pid]:  " << strerror(errno);
+          logMessage(ssMessage.str());
+        }
+        outService.close();
+        gServices[strService]->bStopped = false;
+        if (!gServices[strService]->strHealthCheckType.empty())
+        {
+          gServices[strService]->strHealth = "unknown";
+          gServices[strService]->unHealthCheckFailures = 0;
+          gServices[strService]->unHealthCheckStart = timeMonotonic();
+        }
+        if (!gServices[strService]->strExecStartPost.empty())
+        {
+          size_t unHook = timeMonotonic();
+          system(gServices[strService]->strExecStartPost.c_str());
+          statsRecord("ExecStartPost", strService, unHook);
+          traceRecord("ExecStartPost", strService, unHook);
         }
+        logMessage((string)"serviceStart() [" + strService + (string)"]:  Started service.");
       }
-      // }}}
-      execve(args[0], args, ((unEnvIndex > 0)?env:environ));
+    }
+    else
+    {
       ssMessage.str("");
-      ssMessage << "serviceStart()->execve(" << errno << ") error [" << args[0] << "]:  " << strerror(errno);
-      gpCentral->log(ssMessage.str());
-      _exit(1);
+      ssMessage << "fork(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+      if (fdExec[0] != -1)
+      {
+        close(fdExec[0]);
+        close(fdExec[1]);
+      }
     }
-    else if (nPid > 0)
+  }
+
+  if (bResult)
+  {
+    gServices[strService]->strStale.clear();
+    gServices[strService]->unStarts++;
+    gServices[strService]->unStartDuration = (timeMonotonic() - unStart) / 1000;
+    journalRecord(strService, "start", gServiceHot[gServices[strService]->unId].nPid, -1, gServices[strService]->unStartDuration);
+  }
+  statsRecord("serviceStart", strService, unStart);
+  traceRecord("serviceStart", strService, unStart);
+  return bResult;
+}
+// }}}
+// {{{ serviceState()
+string serviceState(const string strService)
+{
+  string strState = ((!gServices[strService]->listens.empty())?"listening":"enabled");
+
+  if (gServiceHot[gServices[strService]->unId].nPid != -1)
+  {
+    strState = "active";
+    if (!gServices[strService]->strHealthCheckType.empty())
+    {
+      stringstream ssState;
+      ssState << strState << " (" << gServices[strService]->strHealth;
+      if (gServices[strService]->strHealth != "unknown")
+      {
+        ssState << ", " << gServices[strService]->unHealthCheckLatency << " ms";
+      }
+      ssState << ")";
+      strState = ssState.str();
+    }
+  }
+
+  return strState;
+}
+// }}}
+// {{{ serviceStatus()
+bool serviceStatus(const string strService, map<string, string> &status, string &strError)
+{
+  bool bResult = false;
+
+  if (serviceValid(strService, strError))
+  {
+    if (gServices.find(strService) != gServices.end())
     {
-      ofstream outService;
+      list<pid_t> processes;
+      stringstream ssValue;
       bResult = true;
-      time(&(gServices[strService]->CStart));
-      gServices[strService]->nPid = nPid;
-      outService.open((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
-      if (outService)
+      status["State"] = ((gServiceHot[gServices[strService]->unId].nPid != -1)?"active":((!gServices[strService]->listens.empty())?"listening":"enabled"));
+      if (!gServices[strService]->strDescription.empty())
       {
-        outService << nPid << endl;
+        status["Description"] = gServices[strService]->strDescription;
       }
-      else
+      status["Restart"] = gServices[strService]->strRestart;
+      if (!gServices[strService]->strStale.empty())
       {
-        ssMessage.str("");
-        ssMessage << "serviceStart()->ifstream::open(" << errno << ") error [" << gstrData << "/active/" << strService << ".pid]:  " << strerror(errno);
-        gpCentral->log(ssMessage.str());
+        status["Stale"] = gServices[strService]->strStale;
+      }
+      ssValue << gServiceHot[gServices[strService]->unId].unCrashes;
+      status["Crashes"] = ssValue.str();
+      if (!gServices[strService]->strExitCause.empty())
+      {
+        const rusage &tUsage = gServices[strService]->tUsage;
+        status["LastExit"] = gServices[strService]->strExitCause;
+        if (tUsage.ru_maxrss > 0)
+        {
+          ssValue.str("");
+          ssValue << "max RSS " << tUsage.ru_maxrss << " KiB, user " << tUsage.ru_utime.tv_sec << "." << setw(3) << setfill('0') << (tUsage.ru_utime.tv_usec / 1000) << " s, system " << tUsage.ru_stime.tv_sec << "." << setw(3) << setfill('0') << (tUsage.ru_stime.tv_usec / 1000) << " s, " << tUsage.ru_nvcsw << " voluntary and " << tUsage.ru_nivcsw << " involuntary context switches";
+          status["LastUsage"] = ssValue.str();
+        }
+      }
+      if (gServiceHot[gServices[strService]->unId].nPid != -1)
+      {
+        char szTime[32];
+        struct tm tTime;
+        ssValue.str("");
+        ssValue << gServiceHot[gServices[strService]->unId].nPid;
+        status["Pid"] = ssValue.str();
+        if (gServices[strService]->bAdopted)
+        {
+          status["Adopted"] = "yes";
+        }
+        ssValue.str("");
+        ssValue << serviceProcesses(strService, processes).size();
+        status["Processes"] = ssValue.str();
+        processes.clear();
+        localtime_r(&(gServices[strService]->CStart), &tTime);
+        strftime(szTime, sizeof(szTime), "%Y-%m-%d %H:%M:%S", &tTime);
+        status["Start"] = szTime;
       }
-      outService.close();
-      gServices[strService]->bStopped = false;
-      if (!gServices[strService]->strExecStartPost.empty())
+      if (!gServices[strService]->fdstore.empty())
       {
-        system(gServices[strService]->strExecStartPost.c_str());
+        ssValue.str("");
+        ssValue << gServices[strService]->fdstore.size();
+        status["FileDescriptorStore"] = ssValue.str();
+      }
+      if (gServiceHot[gServices[strService]->unId].nHandoverPid != -1)
+      {
+        ssValue.str("");
+        ssValue << gServiceHot[gServices[strService]->unId].nHandoverPid << ((gServices[strService]->bHandoverStopping)?" (stopping)":" (waiting for replacement)");
+        status["HandoverPid"] = ssValue.str();
+      }
+      if (!gServices[strService]->strHealthCheckType.empty())
+      {
+        status["HealthCheck"] = gServices[strService]->strHealthCheckType;
+        if (gServiceHot[gServices[strService]->unId].nPid != -1)
+        {
+          status["Health"] = gServices[strService]->strHealth;
+          ssValue.str("");
+          ssValue << gServices[strService]->unHealthCheckFailures << "/" << gServices[strService]->unHealthCheckThreshold;
+          status["HealthFailures"] = ssValue.str();
+          if (gServices[strService]->strHealth != "unknown")
+          {
+            ssValue.str("");
+            ssValue << gServices[strService]->unHealthCheckLatency << " ms";
+            status["HealthLatency"] = ssValue.str();
+          }
+        }
       }
-      gpCentral->log((string)"serviceStart() [" + strService + (string)"]:  Started service.");
+    }
+    else if (gpCentral->file()->fileExist(gstrData + (string)"/enabled/" + strService + (string)".service"))
+    {
+      bResult = true;
+      status["State"] = "enabled";
+    }
+    else if (gpCentral->file()->fileExist(gstrData + (string)"/services/" + strService + (string)".service"))
+    {
+      bResult = true;
+      status["State"] = "disabled";
     }
     else
     {
-      ssMessage.str("");
-      ssMessage << "fork(" << errno << ") " << strerror(errno);
-      strError = ssMessage.str();
+      strError = "Failed to find service.";
     }
-    for (size_t i = 0; i < unArgIndex; i++)
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceStop()
+bool serviceStop(const string strService, string &strError)
+{
+  bool bResult = false;
+  size_t unStart = timeMonotonic();
+
+  if (serviceStopBegin(strService, strError))
+  {
+    while (!serviceStopPoll(strService, bResult, strError))
     {
-      delete args[i];
+      usleep(100000);
     }
-    for (size_t i = 0; i < unEnvIndex; i++)
+  }
+  else
+  {
+    statsRecord("serviceStop", strService, unStart);
+    traceRecord("serviceStop", strService, unStart);
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ serviceStopBegin()
+bool serviceStopBegin(const string strService, string &strError)
+{
+  bool bResult = false;
+  stringstream ssMessage;
+
+  if (serviceActive(strService, strError))
+  {
+    bResult = true;
+    // a stop which is already under way is left to finish
+    if (!gServices[strService]->bStopping)
     {
-      delete env[i];
+      pid_t nGroup = getpgid(gServiceHot[gServices[strService]->unId].nPid);
+      logMessage((string)"serviceStop() [" + strService + (string)"]:  Stopping service.");
+      gServices[strService]->bStopDiagnosed = false;
+      gServices[strService]->bStopMain = false;
+      gServices[strService]->bStopped = true;
+      gServices[strService]->bStopping = true;
+      gServices[strService]->unStopStart = timeMonotonic();
+      healthCheckCancel(strService);
+      if (gServiceHot[gServices[strService]->unId].nHandoverPid != -1)
+      {
+        ssMessage.str("");
+        ssMessage << "serviceStop() [" << strService << "," << gServiceHot[gServices[strService]->unId].nHandoverPid << "]:  Killing the previous instance of an unfinished handover.";
+        logMessage(ssMessage.str());
+        kill(((gServices[strService]->strKillMode != "process" && getpgid(gServiceHot[gServices[strService]->unId].nHandoverPid) == gServiceHot[gServices[strService]->unId].nHandoverPid)?-gServiceHot[gServices[strService]->unId].nHandoverPid:gServiceHot[gServices[strService]->unId].nHandoverPid), SIGKILL);
+        waitpid(gServiceHot[gServices[strService]->unId].nHandoverPid, NULL, 0);
+        gServices[strService]->bHandoverStopping = false;
+        processTrack(gServices[strService], gServiceHot[gServices[strService]->unId].nHandoverPid, -1);
+      }
+      if (nGroup <= 0 || nGroup == getpgrp())
+      {
+        nGroup = -1;
+      }
+      gServices[strService]->nStopGroup = nGroup;
+      gServices[strService]->unStopWait = timeMonotonic();
+      serviceKill(strService, nGroup, gServices[strService]->nKillSignal, false);
     }
   }
 
   return bResult;
 }
 // }}}
-// {{{ serviceStop()
-bool serviceStop(const string strService, string &strError)
+// {{{ serviceStopPoll()
+bool serviceStopPoll(const string strService, bool &bResult, string &strError)
 {
-  bool bResult = false;
+  bool bExit = false;
   stringstream ssMessage;
 
-  if (serviceActive(strService, strError))
+  bResult = false;
+  if (gServices.find(strService) == gServices.end() || !gServices[strService]->bStopping)
+  {
+    // another caller already finished the stop
+    bExit = true;
+    bResult = (gServices.find(strService) == gServices.end() || gServiceHot[gServices[strService]->unId].nPid == -1);
+    if (!bResult)
+    {
+      strError = "The service was started again before its stop finished.";
+    }
+  }
+  else
   {
-    int nStatus;
-    gpCentral->log((string)"serviceStop() [" + strService + (string)"]:  Stopping service.");
-    gServices[strService]->bStopped = true;
-    if (kill(gServices[strService]->nPid, SIGTERM) == 0 || errno == ESRCH)
+    service *ptService = gServices[strService];
+    pid_t nGroup = ptService->nStopGroup;
+    size_t unLead = min((size_t)10, (ptService->unTimeoutStopSec / 2)), unStart = ptService->unStopStart;
+    if (!ptService->bStopMain)
     {
-      bool bExit = false;
-      time_t CTime[2];
-      time(&(CTime[0]));
-      while (!bExit)
+      int nStatus;
+      rusage tUsage;
+      pid_t nReturn = wait4(gServiceHot[ptService->unId].nPid, &nStatus, WNOHANG, &tUsage);
+      if (nReturn == gServiceHot[ptService->unId].nPid || (nReturn < 0 && errno == ECHILD && !serviceRunning(ptService->unId)))
       {
-        if (waitpid(gServices[strService]->nPid, &nStatus, 0) == gServices[strService]->nPid || errno == ECHILD)
+        ptService->bStopMain = true;
+        if (nReturn == gServiceHot[ptService->unId].nPid)
         {
-          bExit = bResult = true;
-          gServices[strService]->bDetached = false;
-          gServices[strService]->nPid = -1;
-          remove((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
-          if (!gServices[strService]->strExecStopPost.empty())
-          {
-            system(gServices[strService]->strExecStopPost.c_str());
-          }
-          gpCentral->log((string)"serviceStop() [" + strService + (string)"]:  Stopped service.");
+          serviceExited(strService, nStatus, tUsage);
         }
-        else if (errno != EINTR)
+        else
         {
-          bExit = true;
-          ssMessage.str("");
-          ssMessage << "waitpid(" << errno << ") " << strerror(errno);
-          strError = ssMessage.str();
+          // a followed or adopted process is not our child so its status is lost
+          ptService->bCoreDumped = false;
+          ptService->nExitSignal = 0;
+          ptService->nExitStatus = -1;
+          ptService->strExitCause = "exited with an unknown status";
+          memset(&(ptService->tUsage), 0, sizeof(rusage));
         }
-        if (!bResult)
+        if (ptService->strKillMode == "mixed")
         {
-          usleep(250000);
-          time(&(CTime[1]));
-          if ((CTime[1] - CTime[0]) >= 300)
-          {
-            bExit = true;
-          }
+          serviceKill(strService, nGroup, SIGKILL, true);
         }
       }
+      else if (nReturn < 0 && errno != EINTR && errno != ECHILD)
+      {
+        bExit = true;
+        ssMessage.str("");
+        ssMessage << "waitpid(" << errno << ") " << strerror(errno);
+        strError = ssMessage.str();
+      }
+    }
+    processReap();
+    if (ptService->bStopMain && !serviceKill(strService, nGroup, 0, true))
+    {
+      bExit = bResult = true;
+      ptService->bAdopted = false;
+      ptService->bDetached = false;
+      journalRecord(strService, "stop", gServiceHot[ptService->unId].nPid, ptService->nExitStatus, ((timeMonotonic() - unStart) / 1000));
+      processTrack(ptService, gServiceHot[ptService->unId].nPid, -1);
+      traceRecord("stopWait", strService, ptService->unStopWait);
+      remove((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
+      if (!ptService->strExecStopPost.empty())
+      {
+        size_t unHook = timeMonotonic();
+        system(ptService->strExecStopPost.c_str());
+        statsRecord("ExecStopPost", strService, unHook);
+        traceRecord("ExecStopPost", strService, unHook);
+      }
+      logMessage((string)"serviceStop() [" + strService + (string)"]:  Stopped service.");
+    }
+    else if (!bExit)
+    {
+      if ((timeMonotonic() - unStart) >= (ptService->unTimeoutStopSec * 1000000000))
+      {
+        bExit = true;
+      }
+      // leave the diagnostics some time to finish before the escalation
+      else if (!ptService->bStopDiagnosed && !ptService->bStopMain && !ptService->strStopDiagnostics.empty() && (timeMonotonic() - unStart) >= ((ptService->unTimeoutStopSec - unLead) * 1000000000))
+      {
+        ptService->bStopDiagnosed = true;
+        serviceDiagnose(strService);
+      }
+    }
+    if (bExit)
+    {
       if (!bResult)
       {
-        if (kill(gServices[strService]->nPid, SIGKILL) == 0 || errno == ESRCH)
+        serviceKill(strService, nGroup, SIGKILL, true);
+        if (kill(gServiceHot[ptService->unId].nPid, SIGKILL) == 0 || errno == ESRCH)
         {
           bResult = true;
-          gServices[strService]->nPid = -1;
+          traceRecord("stopWait", strService, ptService->unStopWait);
+          ptService->nExitSignal = SIGKILL;
+          ptService->nExitStatus = 128 + SIGKILL;
+          ptService->strExitCause = "killed by signal 9 after the stop timeout";
+          journalRecord(strService, "kill", gServiceHot[ptService->unId].nPid, ptService->nExitStatus, ((timeMonotonic() - unStart) / 1000));
+          ptService->bAdopted = false;
+          ptService->bDetached = false;
+          processTrack(ptService, gServiceHot[ptService->unId].nPid, -1);
           remove((gstrData + (string)"/active/" + strService + (string)".pid").c_str());
-          if (!gServices[strService]->strExecStopPost.empty())
+          if (!ptService->strExecStopPost.empty())
           {
-            system(gServices[strService]->strExecStopPost.c_str());
+            size_t unHook = timeMonotonic();
+            system(ptService->strExecStopPost.c_str());
+            statsRecord("ExecStopPost", strService, unHook);
+            traceRecord("ExecStopPost", strService, unHook);
           }
-          gpCentral->log((string)"serviceStop() [" + strService + (string)"]:  Stopped service forcefully.");
+          logMessage((string)"serviceStop() [" + strService + (string)"]:  Stopped service forcefully.");
         }
         else
         {
@@ -1480,16 +8229,31 @@ bool serviceStop(const string strService, string &strError)
           strError = ssMessage.str();
         }
       }
-    }
-    else
-    {
-      ssMessage.str("");
-      ssMessage << "kill(" << errno << ") " << strerror(errno);
-      strError = ssMessage.str();
+      if (bResult)
+      {
+        if (gServiceHot[ptService->unId].fdPid != -1)
+        {
+          close(gServiceHot[ptService->unId].fdPid);
+          gServiceHot[ptService->unId].fdPid = -1;
+        }
+        if (ptService->listens.empty() && (!ptService->listenStream.empty() || !ptService->listenDatagram.empty()))
+        {
+          string strListenError;
+          if (!serviceListen(strService, strListenError))
+          {
+            logMessage((string)"serviceStop()->serviceListen() error [" + strService + (string)"]:  " + strListenError);
+            serviceUnlisten(strService);
+          }
+        }
+        ptService->unStopDuration = (timeMonotonic() - unStart) / 1000;
+      }
+      ptService->bStopping = false;
+      statsRecord("serviceStop", strService, unStart);
+      traceRecord("serviceStop", strService, unStart);
     }
   }
 
-  return bResult;
+  return bExit;
 }
 // }}}
 // {{{ serviceUnlink()
@@ -1525,6 +8289,31 @@ bool serviceUnlink(const string strService, string &strError)
   return bResult;
 }
 // }}}
+// {{{ serviceUnlisten()
+void serviceUnlisten(const string strService)
+{
+  for (vector<int>::iterator i = gServices[strService]->listens.begin(); i != gServices[strService]->listens.end(); i++)
+  {
+    close(*i);
+  }
+  gServices[strService]->listens.clear();
+  gServiceHot[gServices[strService]->unId].bListening = false;
+  for (list<string>::iterator i = gServices[strService]->listenStream.begin(); i != gServices[strService]->listenStream.end(); i++)
+  {
+    if ((*i)[0] == '/')
+    {
+      remove(i->c_str());
+    }
+  }
+  for (list<string>::iterator i = gServices[strService]->listenDatagram.begin(); i != gServices[strService]->listenDatagram.end(); i++)
+  {
+    if ((*i)[0] == '/')
+    {
+      remove(i->c_str());
+    }
+  }
+}
+// }}}
 // {{{ serviceValid()
 bool serviceValid(const string strService, string &strError)
 {
@@ -1552,37 +8341,536 @@ bool serviceValid(const string strService, string &strError)
 // }}}
 // {{{ sighandle()
 void sighandle(const int nSignal, siginfo_t *ptInfo, void *vptContext)
+{
+  // only async-signal-safe stores happen here since the event loop may be mid-mutation
+  if (nSignal > 0 && nSignal < NSIG)
+  {
+    gnSignalPids[nSignal] = ptInfo->si_pid;
+    gbSignals[nSignal] = 1;
+  }
+}
+// }}}
+// {{{ signalDispatch()
+void signalDispatch()
 {
   pid_t nPid = getpid();
+
+  for (int nSignal = 1; nSignal < NSIG; nSignal++)
+  {
+    if (gbSignals[nSignal])
+    {
+      pid_t nSender;
+      unordered_map<pid_t, service *>::iterator i;
+      gbSignals[nSignal] = 0;
+      nSender = gnSignalPids[nSignal];
+      if (nPid != nSender && nSignal != SIGCHLD && ((i = gPids.find(nSender)) == gPids.end() || gServiceHot[i->second->unId].nPid != nSender))
+      {
+        string strSignal;
+        stringstream ssMessage;
+        ssMessage << "sighandle(" << nSignal << "):  " << sigstring(strSignal, nSignal);
+        if (nSignal == SIGHUP)
+        {
+          logMessage(ssMessage.str());
+          gbReload = true;
+        }
+        else
+        {
+          if (nSignal == SIGINT || nSignal == SIGTERM)
+          {
+            logMessage(ssMessage.str());
+          }
+          else
+          {
+            logNotify(ssMessage.str());
+          }
+          gbShutdown = true;
+        }
+      }
+    }
+  }
+}
+// }}}
+// {{{ signalNumber()
+int signalNumber(const string strSignal)
+{
+  int nSignal = 0;
+
+  if (!strSignal.empty() && isdigit(strSignal[0]))
+  {
+    nSignal = atoi(strSignal.c_str());
+  }
+  else
+  {
+    map<string, int> signals;
+    string strName = ((strSignal.size() > 3 && strSignal.substr(0, 3) == "SIG")?strSignal.substr(3, strSignal.size() - 3):strSignal);
+    signals["ABRT"] = SIGABRT;
+    signals["ALRM"] = SIGALRM;
+    signals["CONT"] = SIGCONT;
+    signals["HUP"] = SIGHUP;
+    signals["INT"] = SIGINT;
+    signals["KILL"] = SIGKILL;
+    signals["PWR"] = SIGPWR;
+    signals["QUIT"] = SIGQUIT;
+    signals["STOP"] = SIGSTOP;
+    signals["TERM"] = SIGTERM;
+    signals["USR1"] = SIGUSR1;
+    signals["USR2"] = SIGUSR2;
+    signals["WINCH"] = SIGWINCH;
+    if (signals.find(strName) != signals.end())
+    {
+      nSignal = signals[strName];
+    }
+    signals.clear();
+  }
+
+  return nSignal;
+}
+// }}}
+// {{{ stats
+// {{{ statsBucketMax()
+size_t statsBucketMax(const size_t unBucket)
+{
+  // buckets below 8 are exact and the rest hold 8 linear steps per power of two
+  return ((unBucket < 8)?unBucket:(((8 + (unBucket % 8) + 1) << ((unBucket / 8) - 1)) - 1));
+}
+// }}}
+// {{{ statsPercentile()
+size_t statsPercentile(const string strHistogram, const double dPercentile)
+{
+  size_t unResult = 0;
+
+  if (gHistograms.find(strHistogram) != gHistograms.end() && gHistograms[strHistogram].unCount > 0)
+  {
+    size_t unRank = (size_t)((dPercentile / 100) * gHistograms[strHistogram].unCount), unSeen = 0;
+    if (unRank == 0)
+    {
+      unRank = 1;
+    }
+    for (size_t i = 0; unResult == 0 && i < HISTOGRAM_BUCKETS; i++)
+    {
+      unSeen += gHistograms[strHistogram].buckets[i];
+      if (unSeen >= unRank)
+      {
+        unResult = statsBucketMax(i);
+        if (unResult > gHistograms[strHistogram].unMax)
+        {
+          unResult = gHistograms[strHistogram].unMax;
+        }
+      }
+    }
+  }
+
+  return unResult;
+}
+// }}}
+// {{{ statsRecord()
+void statsRecord(const string strOperation, const string strDetail, const size_t unStart)
+{
+  size_t unDuration = timeMonotonic() - unStart;
+
+  statsValue(strOperation, (unDuration / 1000));
+  if (!gstrStall.empty() && unStart <= gunStallStart)
+  {
+    gstrStall = strOperation + ((!strDetail.empty())?((string)"(" + strDetail + (string)")"):"") + (string)" > " + gstrStall;
+  }
+  else if (unDuration > gunStall)
+  {
+    gunStall = unDuration;
+    gunStallStart = unStart;
+    gstrStall = strOperation + ((!strDetail.empty())?((string)"(" + strDetail + (string)")"):"");
+  }
+}
+// }}}
+// {{{ statsSummary()
+void statsSummary(map<string, string> &stats)
+{
+  stringstream ssValue;
+
+  for (map<string, histogram>::iterator i = gHistograms.begin(); i != gHistograms.end(); i++)
+  {
+    size_t values[5] = {(i->second.unSum / i->second.unCount), statsPercentile(i->first, 50), statsPercentile(i->first, 90), statsPercentile(i->first, 99), i->second.unMax};
+    string names[5] = {"mean", "p50", "p90", "p99", "max"};
+    ssValue.str("");
+    ssValue << "count " << i->second.unCount;
+    for (size_t j = 0; j < 5; j++)
+    {
+      ssValue << ", " << names[j] << " " << (values[j] / 1000) << "." << ((values[j] % 1000 < 100)?"0":"") << ((values[j] % 1000 < 10)?"0":"") << (values[j] % 1000);
+    }
+    ssValue << " ms";
+    stats[i->first] = ssValue.str();
+  }
+  ssValue.str("");
+  ssValue << gunStalls << " over " << gunStallThreshold << " ms";
+  stats["stalls"] = ssValue.str();
+  ssValue.str("");
+  ssValue << "written " << gunLogWritten << ", batches " << gunLogBatches << ", queued " << (gunLogTail - gunLogHead) << ", dropped " << gunLogDropped;
+  stats["log"] = ssValue.str();
+  ssValue.str("");
+  ssValue << "received " << gunNotifyReceived << ", sent " << gunNotifySent << ", suppressed " << gunNotifySuppressed;
+  stats["notify"] = ssValue.str();
+  ssValue.str("");
+  ssValue << "cached " << gunDefinitionsCached << ", parsed " << gunDefinitionsParsed;
+  stats["definitions"] = ssValue.str();
+  ssValue.str("");
+  gCoreMutex.lock();
+  ssValue << "compressed " << gunCoresCompressed << ", removed " << gunCoresRemoved << ", awaiting " << gCrashes.size();
+  gCoreMutex.unlock();
+  stats["cores"] = ssValue.str();
+}
+// }}}
+// {{{ statsValue()
+void statsValue(const string strHistogram, const size_t unValue)
+{
+  size_t unBucket = unValue;
+  histogram *ptHistogram = &gHistograms[strHistogram];
+
+  if (unValue >= 8)
+  {
+    size_t unMagnitude = (sizeof(unsigned long) * 8) - 1 - __builtin_clzl(unValue);
+    unBucket = ((unMagnitude - 2) * 8) + ((unValue >> (unMagnitude - 3)) & 7);
+  }
+  if (unBucket >= HISTOGRAM_BUCKETS)
+  {
+    unBucket = HISTOGRAM_BUCKETS - 1;
+  }
+  ptHistogram->buckets[unBucket]++;
+  ptHistogram->unCount++;
+  ptHistogram->unSum += unValue;
+  if (unValue > ptHistogram->unMax)
+  {
+    ptHistogram->unMax = unValue;
+  }
+}
+// }}}
+// }}}
+// {{{ threadSignals()
+void threadSignals()
+{
+  sigset_t tSet;
+
+  sigfillset(&tSet);
+  pthread_sigmask(SIG_BLOCK, &tSet, NULL);
+}
+// }}}
+// {{{ timeMonotonic()
+size_t timeMonotonic()
+{
+  timespec tTime;
+
+  clock_gettime(CLOCK_MONOTONIC, &tTime);
+
+  return ((size_t)tTime.tv_sec * 1000000000) + tTime.tv_nsec;
+}
+// }}}
+// {{{ trace
+// {{{ traceExport()
+void traceExport(Json *ptTrace)
+{
+  char szTime[32];
+  map<string, size_t> lanes;
+  Json *ptEvent;
+  stringstream ssValue;
+
+  ptTrace->insert("displayTimeUnit", "ms");
+  ptTrace->m["traceEvents"] = new Json;
+  ptEvent = new Json;
+  ptEvent->insert("name", "process_name");
+  ptEvent->insert("ph", "M");
+  ssValue.str("");
+  ssValue << getpid();
+  ptEvent->insert("pid", ssValue.str(), 'n');
+  ptEvent->insert("tid", "0", 'n');
+  ptEvent->m["args"] = new Json;
+  ptEvent->m["args"]->insert("name", "svcmgrd");
+  ptTrace->m["traceEvents"]->l.push_back(ptEvent);
+  lanes[""] = 0;
+  for (size_t i = ((gunSpans > TRACE_SPANS)?(gunSpans - TRACE_SPANS):0); i < gunSpans; i++)
+  {
+    span *ptSpan = &gSpans[i % TRACE_SPANS];
+    if (lanes.find(ptSpan->strService) == lanes.end())
+    {
+      size_t unLane = lanes.size();
+      lanes[ptSpan->strService] = unLane;
+      ssValue.str("");
+      ssValue << unLane;
+      ptEvent = new Json;
+      ptEvent->insert("name", "thread_name");
+      ptEvent->insert("ph", "M");
+      ptEvent->insert("pid", ptTrace->m["traceEvents"]->l.front()->m["pid"]->v, 'n');
+      ptEvent->insert("tid", ssValue.str(), 'n');
+      ptEvent->m["args"] = new Json;
+      ptEvent->m["args"]->insert("name", ptSpan->strService);
+      ptTrace->m["traceEvents"]->l.push_back(ptEvent);
+    }
+    ptEvent = new Json;
+    ptEvent->insert("name", ptSpan->strName);
+    ptEvent->insert("cat", ((ptSpan->strService.empty())?"daemon":"service"));
+    ptEvent->insert("ph", "X");
+    ptEvent->insert("pid", ptTrace->m["traceEvents"]->l.front()->m["pid"]->v, 'n');
+    ssValue.str("");
+    ssValue << lanes[ptSpan->strService];
+    ptEvent->insert("tid", ssValue.str(), 'n');
+    // the viewer expects microseconds so the nanoseconds are kept as the fraction
+    snprintf(szTime, sizeof(szTime), "%zu.%03zu", (ptSpan->unStart / 1000), (ptSpan->unStart % 1000));
+    ptEvent->insert("ts", szTime, 'n');
+    snprintf(szTime, sizeof(szTime), "%zu.%03zu", (ptSpan->unDuration / 1000), (ptSpan->unDuration % 1000));
+    ptEvent->insert("dur", szTime, 'n');
+    if (!ptSpan->strService.empty())
+    {
+      ptEvent->m["args"] = new Json;
+      ptEvent->m["args"]->insert("service", ptSpan->strService);
+    }
+    ptTrace->m["traceEvents"]->l.push_back(ptEvent);
+  }
+}
+// }}}
+// {{{ traceRecord()
+void traceRecord(const string strName, const string strService, const size_t unStart)
+{
+  span *ptSpan = &gSpans[gunSpans++ % TRACE_SPANS];
+
+  ptSpan->unStart = unStart;
+  ptSpan->unDuration = timeMonotonic() - unStart;
+  ptSpan->strName = strName;
+  ptSpan->strService = strService;
+}
+// }}}
+// }}}
+// {{{ upgrade()
+bool upgrade(int argc, char *argv[], const int fdUnix, const int fdNotify, map<int, vector<string> > &sockets, string &strError)
+{
+  bool bResult = false;
+  int fdState;
+  list<int> inherited;
   stringstream ssMessage;
 
-  if (nPid != ptInfo->si_pid && nSignal != SIGCHLD)
+  if ((fdState = memfd_create("svcmgrd", 0)) >= 0)
   {
-    bool bUse = true;
-    for (map<string, service *>::iterator i = gServices.begin(); bUse && i != gServices.end(); i++)
+    char *args[100];
+    size_t unArgIndex = 0;
+    string strJson, strUpgrade;
+    Json *ptState = new Json;
+    logMessage((string)"upgrade() [" + gstrBinary + (string)"]:  Upgrading daemon.");
+    // {{{ serialize
+    if (fdUnix != -1)
+    {
+      ssMessage.str("");
+      ssMessage << fdUnix;
+      ptState->insert("Unix", ssMessage.str());
+      inherited.push_back(fdUnix);
+    }
+    if (fdNotify != -1)
+    {
+      ssMessage.str("");
+      ssMessage << fdNotify;
+      ptState->insert("Notify", ssMessage.str());
+      inherited.push_back(fdNotify);
+    }
+    // job IDs keep counting so a client never confuses an old job with a new one
+    ssMessage.str("");
+    ssMessage << gunJobId;
+    ptState->insert("JobId", ssMessage.str());
+    ptState->m["Sockets"] = new Json;
+    for (map<int, vector<string> >::iterator i = sockets.begin(); i != sockets.end(); i++)
     {
-      if (i->second->nPid == ptInfo->si_pid)
+      Json *ptBuffers = new Json;
+      for (size_t j = 0; j < i->second.size(); j++)
       {
-        bUse = false;
+        Json *ptItem = new Json;
+        // binary framing may carry any byte so its buffers travel as hex
+        if (j < 2 && i->second.size() > 2 && i->second[2] == "binary")
+        {
+          frameHex(i->second[j], ptItem->v);
+        }
+        else
+        {
+          ptItem->v = i->second[j];
+        }
+        ptBuffers->l.push_back(ptItem);
       }
+      ssMessage.str("");
+      ssMessage << i->first;
+      ptState->m["Sockets"]->m[ssMessage.str()] = ptBuffers;
+      inherited.push_back(i->first);
     }
-    if (bUse)
+    ptState->m["Watchers"] = new Json;
+    for (list<watcher>::iterator i = gWatchers.begin(); i != gWatchers.end(); i++)
     {
-      string strError, strSignal;
-      stringstream ssMessage, ssPrefix;
-      ssPrefix << "sighandle(" << nSignal << ")";
+      Json *ptWatcher = new Json;
       ssMessage.str("");
-      ssMessage << ssPrefix.str() << ":  " << sigstring(strSignal, nSignal);
-      if (nSignal == SIGINT || nSignal == SIGTERM)
+      ssMessage << i->fdSocket;
+      ptWatcher->insert("Socket", ssMessage.str());
+      ptWatcher->insert("Service", i->strService);
+      if (i->bBinary)
       {
-        gpCentral->log(ssMessage.str());
+        ssMessage.str("");
+        ssMessage << i->tFrame.unId;
+        ptWatcher->insert("Id", ssMessage.str());
+        ssMessage.str("");
+        ssMessage << i->tFrame.usFunction;
+        ptWatcher->insert("Code", ssMessage.str());
       }
       else
       {
-        gpCentral->notify(ssMessage.str());
+        ptWatcher->insert("Prefix", i->strPrefix);
+      }
+      ptState->m["Watchers"]->l.push_back(ptWatcher);
+    }
+    ptState->m["Services"] = new Json;
+    for (unordered_map<string, service *>::iterator i = gServices.begin(); i != gServices.end(); i++)
+    {
+      healthCheckCancel(i->first);
+      ptState->m["Services"]->m[i->first] = new Json;
+      serviceSerialize(i->first, ptState->m["Services"]->m[i->first]);
+      inherited.insert(inherited.end(), i->second->listens.begin(), i->second->listens.end());
+      for (vector<pair<string, int> >::iterator j = i->second->fdstore.begin(); j != i->second->fdstore.end(); j++)
+      {
+        inherited.push_back(j->second);
+      }
+    }
+    ptState->json(strJson);
+    delete ptState;
+    // }}}
+    if (write(fdState, strJson.c_str(), strJson.size()) == (ssize_t)strJson.size())
+    {
+      for (list<int>::iterator i = inherited.begin(); i != inherited.end(); i++)
+      {
+        fcntl(*i, F_SETFD, 0);
+      }
+      ssMessage.str("");
+      ssMessage << "--upgrade=" << fdState;
+      for (int i = 0; unArgIndex < 98 && i < argc; i++)
+      {
+        string strArg = argv[i];
+        if (strArg != "-d" && strArg != "--daemon" && (strArg.size() <= 10 || strArg.substr(0, 10) != "--upgrade="))
+        {
+          args[unArgIndex++] = argv[i];
+        }
+      }
+      strUpgrade = ssMessage.str();
+      args[unArgIndex++] = (char *)strUpgrade.c_str();
+      args[unArgIndex] = NULL;
+      coreStop();
+      logStop();
+      execv(gstrBinary.c_str(), args);
+      ssMessage.str("");
+      ssMessage << "execv(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+      logStart();
+      coreStart();
+      for (list<int>::iterator i = inherited.begin(); i != inherited.end(); i++)
+      {
+        fcntl(*i, F_SETFD, FD_CLOEXEC);
+      }
+    }
+    else
+    {
+      ssMessage.str("");
+      ssMessage << "write(" << errno << ") " << strerror(errno);
+      strError = ssMessage.str();
+    }
+    close(fdState);
+  }
+  else
+  {
+    ssMessage.str("");
+    ssMessage << "memfd_create(" << errno << ") " << strerror(errno);
+    strError = ssMessage.str();
+  }
+
+  return bResult;
+}
+// }}}
+// {{{ watch
+// {{{ watchAdd()
+void watchAdd(const int fdSocket, const string strService, const string strPrefix, const frameHeader *ptFrame)
+{
+  watcher tWatcher;
+
+  tWatcher.bBinary = (ptFrame != NULL);
+  memset(&tWatcher.tFrame, 0, sizeof(frameHeader));
+  if (ptFrame != NULL)
+  {
+    tWatcher.tFrame = *ptFrame;
+  }
+  tWatcher.fdSocket = fdSocket;
+  tWatcher.strPrefix = strPrefix;
+  tWatcher.strService = strService;
+  gWatchers.push_back(tWatcher);
+}
+// }}}
+// {{{ watchPush()
+void watchPush(const journalEntry &tEntry)
+{
+  if (!gWatchers.empty())
+  {
+    string strJson, strService = ((tEntry.unService < gJournalNames.size())?gJournalNames[tEntry.unService]:"");
+    Json *ptEvent = new Json;
+    journalFormat(tEntry, ptEvent);
+    ptEvent->json(strJson);
+    // each event is another reply to the watch request so clients match it by the same ID
+    for (list<watcher>::iterator i = gWatchers.begin(); i != gWatchers.end(); i++)
+    {
+      if (i->strService.empty() || i->strService == strService)
+      {
+        if (i->bBinary)
+        {
+          frameReply(i->tFrame, true, "", ptEvent, gWatchBuffers[i->fdSocket]);
+        }
+        else
+        {
+          gWatchBuffers[i->fdSocket].append(i->strPrefix + (string)"\"Response\":" + strJson + (string)",\"Status\":\"okay\"}\n");
+        }
       }
-      gbShutdown = true;
     }
+    delete ptEvent;
+  }
+}
+// }}}
+// {{{ watchRemove()
+void watchRemove(const int fdSocket)
+{
+  for (list<watcher>::iterator i = gWatchers.begin(); i != gWatchers.end();)
+  {
+    if (i->fdSocket == fdSocket)
+    {
+      i = gWatchers.erase(i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+  gWatchBuffers.erase(fdSocket);
+}
+// }}}
+// {{{ watchReply()
+void watchReply(const watcher &tWatcher, const bool bProcessed, const string &strError, Json *ptResponse)
+{
+  string &strBuffer = gWatchBuffers[tWatcher.fdSocket];
+
+  if (tWatcher.bBinary)
+  {
+    frameReply(tWatcher.tFrame, bProcessed, strError, ptResponse, strBuffer);
+  }
+  else
+  {
+    string strJson;
+    strBuffer.append(tWatcher.strPrefix);
+    if (!strError.empty())
+    {
+      strBuffer.append("\"Error\":");
+      requestEscape(strBuffer, strError.c_str(), strError.size());
+      strBuffer.push_back(',');
+    }
+    if (ptResponse != NULL)
+    {
+      strBuffer.append("\"Response\":");
+      strBuffer.append(ptResponse->json(strJson));
+      strBuffer.push_back(',');
+    }
+    strBuffer.append((bProcessed)?"\"Status\":\"okay\"}\n":"\"Status\":\"error\"}\n");
   }
 }
 // }}}
+// }}}